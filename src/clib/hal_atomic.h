@@ -13,9 +13,14 @@
 #if GCC_VERSION > 40704
 #define ATOMIC_LOAD(x) __atomic_load_n((x), __ATOMIC_SEQ_CST)
 #define ATOMIC_STORE(x, v) __atomic_store_n((x), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_ACQUIRE(x) __atomic_load_n((x), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_RELEASE(x, v) __atomic_store_n((x), (v), __ATOMIC_RELEASE)
 #else
 #define ATOMIC_LOAD(x) ({__COMPILER_BARRIER(); *(x);})
 #define ATOMIC_STORE(x, v) ({__COMPILER_BARRIER(); *(x) = v; __sync_synchronize(); })
+// x86 keeps loads and stores in order, only the compiler has to
+#define ATOMIC_LOAD_ACQUIRE(x) ({__COMPILER_BARRIER(); __typeof__(*(x)) __v = *(x); __COMPILER_BARRIER(); __v;})
+#define ATOMIC_STORE_RELEASE(x, v) ({__COMPILER_BARRIER(); *(x) = v; })
 #endif
 
 #define CACHE_ALIGN_SIZE 64
@@ -30,6 +30,7 @@ namespace clib {
       switch_hour_(-1),
       switch_minute_(-1),
       check_file_exist_(false),
+      format_(HALLogFormats::HAL_LOG_FORMAT_TEXT),
       level_filter_(&level_filter_default_),
       level_string_(&level_string_default_) {
   }
@@ -139,6 +140,16 @@ namespace clib {
     return ret;
   }
 
+  int HALLog::set_format(const int32_t format) {
+    int ret = HAL_SUCCESS;
+    if (format < 0 || format >= HALLogFormats::HAL_LOG_FORMAT_END) {
+      ret = HAL_INVALID_PARAM;
+    } else {
+      format_ = format;
+    }
+    return ret;
+  }
+
   ////////////////////////////////////////////////////////////////////////////////////////////////////
   
   void HALLog::create_log_dir_(const char *file_name) {
@@ -235,30 +246,42 @@ namespace clib {
 
   ////////////////////////////////////////////////////////////////////////////////////////////////////
   
-  const char *HALLog::format_log_header_(
-      const char *module,
-      const int32_t level,
-      const char *file,
-      const int32_t line,
-      const char *function,
-      int64_t &header_length) {
-    static __thread char header[MAX_LOG_HEADER_SIZE];
+  // Large enough for any int field, as -Wformat-truncation assumes
+  static const int64_t LOG_TIME_SIZE = 128;
+
+  static inline void format_log_time_(char *buf, const int64_t size) {
     const struct tm *cur_tm = get_cur_tm();
     int64_t usec = get_cur_microseconds_time() % 1000000;
-    const char *base_file_name = strrchr(file, '/');
-    base_file_name = base_file_name ? base_file_name + 1 : file;
-    header_length = snprintf(header, MAX_LOG_HEADER_SIZE, "[%04d-%02d-%02d %02d:%02d:%02d.%06ld] "
-        "%s %s %s:%d:%s [%ld] ",
+    snprintf(buf, size, "%04d-%02d-%02d %02d:%02d:%02d.%06ld",
         cur_tm->tm_year + 1900,
         cur_tm->tm_mon + 1,
         cur_tm->tm_mday,
         cur_tm->tm_hour,
         cur_tm->tm_min,
         cur_tm->tm_sec,
-        usec,
+        usec);
+  }
+
+  static inline const char *get_base_file_name_(const char *file) {
+    const char *base_file_name = strrchr(file, '/');
+    return base_file_name ? base_file_name + 1 : file;
+  }
+
+  const char *HALLog::format_log_header_(
+      const char *module,
+      const int32_t level,
+      const char *file,
+      const int32_t line,
+      const char *function,
+      int64_t &header_length) {
+    static __thread char header[MAX_LOG_HEADER_SIZE];
+    char time_buf[LOG_TIME_SIZE];
+    format_log_time_(time_buf, sizeof(time_buf));
+    header_length = snprintf(header, MAX_LOG_HEADER_SIZE, "[%s] %s %s %s:%d:%s [%ld] ",
+        time_buf,
         level_string_->i_level_string(level),
         module,
-        base_file_name,
+        get_base_file_name_(file),
         line,
         function,
         gettid());
@@ -270,7 +293,42 @@ namespace clib {
     return header;
   }
 
+  // Escape src into buf from pos, cut on an escape sequence boundary at limit
+  static inline void append_json_string_(char *buf, int64_t &pos, const int64_t limit, const char *src) {
+    pos += json_escape(src, strlen(src), buf + pos, limit - pos);
+  }
+
+  const char *HALLog::format_json_log_header_(
+      const char *module,
+      const int32_t level,
+      const char *file,
+      const int32_t line,
+      const char *function,
+      int64_t &header_length) {
+    // Longest text following each escaped field, the fields are cut to leave
+    // room for it so that a truncated header is still a well formed prefix
+    static const int64_t FILE_RESERVE = sizeof("\",\"file\":\"") - 1;
+    static const int64_t LINE_RESERVE = sizeof("\",\"line\":-2147483648,\"function\":\"") - 1;
+    static const int64_t TID_RESERVE = sizeof("\",\"tid\":-9223372036854775808,\"msg\":\"") - 1;
+    // the last snprintf still needs room for its NUL
+    static const int64_t HEADER_LIMIT = MAX_LOG_HEADER_SIZE - 1;
+    static __thread char header[MAX_LOG_HEADER_SIZE];
+    char time_buf[LOG_TIME_SIZE];
+    format_log_time_(time_buf, sizeof(time_buf));
+    header_length = snprintf(header, MAX_LOG_HEADER_SIZE, "{\"time\":\"%s\",\"level\":\"%s\",\"module\":\"",
+        time_buf,
+        level_string_->i_level_string(level));
+    append_json_string_(header, header_length, HEADER_LIMIT - FILE_RESERVE - LINE_RESERVE - TID_RESERVE, module);
+    header_length += snprintf(header + header_length, MAX_LOG_HEADER_SIZE - header_length, "\",\"file\":\"");
+    append_json_string_(header, header_length, HEADER_LIMIT - LINE_RESERVE - TID_RESERVE, get_base_file_name_(file));
+    header_length += snprintf(header + header_length, MAX_LOG_HEADER_SIZE - header_length, "\",\"line\":%d,\"function\":\"", line);
+    append_json_string_(header, header_length, HEADER_LIMIT - TID_RESERVE, function);
+    header_length += snprintf(header + header_length, MAX_LOG_HEADER_SIZE - header_length, "\",\"tid\":%ld,\"msg\":\"", gettid());
+    return header;
+  }
+
   char NEWLINE[1] = {'\n'};
+  char JSON_TAIL[3] = {'"', '}', '\n'};
 
   void HALLog::write_log(
       const char *module,
@@ -297,17 +355,31 @@ namespace clib {
     }
 
     int64_t header_length = 0;
-    const char *header = format_log_header_(module, level, file, line, function, header_length);
+    const char *header = NULL;
+    const char *body = content;
+    const char *tail = NEWLINE;
+    int64_t tail_length = sizeof(NEWLINE);
+    if (HALLogFormats::HAL_LOG_FORMAT_JSON == format_) {
+      // worst case every byte expands to "\u00XX"
+      static __thread char escaped[MAX_LOG_CONTENT_SIZE * 6];
+      header = format_json_log_header_(module, level, file, line, function, header_length);
+      content_length = json_escape(content, content_length, escaped, sizeof(escaped));
+      body = escaped;
+      tail = JSON_TAIL;
+      tail_length = sizeof(JSON_TAIL);
+    } else {
+      header = format_log_header_(module, level, file, line, function, header_length);
+    }
 
     struct iovec vec[3];
     vec[0].iov_base = (void*)header;
     vec[0].iov_len = header_length;
-    vec[1].iov_base = content;
+    vec[1].iov_base = (void*)body;
     vec[1].iov_len = content_length;
-    vec[2].iov_base = NEWLINE;
-    vec[2].iov_len = sizeof(NEWLINE);
+    vec[2].iov_base = (void*)tail;
+    vec[2].iov_len = tail_length;
 
-    int64_t log_size = header_length + content_length + sizeof(NEWLINE);
+    int64_t log_size = header_length + content_length + tail_length;
     HALRLockGuard lock_guard;
     int fd = get_fd_(log_size, lock_guard);
     int64_t write_length = writev(fd, vec, ARRAYSIZE(vec));
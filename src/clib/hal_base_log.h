@@ -41,6 +41,15 @@ namespace clib {
       };
   };
 
+  class HALLogFormats {
+    public:
+      enum {
+        HAL_LOG_FORMAT_TEXT = 0,
+        HAL_LOG_FORMAT_JSON = 1,
+        HAL_LOG_FORMAT_END,
+      };
+  };
+
   ////////////////////////////////////////////////////////////////////////////////////////////////////
 
   class IHALLogLevelFilter {
@@ -119,6 +128,10 @@ namespace clib {
       int set_level_string(const IHALLogLevelString *level_string);
 
       int set_check_file_exist(const bool check_file_exist);
+
+      // HAL_LOG_FORMAT_TEXT: "[ts] LEVEL module file:line:func [tid] msg"
+      // HAL_LOG_FORMAT_JSON: one json object per line, header fields as keys
+      int set_format(const int32_t format);
     public:
       void write_log(
           const char *module,
@@ -149,6 +162,13 @@ namespace clib {
           const int32_t line,
           const char *function,
           int64_t &header_length);
+      const char *format_json_log_header_(
+          const char *module,
+          const int32_t level,
+          const char *file,
+          const int32_t line,
+          const char *function,
+          int64_t &header_length);
     private:
       HALSpinRWLock file_lock_;
       const char *file_name_;
@@ -161,6 +181,7 @@ namespace clib {
       int64_t switch_hour_;
       int64_t switch_minute_;
       bool check_file_exist_;
+      int32_t format_;
 
       HALLogLevelFilterDefault level_filter_default_;
       const IHALLogLevelFilter *level_filter_;
@@ -0,0 +1,358 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_CACHE_H__
+#define __HAL_CLIB_CACHE_H__
+#include <stdint.h>
+#include <assert.h>
+
+#include <new>
+#include <functional>
+
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_base_log.h"
+#include "clib/hal_util.h"
+#include "clib/hal_spin_lock.h"
+#include "clib/hal_hash_map.h"
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+  struct HALCacheStat {
+    // Totals since construction
+    int64_t hit_count_;
+    int64_t miss_count_;
+    int64_t eviction_count_;
+    int64_t entry_count_;
+    int64_t used_bytes_;
+    int64_t capacity_;
+  };
+
+  // Cache of a fixed byte budget with approximate LRU eviction. get() walks
+  // a bucket inside a HALHazardVersion critical section without any lock and
+  // sets the referenced bit of the entry it hits. put() and erase() lock one
+  // bucket. When a put() goes over the budget, the CLOCK hand sweeps the
+  // buckets, clearing referenced bits and evicting entries found clear.
+  // Evicted entries are freed once no reader can hold them and stay charged
+  // until then, the put() reclaims them right after evicting, so the budget
+  // is only exceeded by the entries readers still stand on.
+  template <class K, class V, class HashFunc = HALHash<K>, class EqualFunc = std::equal_to<K> >
+  class HALCache {
+    // A new entry is not referenced, it earns a second chance from the hand
+    // by a hit, so a scan of cold keys does not push out the hot ones.
+    struct Entry {
+      Entry(const uint64_t hash, const K &key, const V &value, const int64_t charge)
+        : next_(NULL), hash_(hash), charge_(charge), referenced_(false), key_(key), value_(value) {}
+      Entry *next_;
+      uint64_t hash_;
+      int64_t charge_;
+      bool referenced_;
+      K key_;
+      V value_;
+    };
+    struct Bucket {
+      Bucket() : lock_(), head_(NULL) {}
+      HALSpinLock lock_;
+      Entry *head_;
+    };
+    // Lookups of threads on different stripes do not share a cache line
+    struct Counter {
+      int64_t hit_count_;
+      int64_t miss_count_;
+    } CACHE_ALIGNED;
+    public:
+      static const int64_t MIN_BUCKET_COUNT = 16;
+      static const int64_t COUNTER_STRIPE = 64;
+    public:
+      // capacity is in bytes, entries are charged their own size plus the
+      // charge passed to put(). bucket_count is rounded up to a power of 2.
+      HALCache(
+        const int64_t capacity,
+        const int64_t bucket_count = 1024,
+        const HashFunc &hash_func = HashFunc(),
+        const EqualFunc &equal_func = EqualFunc());
+      ~HALCache();
+    public:
+      // Insert or overwrite, evicting others until the entry fits.
+      // HAL_OVER_MEMORY_LIMIT if it would not fit in an empty cache.
+      int put(const K &key, const V &value, const int64_t charge = 0);
+      // HAL_ENTRY_NOT_EXIST on miss
+      int get(const K &key, V &value);
+      int erase(const K &key);
+      // Free the replaced, erased and evicted entries no reader holds anymore,
+      // put() does it by itself only when over the budget.
+      void reclaim();
+      int64_t size() const;
+      // Entries unlinked but not freed yet are included
+      int64_t get_used_bytes() const;
+      void get_stat(HALCacheStat &stat) const;
+    private:
+      Bucket &get_bucket_(const uint64_t hash) { return buckets_[hash & (bucket_count_ - 1)]; }
+      Counter &get_counter_() { return counters_[gettn() & (COUNTER_STRIPE - 1)]; }
+      void evict_();
+      void unlink_(Entry **link);
+      void uncharge_(const int64_t charge);
+      static void free_entry_(void *ptr, void *arg);
+    private:
+      HALCache(const HALCache &);
+      HALCache &operator =(const HALCache &);
+    private:
+      HashFunc hash_func_;
+      EqualFunc equal_func_;
+      int64_t capacity_;
+      int64_t bucket_count_;
+      Bucket *buckets_;
+      HALHazardVersion hazard_version_;
+      int64_t hand_ CACHE_ALIGNED;
+      int64_t used_bytes_ CACHE_ALIGNED;
+      // Part of used_bytes_ unlinked and waiting for readers to leave
+      int64_t retiring_bytes_;
+      int64_t count_;
+      int64_t eviction_count_;
+      Counter counters_[COUNTER_STRIPE];
+  };
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  const int64_t HALCache<K, V, HashFunc, EqualFunc>::MIN_BUCKET_COUNT;
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  const int64_t HALCache<K, V, HashFunc, EqualFunc>::COUNTER_STRIPE;
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  HALCache<K, V, HashFunc, EqualFunc>::HALCache(
+    const int64_t capacity,
+    const int64_t bucket_count,
+    const HashFunc &hash_func,
+    const EqualFunc &equal_func)
+    : hash_func_(hash_func),
+      equal_func_(equal_func),
+      capacity_(capacity),
+      bucket_count_(MIN_BUCKET_COUNT),
+      buckets_(NULL),
+      hazard_version_(),
+      hand_(0),
+      used_bytes_(0),
+      retiring_bytes_(0),
+      count_(0),
+      eviction_count_(0) {
+    while (bucket_count_ < bucket_count) {
+      bucket_count_ <<= 1;
+    }
+    buckets_ = (Bucket*)hal_malloc(sizeof(Bucket) * bucket_count_, HALModIds::CACHE);
+    assert(NULL != buckets_);
+    for (int64_t i = 0; i < bucket_count_; i++) {
+      new(&buckets_[i]) Bucket();
+    }
+    for (int64_t i = 0; i < COUNTER_STRIPE; i++) {
+      counters_[i].hit_count_ = 0;
+      counters_[i].miss_count_ = 0;
+    }
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  HALCache<K, V, HashFunc, EqualFunc>::~HALCache() {
+    hazard_version_.retire();
+    for (int64_t i = 0; i < bucket_count_; i++) {
+      Bucket &bucket = buckets_[i];
+      while (NULL != bucket.head_) {
+        Entry *entry = bucket.head_;
+        bucket.head_ = entry->next_;
+        entry->~Entry();
+        hal_free(entry);
+      }
+    }
+    hal_free(buckets_);
+    buckets_ = NULL;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int HALCache<K, V, HashFunc, EqualFunc>::put(const K &key, const V &value, const int64_t charge) {
+    int ret = HAL_SUCCESS;
+    const uint64_t hash = hash_func_(key);
+    const int64_t total_charge = (int64_t)sizeof(Entry) + charge;
+    Entry *entry = NULL;
+    if (0 > charge
+        || capacity_ < total_charge) {
+      LOG_WARN(CLIB, "entry does not fit, charge=%ld capacity=%ld", charge, capacity_);
+      ret = HAL_OVER_MEMORY_LIMIT;
+    } else if (NULL == (entry = (Entry*)hal_malloc(sizeof(Entry), HALModIds::CACHE))) {
+      LOG_WARN(CLIB, "alloc entry fail");
+      ret = HAL_ALLOCATE_FAIL;
+    } else {
+      // No critical section here, every entry touched is under its bucket
+      // lock, and one would keep evict_() from reclaiming what it evicted
+      new(entry) Entry(hash, key, value, total_charge);
+      // Reserve first, so that concurrent puts each evict their own share
+      if (capacity_ < __sync_add_and_fetch(&used_bytes_, total_charge)) {
+        evict_();
+      }
+      Bucket &bucket = get_bucket_(hash);
+      bucket.lock_.lock();
+      Entry **link = &bucket.head_;
+      while (NULL != *link
+            && !(hash == (*link)->hash_ && equal_func_(key, (*link)->key_))) {
+        link = &(*link)->next_;
+      }
+      if (NULL != *link) {
+        unlink_(link);
+      }
+      entry->next_ = bucket.head_;
+      ATOMIC_STORE(&bucket.head_, entry);
+      __sync_add_and_fetch(&count_, 1);
+      bucket.lock_.unlock();
+    }
+    return ret;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int HALCache<K, V, HashFunc, EqualFunc>::get(const K &key, V &value) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    const uint64_t hash = hash_func_(key);
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      Entry *entry = ATOMIC_LOAD(&get_bucket_(hash).head_);
+      while (NULL != entry
+            && !(hash == entry->hash_ && equal_func_(key, entry->key_))) {
+        entry = ATOMIC_LOAD(&entry->next_);
+      }
+      Counter &counter = get_counter_();
+      if (NULL == entry) {
+        ret = HAL_ENTRY_NOT_EXIST;
+        __sync_add_and_fetch(&counter.miss_count_, 1);
+      } else {
+        value = entry->value_;
+        // only store when clear, hot entries are not written on every hit
+        if (!ATOMIC_LOAD(&entry->referenced_)) {
+          ATOMIC_STORE(&entry->referenced_, true);
+        }
+        __sync_add_and_fetch(&counter.hit_count_, 1);
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int HALCache<K, V, HashFunc, EqualFunc>::erase(const K &key) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    const uint64_t hash = hash_func_(key);
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      Bucket &bucket = get_bucket_(hash);
+      bucket.lock_.lock();
+      Entry **link = &bucket.head_;
+      while (NULL != *link
+            && !(hash == (*link)->hash_ && equal_func_(key, (*link)->key_))) {
+        link = &(*link)->next_;
+      }
+      if (NULL == *link) {
+        ret = HAL_ENTRY_NOT_EXIST;
+      } else {
+        unlink_(link);
+      }
+      bucket.lock_.unlock();
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALCache<K, V, HashFunc, EqualFunc>::reclaim() {
+    hazard_version_.retire();
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int64_t HALCache<K, V, HashFunc, EqualFunc>::size() const {
+    return ATOMIC_LOAD(&count_);
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int64_t HALCache<K, V, HashFunc, EqualFunc>::get_used_bytes() const {
+    return ATOMIC_LOAD(&used_bytes_);
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALCache<K, V, HashFunc, EqualFunc>::get_stat(HALCacheStat &stat) const {
+    stat.hit_count_ = 0;
+    stat.miss_count_ = 0;
+    for (int64_t i = 0; i < COUNTER_STRIPE; i++) {
+      stat.hit_count_ += ATOMIC_LOAD(&counters_[i].hit_count_);
+      stat.miss_count_ += ATOMIC_LOAD(&counters_[i].miss_count_);
+    }
+    stat.eviction_count_ = ATOMIC_LOAD(&eviction_count_);
+    stat.entry_count_ = ATOMIC_LOAD(&count_);
+    stat.used_bytes_ = ATOMIC_LOAD(&used_bytes_);
+    stat.capacity_ = capacity_;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALCache<K, V, HashFunc, EqualFunc>::evict_() {
+    // Two full turns clear every referenced bit, entries hit again that
+    // often are then evicted regardless so that the budget holds. Evicted
+    // entries still waiting to be freed are not evicted again, so the hand
+    // stops once the linked ones fit and the reclaim below does the rest.
+    const int64_t force_after = 2 * bucket_count_;
+    for (int64_t i = 0;
+        capacity_ < ATOMIC_LOAD(&used_bytes_) - ATOMIC_LOAD(&retiring_bytes_)
+        && 0 < ATOMIC_LOAD(&count_);
+        i++) {
+      Bucket &bucket = buckets_[__sync_fetch_and_add(&hand_, 1) & (bucket_count_ - 1)];
+      bucket.lock_.lock();
+      Entry **link = &bucket.head_;
+      while (NULL != *link
+            && capacity_ < ATOMIC_LOAD(&used_bytes_) - ATOMIC_LOAD(&retiring_bytes_)) {
+        if (force_after > i
+            && ATOMIC_LOAD(&(*link)->referenced_)) {
+          ATOMIC_STORE(&(*link)->referenced_, false);
+          link = &(*link)->next_;
+        } else {
+          unlink_(link);
+          __sync_add_and_fetch(&eviction_count_, 1);
+        }
+      }
+      bucket.lock_.unlock();
+    }
+    if (capacity_ < ATOMIC_LOAD(&used_bytes_)) {
+      reclaim();
+    }
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALCache<K, V, HashFunc, EqualFunc>::unlink_(Entry **link) {
+    // readers standing on entry still find their way by entry->next_
+    Entry *entry = *link;
+    ATOMIC_STORE(link, entry->next_);
+    __sync_add_and_fetch(&count_, -1);
+    // charged until free_entry_ runs
+    __sync_add_and_fetch(&retiring_bytes_, entry->charge_);
+    int tmp_ret = hazard_version_.add_node(entry, free_entry_, this, sizeof(Entry));
+    if (HAL_SUCCESS != tmp_ret) {
+      LOG_WARN(CLIB, "add_node fail, entry leaked, ret=%d", tmp_ret);
+    }
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALCache<K, V, HashFunc, EqualFunc>::uncharge_(const int64_t charge) {
+    __sync_add_and_fetch(&retiring_bytes_, -charge);
+    __sync_add_and_fetch(&used_bytes_, -charge);
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALCache<K, V, HashFunc, EqualFunc>::free_entry_(void *ptr, void *arg) {
+    Entry *entry = (Entry*)ptr;
+    ((HALCache*)arg)->uncharge_(entry->charge_);
+    entry->~Entry();
+    hal_free(entry);
+  }
+
+}
+}
+
+#endif // __HAL_CLIB_CACHE_H__
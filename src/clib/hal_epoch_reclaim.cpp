@@ -0,0 +1,172 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include "clib/hal_epoch_reclaim.h"
+
+namespace libhalog {
+namespace clib {
+namespace epoch_reclaim {
+  ThreadStore::ThreadStore()
+    : enabled_(false),
+      tid_(0),
+      acquire_depth_(0),
+      state_(0),
+      hazard_waiting_count_(0),
+      next_(NULL) {
+    for (int64_t i = 0; i < LIMBO_COUNT; i++) {
+      limbos_[i].head_ = NULL;
+      limbos_[i].count_ = 0;
+      limbos_[i].epoch_ = UINT64_MAX;
+    }
+  }
+
+  ThreadStore::~ThreadStore() {
+    for (int64_t i = 0; i < LIMBO_COUNT; i++) {
+      retire_limbo_(limbos_[i]);
+    }
+  }
+
+  void ThreadStore::set_enabled(const uint16_t tid) {
+    tid_ = tid;
+    ATOMIC_STORE(&enabled_, true);
+  }
+
+  bool ThreadStore::is_enabled() const {
+    return ATOMIC_LOAD(&enabled_);
+  }
+
+  uint16_t ThreadStore::get_tid() const {
+    return tid_;
+  }
+
+  void ThreadStore::set_next(ThreadStore *ts) {
+    next_ = ts;
+  }
+
+  ThreadStore *ThreadStore::get_next() const {
+    return next_;
+  }
+
+  bool ThreadStore::nested_acquire() {
+    assert(tid_ == gettn());
+    bool bret = false;
+    if (0 < acquire_depth_) {
+      acquire_depth_++;
+      bret = true;
+    }
+    return bret;
+  }
+
+  void ThreadStore::acquire(const uint64_t epoch) {
+    assert(tid_ == gettn());
+    // Full barrier, must be visible before any shared read in the critical section
+    ATOMIC_STORE(&state_, (epoch << 1) | 1);
+    acquire_depth_ = 1;
+  }
+
+  bool ThreadStore::release() {
+    assert(tid_ == gettn());
+    bool bret = false;
+    if (1 < acquire_depth_) {
+      acquire_depth_--;
+    } else {
+      acquire_depth_ = 0;
+      ATOMIC_STORE(&state_, (uint64_t)0);
+      bret = true;
+    }
+    return bret;
+  }
+
+  void ThreadStore::force_release() {
+    assert(tid_ == gettn());
+    acquire_depth_ = 0;
+    ATOMIC_STORE(&state_, (uint64_t)0);
+  }
+
+  bool ThreadStore::is_quiescent(const uint64_t epoch) const {
+    uint64_t state = ATOMIC_LOAD(&state_);
+    return (0 == (state & 1) || epoch == (state >> 1));
+  }
+
+  void ThreadStore::add_node(const uint64_t epoch, HALHazardNodeI *node) {
+    assert(tid_ == gettn());
+    Limbo &limbo = limbos_[epoch % LIMBO_COUNT];
+    if (epoch != limbo.epoch_) {
+      // The bucket holds nodes of epoch-3 or older, all of them are safe now
+      retire_limbo_(limbo);
+      limbo.epoch_ = epoch;
+    }
+    node->__set_next__(limbo.head_);
+    limbo.head_ = node;
+    limbo.count_++;
+    ATOMIC_STORE(&hazard_waiting_count_, hazard_waiting_count_ + 1);
+  }
+
+  int64_t ThreadStore::get_hazard_waiting_count() const {
+    return ATOMIC_LOAD(&hazard_waiting_count_);
+  }
+
+  int64_t ThreadStore::retire(const uint64_t epoch) {
+    assert(!is_enabled() || tid_ == gettn());
+    int64_t retire_count = 0;
+    for (int64_t i = 0; i < LIMBO_COUNT; i++) {
+      if (UINT64_MAX != limbos_[i].epoch_
+          && (limbos_[i].epoch_ + 2) <= epoch) {
+        retire_count += retire_limbo_(limbos_[i]);
+      }
+    }
+    return retire_count;
+  }
+
+  void ThreadStore::hand_off(ThreadStore &orphans) {
+    assert(tid_ == gettn());
+    for (int64_t i = 0; i < LIMBO_COUNT; i++) {
+      Limbo &limbo = limbos_[i];
+      Limbo &dest = orphans.limbos_[i];
+      if (NULL == limbo.head_) {
+        // nothing to move
+      } else if (UINT64_MAX != dest.epoch_
+                && dest.epoch_ > limbo.epoch_) {
+        // Older than dest by a multiple of LIMBO_COUNT, safe already
+        retire_limbo_(limbo);
+      } else {
+        if (UINT64_MAX != dest.epoch_
+            && dest.epoch_ < limbo.epoch_) {
+          orphans.retire_limbo_(dest);
+        }
+        HALHazardNodeI *tail = limbo.head_;
+        while (NULL != tail->__get_next__()) {
+          tail = tail->__get_next__();
+        }
+        tail->__set_next__(dest.head_);
+        dest.head_ = limbo.head_;
+        dest.count_ += limbo.count_;
+        dest.epoch_ = limbo.epoch_;
+        ATOMIC_STORE(&orphans.hazard_waiting_count_, orphans.hazard_waiting_count_ + limbo.count_);
+        ATOMIC_STORE(&hazard_waiting_count_, hazard_waiting_count_ - limbo.count_);
+        limbo.head_ = NULL;
+        limbo.count_ = 0;
+      }
+      limbo.epoch_ = UINT64_MAX;
+    }
+  }
+
+  int64_t ThreadStore::retire_limbo_(Limbo &limbo) {
+    int64_t retire_count = limbo.count_;
+    HALHazardNodeI *iter = limbo.head_;
+    limbo.head_ = NULL;
+    limbo.count_ = 0;
+    limbo.epoch_ = UINT64_MAX;
+    while (NULL != iter) {
+      HALHazardNodeI *node2retire = iter;
+      iter = iter->__get_next__();
+      node2retire->retire();
+    }
+    if (0 < retire_count) {
+      ATOMIC_STORE(&hazard_waiting_count_, hazard_waiting_count_ - retire_count);
+    }
+    return retire_count;
+  }
+}
+}
+}
@@ -0,0 +1,279 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_EPOCH_RECLAIM_H__
+#define __HAL_CLIB_EPOCH_RECLAIM_H__
+#include <stdint.h>
+
+#include "clib/hal_define.h"
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_base_log.h"
+#include "clib/hal_spin_lock.h"
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+namespace epoch_reclaim {
+  // Epoch based reclamation with three epochs. A node retired in epoch E may
+  // still be seen by threads active in E or E-1, and is safe once the global
+  // epoch reaches E+2. Limbo lists are only touched by the owner thread.
+  class ThreadStore {
+    static const int64_t LIMBO_COUNT = 3;
+    struct Limbo {
+      HALHazardNodeI *head_;
+      int64_t count_;
+      uint64_t epoch_;
+    };
+    public:
+      ThreadStore();
+      ~ThreadStore();
+    public:
+      void set_enabled(const uint16_t tid);
+      bool is_enabled() const;
+      uint16_t get_tid() const;
+
+      void set_next(ThreadStore *ts);
+      ThreadStore *get_next() const;
+
+      bool nested_acquire();
+      void acquire(const uint64_t epoch);
+      // Return true if the outermost critical section is left
+      bool release();
+      // Leave the critical section of an exiting thread, whatever the depth is
+      void force_release();
+      // Return false if the thread is active in an epoch other than epoch
+      bool is_quiescent(const uint64_t epoch) const;
+
+      void add_node(const uint64_t epoch, HALHazardNodeI *node);
+      int64_t get_hazard_waiting_count() const;
+      // Called by the owner, or on a store of no thread under its lock
+      int64_t retire(const uint64_t epoch);
+      // Move the limbo lists of an exiting thread to orphans, a store of no
+      // thread, the caller holds the lock of orphans
+      void hand_off(ThreadStore &orphans);
+    private:
+      int64_t retire_limbo_(Limbo &limbo);
+    private:
+      bool enabled_;
+      uint16_t tid_;
+      int64_t acquire_depth_;
+
+      // (epoch << 1) | active
+      uint64_t state_ CACHE_ALIGNED;
+
+      Limbo limbos_[LIMBO_COUNT] CACHE_ALIGNED;
+      int64_t hazard_waiting_count_;
+
+      ThreadStore *next_ CACHE_ALIGNED;
+  };
+}
+
+  ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // Same interface as HALHazardVersionT, so containers can be templated on the
+  // reclamation scheme.
+  template <uint16_t MaxThreadCnt>
+  class HALEpochReclaimT {
+    public:
+      HALEpochReclaimT(const int64_t thread_waiting_threshold = 64);
+      ~HALEpochReclaimT();
+    public:
+      int add_node(HALHazardNodeI *node);
+      int acquire(uint64_t &handle);
+      void release(const uint64_t handle);
+      void retire();
+      int64_t get_hazard_waiting_count() const;
+    private:
+      class ExitHook : public HALThreadExitHook {
+        public:
+          explicit ExitHook(HALEpochReclaimT &host) : host_(host) {}
+          void on_thread_exit(const int64_t tn) { host_.on_thread_exit_(tn); }
+        private:
+          HALEpochReclaimT &host_;
+      };
+    private:
+      int get_thread_store_(epoch_reclaim::ThreadStore *&ts);
+      bool try_advance_();
+      void on_thread_exit_(const int64_t tn);
+      void retire_orphans_();
+    private:
+      int64_t thread_waiting_threshold_;
+      ExitHook exit_hook_;
+
+      uint64_t epoch_ CACHE_ALIGNED;
+
+      HALSpinLock thread_lock_ CACHE_ALIGNED;
+      epoch_reclaim::ThreadStore threads_[MaxThreadCnt];
+      epoch_reclaim::ThreadStore *thread_list_;
+
+      // Limbo lists left by exited threads
+      HALSpinLock orphan_lock_ CACHE_ALIGNED;
+      epoch_reclaim::ThreadStore orphans_;
+  };
+
+  typedef HALEpochReclaimT<HAL_MAX_THREAD_COUNT> HALEpochReclaim;
+
+  ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  template <uint16_t MaxThreadCnt>
+  HALEpochReclaimT<MaxThreadCnt>::HALEpochReclaimT(const int64_t thread_waiting_threshold)
+    : thread_waiting_threshold_(thread_waiting_threshold),
+      exit_hook_(*this),
+      epoch_(0),
+      thread_lock_(),
+      thread_list_(NULL),
+      orphan_lock_(),
+      orphans_() {
+    gsi<HALThreadRegistry>().add_exit_hook(&exit_hook_);
+  }
+
+  template <uint16_t MaxThreadCnt>
+  HALEpochReclaimT<MaxThreadCnt>::~HALEpochReclaimT() {
+    gsi<HALThreadRegistry>().del_exit_hook(&exit_hook_);
+    // ThreadStore destructor retires all limbo lists
+  }
+
+  template <uint16_t MaxThreadCnt>
+  int HALEpochReclaimT<MaxThreadCnt>::add_node(HALHazardNodeI *node) {
+    int ret = HAL_SUCCESS;
+    epoch_reclaim::ThreadStore *ts = NULL;
+    if (NULL == node) {
+      LOG_WARN(CLIB, "invalid param, node null pointer");
+      ret = HAL_INVALID_PARAM;
+    } else if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
+      LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
+    } else {
+      ts->add_node(ATOMIC_LOAD(&epoch_), node);
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  int HALEpochReclaimT<MaxThreadCnt>::acquire(uint64_t &handle) {
+    int ret = HAL_SUCCESS;
+    epoch_reclaim::ThreadStore *ts = NULL;
+    if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
+      LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
+    } else {
+      if (!ts->nested_acquire()) {
+        ts->acquire(ATOMIC_LOAD(&epoch_));
+      }
+      handle = ts->get_tid();
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  void HALEpochReclaimT<MaxThreadCnt>::release(const uint64_t handle) {
+    if (MaxThreadCnt > handle) {
+      epoch_reclaim::ThreadStore *ts = &threads_[handle];
+      if (ts->release()
+          && thread_waiting_threshold_ < ts->get_hazard_waiting_count()) {
+        try_advance_();
+        ts->retire(ATOMIC_LOAD(&epoch_));
+        retire_orphans_();
+      }
+    }
+  }
+
+  template <uint16_t MaxThreadCnt>
+  void HALEpochReclaimT<MaxThreadCnt>::retire() {
+    int ret = HAL_SUCCESS;
+    epoch_reclaim::ThreadStore *ts = NULL;
+    if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
+      LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
+    } else {
+      // Nodes of the current epoch need two advances to become safe
+      if (try_advance_()) {
+        try_advance_();
+      }
+      ts->retire(ATOMIC_LOAD(&epoch_));
+      retire_orphans_();
+    }
+  }
+
+  template <uint16_t MaxThreadCnt>
+  int64_t HALEpochReclaimT<MaxThreadCnt>::get_hazard_waiting_count() const {
+    int64_t ret = orphans_.get_hazard_waiting_count();
+    epoch_reclaim::ThreadStore *iter = ATOMIC_LOAD(&thread_list_);
+    while (NULL != iter) {
+      ret += iter->get_hazard_waiting_count();
+      iter = iter->get_next();
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  int HALEpochReclaimT<MaxThreadCnt>::get_thread_store_(epoch_reclaim::ThreadStore *&ts) {
+    int ret = HAL_SUCCESS;
+    int64_t tn = gettn();
+    if (MaxThreadCnt <= tn) {
+      LOG_WARN(CLIB, "thread number overflow, tn=%ld", tn);
+      ret = HAL_TOO_MANY_THREADS;
+    } else {
+      ts = &threads_[tn];
+      if (!ts->is_enabled()) {
+        thread_lock_.lock();
+        if (!ts->is_enabled()) {
+          ts->set_enabled((uint16_t)tn);
+          ts->set_next(ATOMIC_LOAD(&thread_list_));
+          ATOMIC_STORE(&thread_list_, ts);
+        }
+        thread_lock_.unlock();
+      }
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  bool HALEpochReclaimT<MaxThreadCnt>::try_advance_() {
+    bool bret = true;
+    uint64_t epoch = ATOMIC_LOAD(&epoch_);
+    epoch_reclaim::ThreadStore *iter = ATOMIC_LOAD(&thread_list_);
+    while (NULL != iter) {
+      if (!iter->is_quiescent(epoch)) {
+        bret = false;
+        break;
+      }
+      iter = iter->get_next();
+    }
+    if (bret) {
+      bret = __sync_bool_compare_and_swap(&epoch_, epoch, epoch + 1);
+    }
+    return bret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  void HALEpochReclaimT<MaxThreadCnt>::on_thread_exit_(const int64_t tn) {
+    // The exited thread must not hold the epoch back, and its limbo lists
+    // must not wait for the next thread reusing tn
+    if (0 <= tn
+        && MaxThreadCnt > tn
+        && threads_[tn].is_enabled()) {
+      epoch_reclaim::ThreadStore *ts = &threads_[tn];
+      ts->force_release();
+      if (try_advance_()) {
+        try_advance_();
+      }
+      ts->retire(ATOMIC_LOAD(&epoch_));
+      orphan_lock_.lock();
+      ts->hand_off(orphans_);
+      orphan_lock_.unlock();
+    }
+  }
+
+  template <uint16_t MaxThreadCnt>
+  void HALEpochReclaimT<MaxThreadCnt>::retire_orphans_() {
+    if (0 < orphans_.get_hazard_waiting_count()
+        && orphan_lock_.try_lock()) {
+      orphans_.retire(ATOMIC_LOAD(&epoch_));
+      orphan_lock_.unlock();
+    }
+  }
+}
+}
+
+#endif // __HAL_CLIB_EPOCH_RECLAIM_H__
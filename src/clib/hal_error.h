@@ -11,6 +11,10 @@ HAL_ERROR_DEF(HAL_EBUSY)                //-9995
 HAL_ERROR_DEF(HAL_TOO_MANY_THREADS)     //-9994
 HAL_ERROR_DEF(HAL_QUEUE_FULL)           //-9993
 HAL_ERROR_DEF(HAL_QUEUE_EMPTY)          //-9992
+HAL_ERROR_DEF(HAL_OVER_MEMORY_LIMIT)    //-9991
+HAL_ERROR_DEF(HAL_ENTRY_NOT_EXIST)      //-9990
+HAL_ERROR_DEF(HAL_ENTRY_EXIST)          //-9989
+HAL_ERROR_DEF(HAL_TIMEOUT)              //-9988
 #endif
 
 #ifndef __HAL_CLIB_ERROR_H__
@@ -0,0 +1,72 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <errno.h>
+#include <linux/futex.h>
+#include "clib/hal_error.h"
+#include "clib/hal_util.h"
+#include "clib/hal_event_count.h"
+
+namespace libhalog {
+namespace clib {
+
+  HALEventCount::HALEventCount()
+    : epoch_(0),
+      waiters_(0) {
+  }
+
+  HALEventCount::~HALEventCount() {
+  }
+
+  uint32_t HALEventCount::prepare_wait() {
+    // locked add, the check of the condition after it can not move up
+    __sync_add_and_fetch(&waiters_, 1);
+    return ATOMIC_LOAD(&epoch_);
+  }
+
+  void HALEventCount::cancel_wait() {
+    __sync_sub_and_fetch(&waiters_, 1);
+  }
+
+  int HALEventCount::wait(const uint32_t key, const int64_t deadline) {
+    int ret = HAL_SUCCESS;
+    while (key == ATOMIC_LOAD(&epoch_)) {
+      int64_t timeout = deadline - get_monotonic_microseconds_time();
+      if (0 >= timeout) {
+        ret = HAL_TIMEOUT;
+        break;
+      }
+      // returns at once with EAGAIN if epoch_ is not key any more
+      timespec ts = microseconds_to_ts(timeout);
+      if (0 != syscall(SYS_futex, &epoch_, FUTEX_WAIT_PRIVATE, key, &ts, NULL, 0)
+          && EAGAIN != errno
+          && EINTR != errno
+          && ETIMEDOUT != errno) {
+        ret = HAL_ERROR;
+        break;
+      }
+    }
+    __sync_sub_and_fetch(&waiters_, 1);
+    return ret;
+  }
+
+  void HALEventCount::notify() {
+    wake_(1);
+  }
+
+  void HALEventCount::notify_all() {
+    wake_(INT32_MAX);
+  }
+
+  void HALEventCount::wake_(const int32_t count) {
+    // orders the write making the condition true before the load of waiters_,
+    // pairs with the locked add of prepare_wait()
+    __sync_synchronize();
+    if (0 != ATOMIC_LOAD(&waiters_)) {
+      __sync_add_and_fetch(&epoch_, 1);
+      syscall(SYS_futex, &epoch_, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+    }
+  }
+
+}
+}
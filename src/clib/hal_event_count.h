@@ -0,0 +1,51 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_EVENT_COUNT_H__
+#define __HAL_CLIB_EVENT_COUNT_H__
+#include <stdint.h>
+
+namespace libhalog {
+namespace clib {
+
+  // Eventcount over futex, lets a lock-free structure park the threads
+  // waiting for a condition without a lock on its fast path:
+  //   uint32_t key = ec.prepare_wait();
+  //   if (condition is true now) {
+  //     ec.cancel_wait();
+  //   } else {
+  //     ec.wait(key, deadline);
+  //   }
+  // The other side makes the condition true and then calls notify() or
+  // notify_all(), which issue FUTEX_WAKE only if a waiter is registered.
+  class HALEventCount {
+    public:
+      HALEventCount();
+      ~HALEventCount();
+    public:
+      // Register as a waiter, the condition must be checked again after it
+      uint32_t prepare_wait();
+      void cancel_wait();
+      // Sleep until a notify_all() after prepare_wait() returned key, and
+      // unregister. deadline is in microseconds of
+      // get_monotonic_microseconds_time(), HAL_TIMEOUT if it passes first.
+      int wait(const uint32_t key, const int64_t deadline);
+      // Wake one or every waiter, only a full fence and a load if there is
+      // none. A waiter woken by notify() may time out at the same moment, it
+      // has to check the condition once more then.
+      void notify();
+      void notify_all();
+    private:
+      void wake_(const int32_t count);
+    private:
+      HALEventCount(const HALEventCount &);
+      HALEventCount &operator =(const HALEventCount &);
+    private:
+      uint32_t epoch_;
+      uint32_t waiters_;
+  };
+
+}
+}
+
+#endif // __HAL_CLIB_EVENT_COUNT_H__
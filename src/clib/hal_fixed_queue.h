@@ -4,16 +4,43 @@
 #ifndef __HAL_CLIB_FIXED_QUEUE_H__
 #define __HAL_CLIB_FIXED_QUEUE_H__
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
+#include <algorithm>
+
 #include "clib/hal_error.h"
 #include "clib/hal_atomic.h"
 #include "clib/hal_malloc.h"
 #include "clib/hal_mod_define.h"
+#include "clib/hal_event_count.h"
 
 namespace libhalog {
 namespace clib {
-  template <class T>
+  // Topology policies of HALFixedQueue, a call site switches by typedef:
+  //   typedef HALFixedQueue<Task, HALQueueSPSC> TaskQueue;
+  // A single side owns its position and moves it by a plain store instead
+  // of a CAS. SPSC does not look at the slots at all, each side checks the
+  // position of the other, cached and reloaded only when the queue seems
+  // full or empty.
+  struct HALQueueMPMC {
+    static const bool SINGLE_PRODUCER = false;
+    static const bool SINGLE_CONSUMER = false;
+  };
+  struct HALQueueMPSC {
+    static const bool SINGLE_PRODUCER = false;
+    static const bool SINGLE_CONSUMER = true;
+  };
+  struct HALQueueSPMC {
+    static const bool SINGLE_PRODUCER = true;
+    static const bool SINGLE_CONSUMER = false;
+  };
+  struct HALQueueSPSC {
+    static const bool SINGLE_PRODUCER = true;
+    static const bool SINGLE_CONSUMER = true;
+  };
+
+  template <class T, class Policy = HALQueueMPMC>
   class HALFixedQueue {
     struct Node {
       T data_;
@@ -25,90 +52,383 @@ namespace clib {
     public:
       int push(const T &data);
       int pop(T &data);
+      // Claim up to count slots with one CAS and fill or drain them, in order.
+      // push_count/pop_count is how many are done, HAL_QUEUE_FULL/EMPTY if 0.
+      int push_n(const T *datas, const int64_t count, int64_t &push_count);
+      int pop_n(T *datas, const int64_t count, int64_t &pop_count);
+      // Spin a while and then sleep while the queue is full or empty.
+      // deadline is in microseconds of get_monotonic_microseconds_time(),
+      // HAL_TIMEOUT if it passes first. Every successful push or pop of the
+      // other side wakes them, that costs a fence and a load if none sleeps.
+      int push_wait(const T &data, const int64_t deadline);
+      int pop_wait(T &data, const int64_t deadline);
       int64_t size() const;
+    private:
+      static const int64_t WAIT_SPIN_COUNT = 128;
+      static const bool SPSC = Policy::SINGLE_PRODUCER && Policy::SINGLE_CONSUMER;
+      // Move pos from old_pos to new_pos, return the value before like
+      // __sync_val_compare_and_swap. The only thread of a side just stores.
+      static uint64_t advance_(uint64_t *pos, const uint64_t old_pos, const uint64_t new_pos, const bool single);
+      // Without waking the other side
+      int push_(const T &data);
+      int pop_(T &data);
+      int push_n_(const T *datas, const int64_t count, int64_t &push_count);
+      int pop_n_(T *datas, const int64_t count, int64_t &pop_count);
+      int push_spsc_(const T &data);
+      int pop_spsc_(T &data);
+      int push_n_spsc_(const T *datas, const int64_t count, int64_t &push_count);
+      int pop_n_spsc_(T *datas, const int64_t count, int64_t &pop_count);
     private:
       int64_t length_;
       Node *nodes_ CACHE_ALIGNED;
       uint64_t producer_ CACHE_ALIGNED;
+      uint64_t cached_consumer_;
       uint64_t consumer_ CACHE_ALIGNED;
+      uint64_t cached_producer_;
+      HALEventCount not_empty_ CACHE_ALIGNED;
+      HALEventCount not_full_ CACHE_ALIGNED;
   };
 
-  template <class T>
-  HALFixedQueue<T>::HALFixedQueue(const int64_t length)
+  template <class T, class Policy>
+  HALFixedQueue<T, Policy>::HALFixedQueue(const int64_t length)
     : length_(0),
       nodes_(NULL),
       producer_(0), 
-      consumer_(0) {
+      cached_consumer_(0),
+      consumer_(0),
+      cached_producer_(0),
+      not_empty_(),
+      not_full_() {
     assert(0 < length);
     nodes_ = (Node*)hal_malloc(sizeof(Node) * length, HALModIds::FIXED_QUEUE);
     assert(NULL != nodes_);
     length_ = length;
-    memset(nodes_, -1, sizeof(Node) * length);
+    for (int64_t i = 0; i < length; i++) {
+      nodes_[i].seq_ = (uint64_t)-1;
+    }
   }
 
-  template <class T>
-  HALFixedQueue<T>::~HALFixedQueue() {
+  template <class T, class Policy>
+  HALFixedQueue<T, Policy>::~HALFixedQueue() {
     if (NULL != nodes_) {
       hal_free(nodes_);
       nodes_ = NULL;
     }
   }
 
-  template <class T>
-  int HALFixedQueue<T>::push(const T &data) {
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::push(const T &data) {
+    int ret = push_(data);
+    if (HAL_SUCCESS == ret) {
+      not_empty_.notify();
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::pop(T &data) {
+    int ret = pop_(data);
+    if (HAL_SUCCESS == ret) {
+      not_full_.notify();
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::push_n(const T *datas, const int64_t count, int64_t &push_count) {
+    int ret = push_n_(datas, count, push_count);
+    if (1 == push_count) {
+      not_empty_.notify();
+    } else if (1 < push_count) {
+      not_empty_.notify_all();
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::pop_n(T *datas, const int64_t count, int64_t &pop_count) {
+    int ret = pop_n_(datas, count, pop_count);
+    if (1 == pop_count) {
+      not_full_.notify();
+    } else if (1 < pop_count) {
+      not_full_.notify_all();
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::push_(const T &data) {
     int ret = HAL_QUEUE_FULL;
-    uint64_t old_pos = producer_;
-    uint64_t cmp_pos = old_pos;
-    uint64_t new_pos = old_pos + 1;
-    while (true) {
-      uint64_t index = old_pos % length_;
-      if ((uint64_t)-1 != nodes_[index].seq_
-          && old_pos == producer_) {
-        break;
-      }
-      if (cmp_pos == (old_pos = __sync_val_compare_and_swap(&producer_, cmp_pos, new_pos))) {
-        nodes_[index].data_ = data;
-        nodes_[index].seq_ = old_pos;
-        ret = HAL_SUCCESS;
-        break;
-      } else {
-        cmp_pos = old_pos;
-        new_pos = old_pos + 1;
+    if (SPSC) {
+      ret = push_spsc_(data);
+    } else {
+      uint64_t old_pos = producer_;
+      uint64_t cmp_pos = old_pos;
+      uint64_t new_pos = old_pos + 1;
+      while (true) {
+        uint64_t index = old_pos % length_;
+        // a free looking slot may still wait for the write of a slow producer
+        // a round ago, as long as no consumer has claimed its position
+        if (((uint64_t)-1 != ATOMIC_LOAD_ACQUIRE(&nodes_[index].seq_)
+              || length_ <= (int64_t)(old_pos - ATOMIC_LOAD(&consumer_)))
+            && old_pos == ATOMIC_LOAD(&producer_)) {
+          break;
+        }
+        if (cmp_pos == (old_pos = advance_(&producer_, cmp_pos, new_pos, Policy::SINGLE_PRODUCER))) {
+          nodes_[index].data_ = data;
+          ATOMIC_STORE_RELEASE(&nodes_[index].seq_, old_pos);
+          ret = HAL_SUCCESS;
+          break;
+        } else {
+          cmp_pos = old_pos;
+          new_pos = old_pos + 1;
+        }
       }
     }
     return ret;
   }
 
-  template <class T>
-  int HALFixedQueue<T>::pop(T &data) {
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::pop_(T &data) {
     int ret = HAL_QUEUE_EMPTY;
-    uint64_t old_pos = consumer_;
-    uint64_t cmp_pos = old_pos;
-    uint64_t new_pos = old_pos + 1;
-    while (true) {
-      uint64_t index = old_pos % length_;
-      if (old_pos != nodes_[index].seq_
-          && old_pos == consumer_) {
-        break;
+    if (SPSC) {
+      ret = pop_spsc_(data);
+    } else {
+      uint64_t old_pos = consumer_;
+      uint64_t cmp_pos = old_pos;
+      uint64_t new_pos = old_pos + 1;
+      while (true) {
+        uint64_t index = old_pos % length_;
+        if (old_pos != ATOMIC_LOAD_ACQUIRE(&nodes_[index].seq_)
+            && old_pos == ATOMIC_LOAD(&consumer_)) {
+          break;
+        }
+        if (cmp_pos == (old_pos = advance_(&consumer_, cmp_pos, new_pos, Policy::SINGLE_CONSUMER))) {
+          data = nodes_[index].data_;
+          ATOMIC_STORE_RELEASE(&nodes_[index].seq_, (uint64_t)-1);
+          ret = HAL_SUCCESS;
+          break;
+        } else {
+          cmp_pos = old_pos;
+          new_pos = old_pos + 1;
+        }
+      }
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::push_n_(const T *datas, const int64_t count, int64_t &push_count) {
+    int ret = HAL_SUCCESS;
+    push_count = 0;
+    if (NULL == datas
+        || 0 >= count) {
+      ret = HAL_INVALID_PARAM;
+    } else if (SPSC) {
+      ret = push_n_spsc_(datas, count, push_count);
+    } else {
+      while (true) {
+        uint64_t old_pos = ATOMIC_LOAD(&producer_);
+        // Slots of positions not yet claimed by a consumer may still wait for
+        // the write of a slow producer a round ago, even if they look free.
+        int64_t limit = (int64_t)(ATOMIC_LOAD(&consumer_) + length_ - old_pos);
+        int64_t n = 0;
+        while (n < count
+              && n < limit
+              && (uint64_t)-1 == ATOMIC_LOAD_ACQUIRE(&nodes_[(old_pos + n) % length_].seq_)) {
+          n++;
+        }
+        if (0 == n) {
+          if (old_pos == ATOMIC_LOAD(&producer_)) {
+            ret = HAL_QUEUE_FULL;
+            break;
+          }
+        } else if (old_pos == advance_(&producer_, old_pos, old_pos + n, Policy::SINGLE_PRODUCER)) {
+          for (int64_t i = 0; i < n; i++) {
+            Node &node = nodes_[(old_pos + i) % length_];
+            node.data_ = datas[i];
+            ATOMIC_STORE_RELEASE(&node.seq_, old_pos + i);
+          }
+          push_count = n;
+          break;
+        }
+      }
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::pop_n_(T *datas, const int64_t count, int64_t &pop_count) {
+    int ret = HAL_SUCCESS;
+    pop_count = 0;
+    if (NULL == datas
+        || 0 >= count) {
+      ret = HAL_INVALID_PARAM;
+    } else if (SPSC) {
+      ret = pop_n_spsc_(datas, count, pop_count);
+    } else {
+      while (true) {
+        uint64_t old_pos = ATOMIC_LOAD(&consumer_);
+        int64_t n = 0;
+        while (n < count
+              && old_pos + n == ATOMIC_LOAD_ACQUIRE(&nodes_[(old_pos + n) % length_].seq_)) {
+          n++;
+        }
+        if (0 == n) {
+          if (old_pos == ATOMIC_LOAD(&consumer_)) {
+            ret = HAL_QUEUE_EMPTY;
+            break;
+          }
+        } else if (old_pos == advance_(&consumer_, old_pos, old_pos + n, Policy::SINGLE_CONSUMER)) {
+          for (int64_t i = 0; i < n; i++) {
+            Node &node = nodes_[(old_pos + i) % length_];
+            datas[i] = node.data_;
+            ATOMIC_STORE_RELEASE(&node.seq_, (uint64_t)-1);
+          }
+          pop_count = n;
+          break;
+        }
+      }
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::push_wait(const T &data, const int64_t deadline) {
+    int ret = push_(data);
+    for (int64_t i = 0; HAL_QUEUE_FULL == ret && i < WAIT_SPIN_COUNT; i++) {
+      PAUSE();
+      ret = push_(data);
+    }
+    while (HAL_QUEUE_FULL == ret) {
+      const uint32_t key = not_full_.prepare_wait();
+      if (HAL_QUEUE_FULL != (ret = push_(data))) {
+        not_full_.cancel_wait();
+      } else {
+        // a wake up may come with the timeout, try once more in any case
+        const int wait_ret = not_full_.wait(key, deadline);
+        if (HAL_QUEUE_FULL == (ret = push_(data))
+            && HAL_SUCCESS != wait_ret) {
+          ret = wait_ret;
+        }
       }
-      if (cmp_pos == (old_pos = __sync_val_compare_and_swap(&consumer_, cmp_pos, new_pos))) {
-        data = nodes_[index].data_;
-        nodes_[index].seq_ = -1;
-        ret = HAL_SUCCESS;
-        break;
+    }
+    if (HAL_SUCCESS == ret) {
+      not_empty_.notify();
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::pop_wait(T &data, const int64_t deadline) {
+    int ret = pop_(data);
+    for (int64_t i = 0; HAL_QUEUE_EMPTY == ret && i < WAIT_SPIN_COUNT; i++) {
+      PAUSE();
+      ret = pop_(data);
+    }
+    while (HAL_QUEUE_EMPTY == ret) {
+      const uint32_t key = not_empty_.prepare_wait();
+      if (HAL_QUEUE_EMPTY != (ret = pop_(data))) {
+        not_empty_.cancel_wait();
       } else {
-        cmp_pos = old_pos;
-        new_pos = old_pos + 1;
+        // a wake up may come with the timeout, try once more in any case
+        const int wait_ret = not_empty_.wait(key, deadline);
+        if (HAL_QUEUE_EMPTY == (ret = pop_(data))
+            && HAL_SUCCESS != wait_ret) {
+          ret = wait_ret;
+        }
       }
     }
+    if (HAL_SUCCESS == ret) {
+      not_full_.notify();
+    }
     return ret;
   }
 
-  template <class T>
-  int64_t HALFixedQueue<T>::size() const {
+  template <class T, class Policy>
+  int64_t HALFixedQueue<T, Policy>::size() const {
     return producer_ - consumer_;
   }
 
+  template <class T, class Policy>
+  uint64_t HALFixedQueue<T, Policy>::advance_(uint64_t *pos, const uint64_t old_pos, const uint64_t new_pos, const bool single) {
+    uint64_t ret = old_pos;
+    if (single) {
+      ATOMIC_STORE_RELEASE(pos, new_pos);
+    } else {
+      ret = __sync_val_compare_and_swap(pos, old_pos, new_pos);
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::push_spsc_(const T &data) {
+    int ret = HAL_SUCCESS;
+    const uint64_t pos = producer_;
+    if (length_ <= (int64_t)(pos - cached_consumer_)
+        && length_ <= (int64_t)(pos - (cached_consumer_ = ATOMIC_LOAD_ACQUIRE(&consumer_)))) {
+      ret = HAL_QUEUE_FULL;
+    } else {
+      nodes_[pos % length_].data_ = data;
+      ATOMIC_STORE_RELEASE(&producer_, pos + 1);
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::pop_spsc_(T &data) {
+    int ret = HAL_SUCCESS;
+    const uint64_t pos = consumer_;
+    if (cached_producer_ <= pos
+        && (cached_producer_ = ATOMIC_LOAD_ACQUIRE(&producer_)) <= pos) {
+      ret = HAL_QUEUE_EMPTY;
+    } else {
+      data = nodes_[pos % length_].data_;
+      ATOMIC_STORE_RELEASE(&consumer_, pos + 1);
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::push_n_spsc_(const T *datas, const int64_t count, int64_t &push_count) {
+    int ret = HAL_SUCCESS;
+    const uint64_t pos = producer_;
+    if (length_ - (int64_t)(pos - cached_consumer_) < count) {
+      cached_consumer_ = ATOMIC_LOAD_ACQUIRE(&consumer_);
+    }
+    const int64_t n = std::min(count, length_ - (int64_t)(pos - cached_consumer_));
+    if (0 >= n) {
+      ret = HAL_QUEUE_FULL;
+    } else {
+      for (int64_t i = 0; i < n; i++) {
+        nodes_[(pos + i) % length_].data_ = datas[i];
+      }
+      ATOMIC_STORE_RELEASE(&producer_, pos + n);
+      push_count = n;
+    }
+    return ret;
+  }
+
+  template <class T, class Policy>
+  int HALFixedQueue<T, Policy>::pop_n_spsc_(T *datas, const int64_t count, int64_t &pop_count) {
+    int ret = HAL_SUCCESS;
+    const uint64_t pos = consumer_;
+    if ((int64_t)(cached_producer_ - pos) < count) {
+      cached_producer_ = ATOMIC_LOAD_ACQUIRE(&producer_);
+    }
+    const int64_t n = std::min(count, (int64_t)(cached_producer_ - pos));
+    if (0 >= n) {
+      ret = HAL_QUEUE_EMPTY;
+    } else {
+      for (int64_t i = 0; i < n; i++) {
+        datas[i] = nodes_[(pos + i) % length_].data_;
+      }
+      ATOMIC_STORE_RELEASE(&consumer_, pos + n);
+      pop_count = n;
+    }
+    return ret;
+  }
+
 }
 }
 
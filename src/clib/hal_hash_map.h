@@ -0,0 +1,404 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_HASH_MAP_H__
+#define __HAL_CLIB_HASH_MAP_H__
+#include <stdint.h>
+#include <assert.h>
+
+#include <new>
+#include <functional>
+
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_base_log.h"
+#include "clib/hal_spin_lock.h"
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+  // std::hash of integers is the identity, finalized by fmix64 of MurmurHash3
+  // so that the low bits used for buckets are well mixed.
+  template <class K>
+  struct HALHash {
+    uint64_t operator()(const K &key) const {
+      uint64_t h = (uint64_t)std::hash<K>()(key);
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdUL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53UL;
+      h ^= h >> 33;
+      return h;
+    }
+  };
+
+  // Chained hash map. get() walks the buckets inside a HALHazardVersion
+  // critical section without any lock, put() and erase() lock one bucket.
+  // Nodes are immutable once linked, an overwrite links a new node in place
+  // of the old one. When the map grows a doubled bucket array is chained
+  // behind the current one, and every write migrates a few buckets to it by
+  // copying their nodes, readers of a moved bucket go on to the new array.
+  template <class K, class V, class HashFunc = HALHash<K>, class EqualFunc = std::equal_to<K> >
+  class HALHashMap {
+    struct Node {
+      Node(const uint64_t hash, const K &key, const V &value)
+        : next_(NULL), hash_(hash), key_(key), value_(value) {}
+      Node *next_;
+      uint64_t hash_;
+      K key_;
+      V value_;
+    };
+    struct Bucket {
+      Bucket() : lock_(), moved_(false), head_(NULL) {}
+      HALSpinLock lock_;
+      bool moved_;
+      Node *head_;
+    };
+    struct BucketArray {
+      BucketArray(const int64_t bucket_count)
+        : bucket_count_(bucket_count), next_(NULL), migrate_cursor_(0), buckets_((Bucket*)(this + 1)) {}
+      Bucket &get_bucket(const uint64_t hash) { return buckets_[hash & (bucket_count_ - 1)]; }
+      int64_t bucket_count_;
+      BucketArray *next_;
+      int64_t migrate_cursor_;
+      Bucket *buckets_;
+    };
+    public:
+      static const int64_t MIN_BUCKET_COUNT = 16;
+      static const int64_t LOAD_FACTOR = 2;
+      static const int64_t MIGRATE_STEP = 4;
+    public:
+      // bucket_count is rounded up to a power of 2
+      HALHashMap(
+        const int64_t bucket_count = 1024,
+        const HashFunc &hash_func = HashFunc(),
+        const EqualFunc &equal_func = EqualFunc());
+      ~HALHashMap();
+    public:
+      // Insert or overwrite
+      int put(const K &key, const V &value);
+      // HAL_ENTRY_NOT_EXIST if key is not found
+      int get(const K &key, V &value);
+      int erase(const K &key);
+      int64_t size() const;
+      // Of the newest bucket array, including one still being migrated to
+      int64_t get_bucket_count() const;
+    private:
+      BucketArray *alloc_array_(const int64_t bucket_count);
+      Bucket &lock_bucket_(const uint64_t hash);
+      void retire_node_(Node *node);
+      void grow_();
+      int migrate_bucket_(BucketArray *array, Bucket &bucket);
+      static void free_node_(void *ptr, void *arg);
+      static void free_array_(void *ptr, void *arg);
+    private:
+      HALHashMap(const HALHashMap &);
+      HALHashMap &operator =(const HALHashMap &);
+    private:
+      HashFunc hash_func_;
+      EqualFunc equal_func_;
+      HALHazardVersion hazard_version_;
+      BucketArray *array_ CACHE_ALIGNED;
+      int64_t count_ CACHE_ALIGNED;
+  };
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  const int64_t HALHashMap<K, V, HashFunc, EqualFunc>::MIN_BUCKET_COUNT;
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  const int64_t HALHashMap<K, V, HashFunc, EqualFunc>::LOAD_FACTOR;
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  const int64_t HALHashMap<K, V, HashFunc, EqualFunc>::MIGRATE_STEP;
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  HALHashMap<K, V, HashFunc, EqualFunc>::HALHashMap(
+    const int64_t bucket_count,
+    const HashFunc &hash_func,
+    const EqualFunc &equal_func)
+    : hash_func_(hash_func),
+      equal_func_(equal_func),
+      hazard_version_(),
+      array_(NULL),
+      count_(0) {
+    int64_t aligned_count = MIN_BUCKET_COUNT;
+    while (aligned_count < bucket_count) {
+      aligned_count <<= 1;
+    }
+    array_ = alloc_array_(aligned_count);
+    assert(NULL != array_);
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  HALHashMap<K, V, HashFunc, EqualFunc>::~HALHashMap() {
+    // nodes of moved buckets are already retired
+    hazard_version_.retire();
+    BucketArray *array = array_;
+    while (NULL != array) {
+      for (int64_t i = 0; i < array->bucket_count_; i++) {
+        Bucket &bucket = array->buckets_[i];
+        while (!bucket.moved_ && NULL != bucket.head_) {
+          Node *next = bucket.head_->next_;
+          free_node_(bucket.head_, NULL);
+          bucket.head_ = next;
+        }
+      }
+      BucketArray *next = array->next_;
+      free_array_(array, NULL);
+      array = next;
+    }
+    array_ = NULL;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int HALHashMap<K, V, HashFunc, EqualFunc>::put(const K &key, const V &value) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    const uint64_t hash = hash_func_(key);
+    Node *node = (Node*)hal_malloc(sizeof(Node), HALModIds::HASH_MAP);
+    if (NULL == node) {
+      LOG_WARN(CLIB, "alloc node fail");
+      ret = HAL_ALLOCATE_FAIL;
+    } else if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+      hal_free(node);
+    } else {
+      new(node) Node(hash, key, value);
+      Bucket &bucket = lock_bucket_(hash);
+      Node **link = &bucket.head_;
+      while (NULL != *link
+            && !(hash == (*link)->hash_ && equal_func_(key, (*link)->key_))) {
+        link = &(*link)->next_;
+      }
+      Node *old = *link;
+      if (NULL != old) {
+        node->next_ = old->next_;
+        ATOMIC_STORE(link, node);
+        retire_node_(old);
+      } else {
+        node->next_ = bucket.head_;
+        ATOMIC_STORE(&bucket.head_, node);
+        __sync_add_and_fetch(&count_, 1);
+      }
+      bucket.lock_.unlock();
+      grow_();
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int HALHashMap<K, V, HashFunc, EqualFunc>::get(const K &key, V &value) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    const uint64_t hash = hash_func_(key);
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      BucketArray *array = ATOMIC_LOAD(&array_);
+      while (true) {
+        Bucket &bucket = array->get_bucket(hash);
+        Node *node = NULL;
+        if (!ATOMIC_LOAD(&bucket.moved_)) {
+          node = ATOMIC_LOAD(&bucket.head_);
+          while (NULL != node
+                && !(hash == node->hash_ && equal_func_(key, node->key_))) {
+            node = ATOMIC_LOAD(&node->next_);
+          }
+          // The old chain stays readable after a move, but writes after the
+          // move only go to the new array.
+          if (!ATOMIC_LOAD(&bucket.moved_)) {
+            if (NULL == node) {
+              ret = HAL_ENTRY_NOT_EXIST;
+            } else {
+              value = node->value_;
+            }
+            break;
+          }
+        }
+        array = ATOMIC_LOAD(&array->next_);
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int HALHashMap<K, V, HashFunc, EqualFunc>::erase(const K &key) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    const uint64_t hash = hash_func_(key);
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      Bucket &bucket = lock_bucket_(hash);
+      Node **link = &bucket.head_;
+      while (NULL != *link
+            && !(hash == (*link)->hash_ && equal_func_(key, (*link)->key_))) {
+        link = &(*link)->next_;
+      }
+      Node *old = *link;
+      if (NULL == old) {
+        ret = HAL_ENTRY_NOT_EXIST;
+      } else {
+        // readers standing on old still find their way by old->next_
+        ATOMIC_STORE(link, old->next_);
+        retire_node_(old);
+        __sync_add_and_fetch(&count_, -1);
+      }
+      bucket.lock_.unlock();
+      grow_();
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int64_t HALHashMap<K, V, HashFunc, EqualFunc>::size() const {
+    return ATOMIC_LOAD(&count_);
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int64_t HALHashMap<K, V, HashFunc, EqualFunc>::get_bucket_count() const {
+    BucketArray *array = ATOMIC_LOAD(&array_);
+    BucketArray *next = ATOMIC_LOAD(&array->next_);
+    return (NULL == next) ? array->bucket_count_ : next->bucket_count_;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  typename HALHashMap<K, V, HashFunc, EqualFunc>::BucketArray *HALHashMap<K, V, HashFunc, EqualFunc>::alloc_array_(const int64_t bucket_count) {
+    BucketArray *ret = NULL;
+    void *buffer = hal_malloc(sizeof(BucketArray) + sizeof(Bucket) * bucket_count, HALModIds::HASH_MAP);
+    if (NULL == buffer) {
+      LOG_WARN(CLIB, "alloc bucket array fail, bucket_count=%ld", bucket_count);
+    } else {
+      ret = new(buffer) BucketArray(bucket_count);
+      for (int64_t i = 0; i < bucket_count; i++) {
+        new(&ret->buckets_[i]) Bucket();
+      }
+    }
+    return ret;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  typename HALHashMap<K, V, HashFunc, EqualFunc>::Bucket &HALHashMap<K, V, HashFunc, EqualFunc>::lock_bucket_(const uint64_t hash) {
+    BucketArray *array = ATOMIC_LOAD(&array_);
+    while (true) {
+      Bucket &bucket = array->get_bucket(hash);
+      bucket.lock_.lock();
+      if (!bucket.moved_) {
+        return bucket;
+      }
+      bucket.lock_.unlock();
+      array = ATOMIC_LOAD(&array->next_);
+    }
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALHashMap<K, V, HashFunc, EqualFunc>::retire_node_(Node *node) {
+    int tmp_ret = hazard_version_.add_node(node, free_node_, NULL, sizeof(Node));
+    if (HAL_SUCCESS != tmp_ret) {
+      LOG_WARN(CLIB, "add_node fail, node leaked, ret=%d", tmp_ret);
+    }
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALHashMap<K, V, HashFunc, EqualFunc>::grow_() {
+    BucketArray *array = ATOMIC_LOAD(&array_);
+    BucketArray *next = ATOMIC_LOAD(&array->next_);
+    if (NULL == next) {
+      if (LOAD_FACTOR * array->bucket_count_ < ATOMIC_LOAD(&count_)
+          && NULL != (next = alloc_array_(array->bucket_count_ * 2))
+          && !__sync_bool_compare_and_swap(&array->next_, NULL, next)) {
+        free_array_(next, NULL);
+      }
+    } else {
+      // Buckets are moved in order, a bucket locked by others or failing to
+      // move is left to the following writes.
+      for (int64_t i = 0; i < MIGRATE_STEP; i++) {
+        int64_t cursor = ATOMIC_LOAD(&array->migrate_cursor_);
+        if (array->bucket_count_ <= cursor) {
+          break;
+        }
+        Bucket &bucket = array->buckets_[cursor];
+        if (!bucket.lock_.try_lock()) {
+          break;
+        }
+        bool moved = (bucket.moved_ || HAL_SUCCESS == migrate_bucket_(array, bucket));
+        bucket.lock_.unlock();
+        if (!moved) {
+          break;
+        }
+        if (__sync_bool_compare_and_swap(&array->migrate_cursor_, cursor, cursor + 1)
+            && array->bucket_count_ == cursor + 1) {
+          ATOMIC_STORE(&array_, next);
+          int tmp_ret = hazard_version_.add_node(array, free_array_, NULL, 0);
+          if (HAL_SUCCESS != tmp_ret) {
+            LOG_WARN(CLIB, "add_node fail, bucket array leaked, ret=%d", tmp_ret);
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  int HALHashMap<K, V, HashFunc, EqualFunc>::migrate_bucket_(BucketArray *array, Bucket &bucket) {
+    int ret = HAL_SUCCESS;
+    // Copy first so that a failure leaves the bucket untouched, the old
+    // chain must stay intact for the readers on it.
+    Node *copies = NULL;
+    for (Node *iter = bucket.head_; NULL != iter; iter = iter->next_) {
+      Node *copy = (Node*)hal_malloc(sizeof(Node), HALModIds::HASH_MAP);
+      if (NULL == copy) {
+        LOG_WARN(CLIB, "alloc node fail, migration postponed");
+        ret = HAL_ALLOCATE_FAIL;
+        break;
+      }
+      new(copy) Node(iter->hash_, iter->key_, iter->value_);
+      copy->next_ = copies;
+      copies = copy;
+    }
+    if (HAL_SUCCESS != ret) {
+      while (NULL != copies) {
+        Node *next = copies->next_;
+        free_node_(copies, NULL);
+        copies = next;
+      }
+    } else {
+      while (NULL != copies) {
+        Node *next = copies->next_;
+        Bucket &target = array->next_->get_bucket(copies->hash_);
+        target.lock_.lock();
+        copies->next_ = target.head_;
+        ATOMIC_STORE(&target.head_, copies);
+        target.lock_.unlock();
+        copies = next;
+      }
+      ATOMIC_STORE(&bucket.moved_, true);
+      for (Node *iter = bucket.head_; NULL != iter; iter = iter->next_) {
+        retire_node_(iter);
+      }
+    }
+    return ret;
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALHashMap<K, V, HashFunc, EqualFunc>::free_node_(void *ptr, void *arg) {
+    UNUSED(arg);
+    ((Node*)ptr)->~Node();
+    hal_free(ptr);
+  }
+
+  template <class K, class V, class HashFunc, class EqualFunc>
+  void HALHashMap<K, V, HashFunc, EqualFunc>::free_array_(void *ptr, void *arg) {
+    UNUSED(arg);
+    hal_free(ptr);
+  }
+
+}
+}
+
+#endif // __HAL_CLIB_HASH_MAP_H__
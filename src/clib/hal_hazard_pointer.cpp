@@ -0,0 +1,109 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <algorithm>
+#include "clib/hal_hazard_pointer.h"
+
+namespace libhalog {
+namespace clib {
+namespace hazard_pointer {
+  ThreadStore::ThreadStore()
+    : enabled_(false),
+      tid_(0),
+      retired_list_(NULL),
+      hazard_waiting_count_(0),
+      next_(NULL) {
+  }
+
+  ThreadStore::~ThreadStore() {
+    retire_all();
+  }
+
+  void ThreadStore::set_enabled(const uint16_t tid) {
+    tid_ = tid;
+    ATOMIC_STORE(&enabled_, true);
+  }
+
+  bool ThreadStore::is_enabled() const {
+    return ATOMIC_LOAD(&enabled_);
+  }
+
+  uint16_t ThreadStore::get_tid() const {
+    return tid_;
+  }
+
+  void ThreadStore::set_next(ThreadStore *ts) {
+    next_ = ts;
+  }
+
+  ThreadStore *ThreadStore::get_next() const {
+    return next_;
+  }
+
+  void ThreadStore::add_node(HALHazardNodeI *node) {
+    assert(tid_ == gettn());
+    node->__set_next__(retired_list_);
+    retired_list_ = node;
+    ATOMIC_STORE(&hazard_waiting_count_, hazard_waiting_count_ + 1);
+  }
+
+  int64_t ThreadStore::get_hazard_waiting_count() const {
+    return ATOMIC_LOAD(&hazard_waiting_count_);
+  }
+
+  int64_t ThreadStore::retire(HALHazardNodeI *const *snapshot, const int64_t snapshot_count) {
+    assert(!is_enabled() || tid_ == gettn());
+    HALHazardNodeI *iter = retired_list_;
+    HALHazardNodeI *list2retire = NULL;
+    int64_t retire_count = 0;
+    retired_list_ = NULL;
+    while (NULL != iter) {
+      HALHazardNodeI *node = iter;
+      iter = iter->__get_next__();
+      if (std::binary_search(snapshot, snapshot + snapshot_count, node)) {
+        node->__set_next__(retired_list_);
+        retired_list_ = node;
+      } else {
+        node->__set_next__(list2retire);
+        list2retire = node;
+        retire_count++;
+      }
+    }
+    ATOMIC_STORE(&hazard_waiting_count_, hazard_waiting_count_ - retire_count);
+    while (NULL != list2retire) {
+      HALHazardNodeI *node2retire = list2retire;
+      list2retire = list2retire->__get_next__();
+      node2retire->retire();
+    }
+    return retire_count;
+  }
+
+  void ThreadStore::hand_off(ThreadStore &orphans) {
+    assert(tid_ == gettn());
+    if (NULL != retired_list_) {
+      HALHazardNodeI *tail = retired_list_;
+      while (NULL != tail->__get_next__()) {
+        tail = tail->__get_next__();
+      }
+      tail->__set_next__(orphans.retired_list_);
+      orphans.retired_list_ = retired_list_;
+      ATOMIC_STORE(&orphans.hazard_waiting_count_, orphans.hazard_waiting_count_ + hazard_waiting_count_);
+      ATOMIC_STORE(&hazard_waiting_count_, (int64_t)0);
+      retired_list_ = NULL;
+    }
+  }
+
+  int64_t ThreadStore::retire_all() {
+    int64_t retire_count = 0;
+    while (NULL != retired_list_) {
+      HALHazardNodeI *node2retire = retired_list_;
+      retired_list_ = retired_list_->__get_next__();
+      node2retire->retire();
+      retire_count++;
+    }
+    hazard_waiting_count_ = 0;
+    return retire_count;
+  }
+}
+}
+}
@@ -0,0 +1,302 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_HAZARD_POINTER_H__
+#define __HAL_CLIB_HAZARD_POINTER_H__
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "clib/hal_define.h"
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_base_log.h"
+#include "clib/hal_spin_lock.h"
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+namespace hazard_pointer {
+  // Hazard slots are written by the owner and scanned by everyone, the retired
+  // list is only touched by the owner.
+  class ThreadStore {
+    public:
+      ThreadStore();
+      ~ThreadStore();
+    public:
+      void set_enabled(const uint16_t tid);
+      bool is_enabled() const;
+      uint16_t get_tid() const;
+
+      void set_next(ThreadStore *ts);
+      ThreadStore *get_next() const;
+
+      void add_node(HALHazardNodeI *node);
+      int64_t get_hazard_waiting_count() const;
+      // Retire nodes not found in the sorted snapshot of all hazard slots.
+      // Called by the owner, or on a store of no thread under its lock.
+      int64_t retire(HALHazardNodeI *const *snapshot, const int64_t snapshot_count);
+      int64_t retire_all();
+      // Move the retired list of an exiting thread to orphans, a store of no
+      // thread, the caller holds the lock of orphans
+      void hand_off(ThreadStore &orphans);
+    private:
+      bool enabled_;
+      uint16_t tid_;
+
+      HALHazardNodeI *retired_list_;
+      int64_t hazard_waiting_count_;
+
+      ThreadStore *next_ CACHE_ALIGNED;
+  };
+}
+
+  ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  // Classic hazard pointers: each thread owns SlotCnt slots, a retired node is
+  // reclaimed once no slot holds it. A thread keeps at most
+  // thread_waiting_threshold + thread_count * SlotCnt nodes unreclaimed, no matter
+  // how long a reader stalls.
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  class HALHazardPointerT {
+    struct Slots {
+      HALHazardNodeI *nodes_[SlotCnt];
+    } CACHE_ALIGNED;
+    public:
+      HALHazardPointerT(const int64_t thread_waiting_threshold = 64);
+      ~HALHazardPointerT();
+    public:
+      // Publish *src in slot and return it once it is confirmed still reachable
+      template <typename T>
+      T *protect(const int64_t slot, T *const *src);
+      int set(const int64_t slot, HALHazardNodeI *node);
+      void clear(const int64_t slot);
+      void clear_all();
+
+      int add_node(HALHazardNodeI *node);
+      void retire();
+      int64_t get_hazard_waiting_count() const;
+    private:
+      class ExitHook : public HALThreadExitHook {
+        public:
+          explicit ExitHook(HALHazardPointerT &host) : host_(host) {}
+          void on_thread_exit(const int64_t tn) { host_.on_thread_exit_(tn); }
+        private:
+          HALHazardPointerT &host_;
+      };
+    private:
+      int get_thread_store_(hazard_pointer::ThreadStore *&ts);
+      int64_t scan_(hazard_pointer::ThreadStore *ts);
+      void on_thread_exit_(const int64_t tn);
+    private:
+      int64_t thread_waiting_threshold_;
+      ExitHook exit_hook_;
+
+      HALSpinLock thread_lock_ CACHE_ALIGNED;
+      Slots slots_[MaxThreadCnt];
+      hazard_pointer::ThreadStore threads_[MaxThreadCnt];
+      hazard_pointer::ThreadStore *thread_list_;
+      int64_t thread_count_;
+
+      int64_t hazard_waiting_count_ CACHE_ALIGNED;
+
+      // Retired lists left by exited threads
+      HALSpinLock orphan_lock_ CACHE_ALIGNED;
+      hazard_pointer::ThreadStore orphans_;
+  };
+
+  typedef HALHazardPointerT<HAL_MAX_THREAD_COUNT, 4> HALHazardPointer;
+
+  ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  HALHazardPointerT<MaxThreadCnt, SlotCnt>::HALHazardPointerT(const int64_t thread_waiting_threshold)
+    : thread_waiting_threshold_(thread_waiting_threshold),
+      exit_hook_(*this),
+      thread_lock_(),
+      thread_list_(NULL),
+      thread_count_(0),
+      hazard_waiting_count_(0),
+      orphan_lock_(),
+      orphans_() {
+    memset(slots_, 0, sizeof(slots_));
+    gsi<HALThreadRegistry>().add_exit_hook(&exit_hook_);
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  HALHazardPointerT<MaxThreadCnt, SlotCnt>::~HALHazardPointerT() {
+    gsi<HALThreadRegistry>().del_exit_hook(&exit_hook_);
+    // ThreadStore destructor retires the nodes left
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  template <typename T>
+  T *HALHazardPointerT<MaxThreadCnt, SlotCnt>::protect(const int64_t slot, T *const *src) {
+    T *ret = NULL;
+    hazard_pointer::ThreadStore *ts = NULL;
+    if (0 > slot || SlotCnt <= slot) {
+      LOG_WARN(CLIB, "invalid param, slot=%ld", slot);
+    } else if (HAL_SUCCESS != get_thread_store_(ts)) {
+      LOG_WARN(CLIB, "get_thread_store_ fail");
+    } else {
+      HALHazardNodeI **hazard = &slots_[ts->get_tid()].nodes_[slot];
+      T *curr = ATOMIC_LOAD(src);
+      while (true) {
+        // Full barrier, the slot must be visible before *src is re-checked
+        ATOMIC_STORE(hazard, static_cast<HALHazardNodeI*>(curr));
+        T *check = ATOMIC_LOAD(src);
+        if (check == curr) {
+          ret = curr;
+          break;
+        }
+        curr = check;
+      }
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  int HALHazardPointerT<MaxThreadCnt, SlotCnt>::set(const int64_t slot, HALHazardNodeI *node) {
+    int ret = HAL_SUCCESS;
+    hazard_pointer::ThreadStore *ts = NULL;
+    if (0 > slot || SlotCnt <= slot) {
+      LOG_WARN(CLIB, "invalid param, slot=%ld", slot);
+      ret = HAL_INVALID_PARAM;
+    } else if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
+      LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
+    } else {
+      ATOMIC_STORE(&slots_[ts->get_tid()].nodes_[slot], node);
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  void HALHazardPointerT<MaxThreadCnt, SlotCnt>::clear(const int64_t slot) {
+    set(slot, NULL);
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  void HALHazardPointerT<MaxThreadCnt, SlotCnt>::clear_all() {
+    for (int64_t i = 0; i < SlotCnt; i++) {
+      set(i, NULL);
+    }
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  int HALHazardPointerT<MaxThreadCnt, SlotCnt>::add_node(HALHazardNodeI *node) {
+    int ret = HAL_SUCCESS;
+    hazard_pointer::ThreadStore *ts = NULL;
+    if (NULL == node) {
+      LOG_WARN(CLIB, "invalid param, node null pointer");
+      ret = HAL_INVALID_PARAM;
+    } else if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
+      LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
+    } else {
+      ts->add_node(node);
+      __sync_add_and_fetch(&hazard_waiting_count_, 1);
+      if ((thread_waiting_threshold_ + ATOMIC_LOAD(&thread_count_) * SlotCnt) <= ts->get_hazard_waiting_count()) {
+        scan_(ts);
+      }
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  void HALHazardPointerT<MaxThreadCnt, SlotCnt>::retire() {
+    int ret = HAL_SUCCESS;
+    hazard_pointer::ThreadStore *ts = NULL;
+    if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
+      LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
+    } else {
+      scan_(ts);
+    }
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  int64_t HALHazardPointerT<MaxThreadCnt, SlotCnt>::get_hazard_waiting_count() const {
+    return ATOMIC_LOAD(&hazard_waiting_count_);
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  int HALHazardPointerT<MaxThreadCnt, SlotCnt>::get_thread_store_(hazard_pointer::ThreadStore *&ts) {
+    int ret = HAL_SUCCESS;
+    int64_t tn = gettn();
+    if (MaxThreadCnt <= tn) {
+      LOG_WARN(CLIB, "thread number overflow, tn=%ld", tn);
+      ret = HAL_TOO_MANY_THREADS;
+    } else {
+      ts = &threads_[tn];
+      if (!ts->is_enabled()) {
+        thread_lock_.lock();
+        if (!ts->is_enabled()) {
+          ts->set_enabled((uint16_t)tn);
+          ts->set_next(ATOMIC_LOAD(&thread_list_));
+          ATOMIC_STORE(&thread_list_, ts);
+          __sync_add_and_fetch(&thread_count_, 1);
+        }
+        thread_lock_.unlock();
+      }
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  int64_t HALHazardPointerT<MaxThreadCnt, SlotCnt>::scan_(hazard_pointer::ThreadStore *ts) {
+    int64_t retire_count = 0;
+    // The list is only ever prepended, walking from the same head twice sees the same stores
+    hazard_pointer::ThreadStore *head = ATOMIC_LOAD(&thread_list_);
+    int64_t snapshot_size = 0;
+    for (hazard_pointer::ThreadStore *iter = head; NULL != iter; iter = iter->get_next()) {
+      snapshot_size += SlotCnt;
+    }
+    HALHazardNodeI **snapshot = (HALHazardNodeI**)hal_malloc(snapshot_size * sizeof(HALHazardNodeI*), HALModIds::HAZARD_POINTER);
+    if (NULL == snapshot) {
+      LOG_WARN(CLIB, "allocate snapshot fail, size=%ld", snapshot_size);
+    } else {
+      int64_t snapshot_count = 0;
+      for (hazard_pointer::ThreadStore *iter = head; NULL != iter; iter = iter->get_next()) {
+        const Slots &slots = slots_[iter->get_tid()];
+        for (int64_t i = 0; i < SlotCnt; i++) {
+          HALHazardNodeI *node = ATOMIC_LOAD(&slots.nodes_[i]);
+          if (NULL != node) {
+            snapshot[snapshot_count++] = node;
+          }
+        }
+      }
+      std::sort(snapshot, snapshot + snapshot_count);
+      retire_count = ts->retire(snapshot, snapshot_count);
+      if (0 < orphans_.get_hazard_waiting_count()
+          && orphan_lock_.try_lock()) {
+        retire_count += orphans_.retire(snapshot, snapshot_count);
+        orphan_lock_.unlock();
+      }
+      __sync_add_and_fetch(&hazard_waiting_count_, -retire_count);
+      hal_free(snapshot);
+    }
+    return retire_count;
+  }
+
+  template <uint16_t MaxThreadCnt, int64_t SlotCnt>
+  void HALHazardPointerT<MaxThreadCnt, SlotCnt>::on_thread_exit_(const int64_t tn) {
+    // The slots of the exited thread protect nothing any more, and its
+    // retired list must not wait for the next thread reusing tn
+    if (0 <= tn
+        && MaxThreadCnt > tn
+        && threads_[tn].is_enabled()) {
+      hazard_pointer::ThreadStore *ts = &threads_[tn];
+      for (int64_t i = 0; i < SlotCnt; i++) {
+        ATOMIC_STORE(&slots_[tn].nodes_[i], (HALHazardNodeI*)NULL);
+      }
+      scan_(ts);
+      orphan_lock_.lock();
+      ts->hand_off(orphans_);
+      orphan_lock_.unlock();
+    }
+  }
+}
+}
+
+#endif // __HAL_CLIB_HAZARD_POINTER_H__
@@ -0,0 +1,381 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+namespace hazard_version {
+  ThreadStore::ThreadStore() 
+    : enabled_(false),
+      tid_(0),
+      group_(NULL),
+      light_publish_(false),
+      acquire_depth_(0),
+      curr_seq_(0),
+      curr_version_(UINT64_MAX),
+      acquire_timestamp_(0),
+      tail_chunk_(NULL),
+      spare_chunk_(NULL),
+      hazard_waiting_count_(0),
+      retire_lock_(),
+      head_chunk_(NULL),
+      head_pos_(0),
+      last_retire_version_(0),
+      retired_count_(0),
+      retire_pass_count_(0),
+      retire_time_us_(0),
+      max_retire_time_us_(0),
+      next_(NULL) {
+  }
+
+  ThreadStore::~ThreadStore() {
+    int64_t retire_bytes = 0;
+    retire(UINT64_MAX, retire_bytes, NULL, NULL, NULL);
+    while (NULL != head_chunk_) {
+      RetireChunk *chunk = head_chunk_;
+      head_chunk_ = chunk->next_;
+      hal_free(chunk);
+    }
+    hal_free(spare_chunk_);
+  }
+
+  void ThreadStore::set_enabled(const uint16_t tid, ThreadGroup *group, const bool light_publish) {
+    tid_ = tid;
+    group_ = group;
+    light_publish_ = light_publish;
+    ATOMIC_STORE(&enabled_, true);
+  }
+
+  bool ThreadStore::is_enabled() const {
+    return ATOMIC_LOAD(&enabled_);
+  }
+
+  uint16_t  ThreadStore::get_tid() const {
+    return tid_;
+  }
+
+  void ThreadStore::set_next(ThreadStore *ts) {
+    next_ = ts;
+  }
+
+  ThreadStore *ThreadStore::get_next() const {
+    return next_;
+  }
+
+  bool ThreadStore::nested_acquire(VersionHandle &handle) {
+    assert(tid_ == gettn());
+    bool bret = false;
+    if (0 < acquire_depth_) {
+      acquire_depth_++;
+      handle.tid_ = tid_;
+      handle._ = 0;
+      handle.seq_ = curr_seq_;
+      bret = true;
+    }
+    return bret;
+  }
+
+  int ThreadStore::acquire(const uint64_t version, VersionHandle &handle) {
+    assert(tid_ == gettn());
+    int ret = HAL_SUCCESS;
+    if (UINT64_MAX != curr_version_) {
+      LOG_WARN(CLIB, "current thread has already assigned a version handle, seq=%u", curr_seq_);
+      ret = HAL_EBUSY;
+    } else {
+      acquire_timestamp_ = get_coarse_microseconds_time();
+      // Must be visible before the caller re-checks the global version
+      publish_version_(version);
+      acquire_depth_ = 1;
+      handle.tid_ = tid_;
+      handle._ = 0;
+      handle.seq_ = curr_seq_;
+    }
+    return ret;
+  }
+
+  bool ThreadStore::release(const VersionHandle &handle) {
+    assert(tid_ == gettn());
+    bool bret = false;
+    // A stale handle of an earlier critical section must not end the
+    // current one, whatever its depth is
+    if (tid_ != handle.tid_
+        || curr_seq_ != handle.seq_
+        || 0 >= acquire_depth_) {
+      LOG_WARN(CLIB, "invalid handle, seq=%u tid=%hu", handle.seq_, handle.tid_);
+    } else if (1 < acquire_depth_) {
+      acquire_depth_--;
+    } else {
+      acquire_depth_ = 0;
+      publish_version_(UINT64_MAX);
+      curr_seq_++;
+      bret = true;
+    }
+    return bret;
+  }
+
+  void ThreadStore::force_release() {
+    if (UINT64_MAX != curr_version_) {
+      LOG_WARN(CLIB, "thread exits inside critical section, tid=%hu depth=%ld", tid_, acquire_depth_);
+      acquire_depth_ = 0;
+      publish_version_(UINT64_MAX);
+      curr_seq_++;
+    }
+  }
+
+  int ThreadStore::add_node(const uint64_t version, void *ptr, HALRetireFunc retire_func, void *arg, const int64_t size) {
+    assert(tid_ == gettn());
+    int ret = HAL_SUCCESS;
+    RetireChunk *chunk = tail_chunk_;
+    if (NULL == chunk
+        || RetireChunk::ENTRY_COUNT <= chunk->count_) {
+      RetireChunk *new_chunk = NULL;
+      if (NULL == (new_chunk = alloc_chunk_())) {
+        ret = HAL_ALLOCATE_FAIL;
+      } else {
+        if (NULL == chunk) {
+          ATOMIC_STORE(&head_chunk_, new_chunk);
+        } else {
+          ATOMIC_STORE(&chunk->next_, new_chunk);
+        }
+        tail_chunk_ = chunk = new_chunk;
+      }
+    }
+    if (HAL_SUCCESS == ret) {
+      assert(0 == chunk->count_ || version >= chunk->entries_[chunk->count_ - 1].version_);
+      RetireEntry &entry = chunk->entries_[chunk->count_];
+      entry.version_ = version;
+      entry.ptr_ = ptr;
+      entry.retire_func_ = retire_func;
+      entry.arg_ = arg;
+      entry.size_ = size;
+      ATOMIC_STORE(&chunk->count_, chunk->count_ + 1);
+      __sync_add_and_fetch(&hazard_waiting_count_, 1);
+    }
+    return ret;
+  }
+
+  int64_t ThreadStore::retire(
+      const uint64_t version,
+      int64_t &retire_bytes,
+      IHALRetireExecutor *executor,
+      HALRetireDoneFunc done_func,
+      void *done_arg) {
+    int64_t retire_count = 0;
+    int64_t sweep_count = 0;
+    retire_bytes = 0;
+    HALRetireBatch *batch = NULL;
+    if (!retire_lock_.try_lock()) {
+      // another thread is retiring this store
+    } else {
+      if (last_retire_version_ != version) {
+        last_retire_version_ = version;
+        int64_t start_time = 0;
+        RetireChunk *chunk = NULL;
+        while (NULL != (chunk = ATOMIC_LOAD(&head_chunk_))) {
+          // Entries are sorted by version, find the cut point and sweep the prefix
+          const int64_t count = ATOMIC_LOAD(&chunk->count_);
+          RetireEntry *begin = &chunk->entries_[head_pos_];
+          RetireEntry *end = &chunk->entries_[count];
+          RetireEntry *cut = begin;
+          int64_t len = end - begin;
+          while (0 < len) {
+            int64_t half = len / 2;
+            if (cut[half].version_ <= version) {
+              cut += half + 1;
+              len -= half + 1;
+            } else {
+              len = half;
+            }
+          }
+          if (0 == start_time
+              && begin < cut) {
+            start_time = get_cur_microseconds_time();
+          }
+          for (RetireEntry *iter = begin; iter < cut; iter++) {
+            if (NULL == executor
+                || (NULL == batch && NULL == (batch = HALRetireBatch::alloc()))) {
+              iter->retire_func_(iter->ptr_, iter->arg_);
+              retire_count++;
+              retire_bytes += iter->size_;
+            } else {
+              if (0 == batch->count_) {
+                batch->done_func_ = done_func;
+                batch->done_arg_ = done_arg;
+              }
+              batch->bytes_ += iter->size_;
+              HALRetireBatch::Item &item = batch->items_[batch->count_++];
+              item.ptr_ = iter->ptr_;
+              item.retire_func_ = iter->retire_func_;
+              item.arg_ = iter->arg_;
+              if (HALRetireBatch::MAX_COUNT <= batch->count_) {
+                submit_retire_batch(executor, batch);
+                batch = NULL;
+              }
+            }
+          }
+          sweep_count += cut - begin;
+          head_pos_ = cut - chunk->entries_;
+          // The owner may fill the chunk and link next_ after count was loaded,
+          // leave the chunk only once every entry of it is swept
+          RetireChunk *next = NULL;
+          if (RetireChunk::ENTRY_COUNT == head_pos_
+              && NULL != (next = ATOMIC_LOAD(&chunk->next_))) {
+            ATOMIC_STORE(&head_chunk_, next);
+            head_pos_ = 0;
+            free_chunk_(chunk);
+          } else {
+            break;
+          }
+        }
+        if (NULL != batch) {
+          submit_retire_batch(executor, batch);
+          batch = NULL;
+        }
+        __sync_add_and_fetch(&hazard_waiting_count_, -sweep_count);
+        if (0 < sweep_count) {
+          int64_t retire_time = get_cur_microseconds_time() - start_time;
+          ATOMIC_STORE(&retired_count_, retired_count_ + sweep_count);
+          ATOMIC_STORE(&retire_pass_count_, retire_pass_count_ + 1);
+          ATOMIC_STORE(&retire_time_us_, retire_time_us_ + retire_time);
+          if (max_retire_time_us_ < retire_time) {
+            ATOMIC_STORE(&max_retire_time_us_, retire_time);
+          }
+        }
+      }
+      retire_lock_.unlock();
+    }
+    return retire_count;
+  }
+
+  void ThreadStore::publish_version_(const uint64_t version) {
+    if (light_publish_) {
+      // Made visible by the heavy_fence() issued before scanning
+      __COMPILER_BARRIER();
+      curr_version_ = version;
+      __COMPILER_BARRIER();
+    } else {
+      ATOMIC_STORE(&curr_version_, version);
+    }
+    group_->mark_dirty(light_publish_);
+  }
+
+  uint64_t ThreadStore::get_version() const {
+    return ATOMIC_LOAD(&curr_version_);
+  }
+
+  int64_t ThreadStore::get_hazard_waiting_count() const {
+    return ATOMIC_LOAD(&hazard_waiting_count_);
+  }
+
+  bool ThreadStore::in_critical_section() const {
+    assert(tid_ == gettn());
+    return (0 < acquire_depth_);
+  }
+
+  int64_t ThreadStore::get_acquire_timestamp() const {
+    return ATOMIC_LOAD(&acquire_timestamp_);
+  }
+
+  void ThreadStore::get_stat(HALHazardThreadStat &stat, const int64_t now) const {
+    stat.tid_ = tid_;
+    stat.version_ = get_version();
+    stat.hold_us_ = (UINT64_MAX == stat.version_) ? 0 : std::max(now - get_acquire_timestamp(), (int64_t)0);
+    stat.pending_count_ = get_hazard_waiting_count();
+    stat.retired_count_ = ATOMIC_LOAD(&retired_count_);
+  }
+
+  void ThreadStore::add_retire_stat(HALHazardVersionStat &stat) const {
+    stat.retired_count_ += ATOMIC_LOAD(&retired_count_);
+    stat.retire_pass_count_ += ATOMIC_LOAD(&retire_pass_count_);
+    stat.retire_time_us_ += ATOMIC_LOAD(&retire_time_us_);
+    stat.max_retire_time_us_ = std::max(stat.max_retire_time_us_, ATOMIC_LOAD(&max_retire_time_us_));
+  }
+
+  RetireChunk *ThreadStore::alloc_chunk_() {
+    RetireChunk *ret = __sync_lock_test_and_set(&spare_chunk_, (RetireChunk*)NULL);
+    if (NULL == ret
+        && NULL == (ret = (RetireChunk*)hal_malloc(sizeof(RetireChunk), HALModIds::HAZARD_VERSION))) {
+      LOG_WARN(CLIB, "hal_malloc retire chunk fail, tid=%hu", tid_);
+    } else {
+      ret->next_ = NULL;
+      ret->count_ = 0;
+    }
+    return ret;
+  }
+
+  void ThreadStore::free_chunk_(RetireChunk *chunk) {
+    // Keep one chunk for the owner thread to avoid malloc/free on every round
+    if (!__sync_bool_compare_and_swap(&spare_chunk_, (RetireChunk*)NULL, chunk)) {
+      hal_free(chunk);
+    }
+  }
+
+  ThreadGroup::ThreadGroup()
+    : members_(NULL),
+      member_count_(0),
+      next_(NULL),
+      lock_(),
+      min_version_(UINT64_MAX),
+      dirty_(false) {
+  }
+
+  ThreadGroup::~ThreadGroup() {
+  }
+
+  void ThreadGroup::set_members(ThreadStore *members, const int64_t member_count) {
+    members_ = members;
+    member_count_ = member_count;
+  }
+
+  void ThreadGroup::set_next(ThreadGroup *group) {
+    next_ = group;
+  }
+
+  ThreadGroup *ThreadGroup::get_next() const {
+    return next_;
+  }
+
+  void ThreadGroup::mark_dirty(const bool light_publish) {
+    // Read first to keep the line shared while the group is already dirty
+    if (!ATOMIC_LOAD(&dirty_)) {
+      if (light_publish) {
+        dirty_ = true;
+        __COMPILER_BARRIER();
+      } else {
+        ATOMIC_STORE(&dirty_, true);
+      }
+    }
+  }
+
+  uint64_t ThreadGroup::get_min_version() {
+    uint64_t ret = UINT64_MAX;
+    if (!lock_.try_lock()) {
+      // Another thread is refreshing the cache, do not trust it
+      ret = calc_min_version_();
+    } else {
+      // Clear before scanning, a member publishing after the scan marks it again
+      if (ATOMIC_LOAD(&dirty_)) {
+        ATOMIC_STORE(&dirty_, false);
+        ATOMIC_STORE(&min_version_, calc_min_version_());
+      }
+      ret = ATOMIC_LOAD(&min_version_);
+      lock_.unlock();
+    }
+    return ret;
+  }
+
+  uint64_t ThreadGroup::calc_min_version_() const {
+    uint64_t ret = UINT64_MAX;
+    // Members never enabled hold UINT64_MAX, no need to check them
+    for (int64_t i = 0; i < member_count_; i++) {
+      uint64_t version = members_[i].get_version();
+      if (ret > version) {
+        ret = version;
+      }
+    }
+    return ret;
+  }
+}
+}
+}
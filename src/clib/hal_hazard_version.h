@@ -4,36 +4,133 @@
 #ifndef __HAL_CLIB_HAZARD_VERSION_H__
 #define __HAL_CLIB_HAZARD_VERSION_H__
 #include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <new>
+#include <algorithm>
 
 #include "clib/hal_define.h"
 #include "clib/hal_error.h"
 #include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_i_allocator.h"
 #include "clib/hal_base_log.h"
 #include "clib/hal_spin_lock.h"
+#include "clib/hal_thread_registry.h"
+#include "clib/hal_retire_pool.h"
 
 namespace libhalog {
 namespace clib {
 namespace hazard_version {
   class ThreadStore;
+  class ThreadGroup;
+}
+namespace epoch_reclaim {
+  class ThreadStore;
+}
+namespace hazard_pointer {
+  class ThreadStore;
 }
   class HALHazardNodeI {
-    friend class hazard_version::ThreadStore;
+    friend class epoch_reclaim::ThreadStore;
+    friend class hazard_pointer::ThreadStore;
     public:
-      HALHazardNodeI() : __next__(NULL), __version__(UINT64_MAX) {}
+      HALHazardNodeI() : __next__(NULL) {}
       virtual ~HALHazardNodeI() {}
     public:
       virtual void retire() = 0;
     private:
       void __set_next__(HALHazardNodeI *next) { assert(this != next); __next__ = next; }
       HALHazardNodeI *__get_next__() const {return __next__;}
-      void __set_version__(const uint64_t version) {__version__ = version;}
-      uint64_t __get_version__() const {return __version__;}
     private:
       HALHazardNodeI *__next__;
-      uint64_t __version__;
+  };
+
+  // What add_node does when the memory limit is still exceeded after a forced retire
+  class HALBackpressurePolicies {
+    public:
+      enum {
+        HAL_BACKPRESSURE_SPIN = 0,      // wait with backoff for the readers
+        HAL_BACKPRESSURE_ERROR = 1,     // return HAL_OVER_MEMORY_LIMIT, node is not taken
+        HAL_BACKPRESSURE_CALLBACK = 2,  // call the callback then take the node anyway
+        HAL_BACKPRESSURE_END,
+      };
+  };
+
+  typedef void (*HALBackpressureCallback)(const int64_t waiting_count, const int64_t waiting_bytes, void *arg);
+
+  // Per thread state, hold_us is 0 and version is UINT64_MAX outside of
+  // critical sections.
+  struct HALHazardThreadStat {
+    uint16_t tid_;
+    uint64_t version_;
+    int64_t hold_us_;
+    int64_t pending_count_;
+    int64_t retired_count_;
+  };
+
+  struct HALHazardVersionStat {
+    uint64_t curr_version_;
+    // UINT64_MAX and -1 holder if no thread is in a critical section
+    uint64_t oldest_version_;
+    int64_t oldest_holder_tid_;
+    int64_t oldest_hold_us_;
+    int64_t thread_count_;
+    int64_t pending_count_;
+    int64_t pending_bytes_;
+    // Totals since construction, sample twice to get throughput
+    int64_t retired_count_;
+    int64_t retire_pass_count_;
+    int64_t retire_time_us_;
+    int64_t max_retire_time_us_;
   };
 
 namespace hazard_version {
+  inline void retire_hazard_node(void *ptr, void *arg) {
+    UNUSED(arg);
+    ((HALHazardNodeI*)ptr)->retire();
+  }
+
+  template <class T>
+  void delete_object(void *ptr, void *arg) {
+    UNUSED(arg);
+    delete (T*)ptr;
+  }
+
+  template <class T>
+  void free_object(void *ptr, void *arg) {
+    ((T*)ptr)->~T();
+    ((IHALAllocator*)arg)->free(ptr);
+  }
+
+  inline void submit_retire_batch(IHALRetireExecutor *executor, HALRetireBatch *batch) {
+    if (HAL_SUCCESS != executor->execute(batch)) {
+      // Queue is full, the retiring thread pays for it
+      batch->run();
+      HALRetireBatch::free(batch);
+    }
+  }
+
+  struct RetireEntry {
+    uint64_t version_;
+    void *ptr_;
+    HALRetireFunc retire_func_;
+    void *arg_;
+    int64_t size_;
+  };
+
+  // Nodes added by one thread in version order, written only by the owner
+  // thread and published by count_, full chunks are linked by next_.
+  struct RetireChunk {
+    static const int64_t ENTRY_COUNT = 256;
+    RetireChunk *next_;
+    int64_t count_;
+    RetireEntry entries_[ENTRY_COUNT];
+  };
+
   struct VersionHandle {
     union {
       struct {
@@ -51,43 +148,118 @@ namespace hazard_version {
       ThreadStore();
       ~ThreadStore();
     public:
-      void set_enabled(const uint16_t tid);
+      // Version is published with compiler barriers only if light_publish,
+      // the reader of versions must issue heavy_fence() before scanning.
+      void set_enabled(const uint16_t tid, ThreadGroup *group, const bool light_publish);
       bool is_enabled() const;
       uint16_t get_tid() const;
 
       void set_next(ThreadStore *ts);
       ThreadStore *get_next() const;
 
+      // Nested acquire/release only touch the depth counter, the version
+      // published by the outermost acquire protects the whole critical section.
+      bool nested_acquire(VersionHandle &handle);
       int acquire(const uint64_t version, VersionHandle &handle);
-      void release(const VersionHandle &handle);
-
-      int add_node(const uint64_t version, HALHazardNodeI *node);
+      // Return true if the outermost critical section is left
+      bool release(const VersionHandle &handle);
+      // Drop the version held by an exiting thread, whatever the depth is
+      void force_release();
+
+      // Only called by the owner thread, versions must not decrease
+      int add_node(const uint64_t version, void *ptr, HALRetireFunc retire_func, void *arg, const int64_t size);
+      // Nodes not swept by retire() yet
       int64_t get_hazard_waiting_count() const;
-      int64_t retire(const uint64_t version, ThreadStore &node_receiver);
+      // Retire the nodes whose version <= version, may be called by any
+      // thread, returns 0 at once if another thread is retiring this store.
+      // Retire functions are run by executor if it is not NULL. Returns the
+      // count and bytes of the nodes retired inline, the batches executor
+      // takes are reported to done_func after they have run.
+      int64_t retire(
+        const uint64_t version,
+        int64_t &retire_bytes,
+        IHALRetireExecutor *executor,
+        HALRetireDoneFunc done_func,
+        void *done_arg);
+      bool in_critical_section() const;
 
       uint64_t get_version() const;
+      // Racy reads for statistics
+      int64_t get_acquire_timestamp() const;
+      void get_stat(HALHazardThreadStat &stat, const int64_t now) const;
+      void add_retire_stat(HALHazardVersionStat &stat) const;
     private:
-      void add_nodes_(HALHazardNodeI *head, HALHazardNodeI *tail, const int64_t count);
+      void publish_version_(const uint64_t version);
+      RetireChunk *alloc_chunk_();
+      void free_chunk_(RetireChunk *chunk);
     private:
       bool enabled_;
       uint16_t tid_;
-      uint64_t last_retire_version_;
+      ThreadGroup *group_;
+      bool light_publish_;
+      int64_t acquire_depth_;
 
       struct {
         uint32_t curr_seq_;
         uint64_t curr_version_;
+        int64_t acquire_timestamp_;
       } CACHE_ALIGNED;
 
-      HALHazardNodeI *hazard_waiting_list_ CACHE_ALIGNED;
-      int64_t hazard_waiting_count_ CACHE_ALIGNED;
+      // Producer side, touched by the owner thread only
+      RetireChunk *tail_chunk_ CACHE_ALIGNED;
+      RetireChunk *spare_chunk_;
+      int64_t hazard_waiting_count_;
+
+      // Consumer side, guarded by retire_lock_
+      HALSpinLock retire_lock_ CACHE_ALIGNED;
+      RetireChunk *head_chunk_;
+      int64_t head_pos_;
+      uint64_t last_retire_version_;
+      int64_t retired_count_;
+      int64_t retire_pass_count_;
+      int64_t retire_time_us_;
+      int64_t max_retire_time_us_;
 
       ThreadStore *next_ CACHE_ALIGNED;
   };
 
-  class DummyHazardNode : public HALHazardNodeI {
+  // A fixed range of ThreadStores whose minimum version is cached, members mark
+  // the group dirty when their version changes so a clean group costs one load.
+  class ThreadGroup {
+    public:
+      ThreadGroup();
+      ~ThreadGroup();
     public:
-      void retire() {}
+      void set_members(ThreadStore *members, const int64_t member_count);
+
+      void set_next(ThreadGroup *group);
+      ThreadGroup *get_next() const;
+
+      void mark_dirty(const bool light_publish);
+      uint64_t get_min_version();
+    private:
+      uint64_t calc_min_version_() const;
+    private:
+      ThreadStore *members_;
+      int64_t member_count_;
+      ThreadGroup *next_;
+
+      HALSpinLock lock_ CACHE_ALIGNED;
+      uint64_t min_version_;
+
+      bool dirty_ CACHE_ALIGNED;
   };
+
+  static const int64_t THREAD_CHUNK_SIZE = 16;
+
+  // ThreadStores of THREAD_CHUNK_SIZE consecutive tids and the group caching
+  // their min version, allocated on the first use of any of these tids.
+  struct ThreadChunk {
+    ThreadGroup group_;
+    ThreadStore stores_[THREAD_CHUNK_SIZE];
+    void *buffer_;
+  };
+
 }
 
   ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -100,26 +272,128 @@ namespace hazard_version {
         const int64_t min_version_cache_timeus = 200000);
       ~HALHazardVersionT();
     public:
-      int add_node(HALHazardNodeI *node);
+      // size is only accounted against the byte budget of set_memory_limit()
+      int add_node(HALHazardNodeI *node, const int64_t size = 0);
+      // Objects need not derive from HALHazardNodeI, the retire buffer keeps
+      // the pointer and how to reclaim it.
+      int add_node(void *ptr, HALRetireFunc retire_func, void *arg, const int64_t size = 0);
+      // Reclaimed by delete
+      template <class T>
+      int add_object(T *obj);
+      // Destructed and returned to allocator, e.g. a pool or HALPageArenaT
+      template <class T>
+      int add_object(T *obj, IHALAllocator &allocator);
       int acquire(uint64_t &handle);
       void release(const uint64_t handle);
       void retire();
       int64_t get_hazard_waiting_count() const;
+    public:
+      // Run retire() every reclaim_interval_us in a background thread, release()
+      // then only clears the version of the caller and never reclaims inline.
+      int start_reclaimer(const int64_t reclaim_interval_us);
+      void stop_reclaimer();
+    public:
+      // Asymmetric fence mode: readers publish their version with compiler
+      // barriers only and the min version refresh issues heavy_fence() before
+      // scanning. Must be called before the first acquire or add_node, returns
+      // HAL_ERROR and keeps the fenced mode if membarrier is not available.
+      int enable_asymmetric_fence();
+      // Lazy version mode: add_node stamps version_ + 1 without writing the
+      // shared version_, which is advanced once per min version refresh instead.
+      // A reader acquiring before the next refresh also pins the nodes added
+      // since the last one. Must be called before the first acquire or add_node.
+      int enable_lazy_version();
+    public:
+      // Snapshots for diagnosis, not synchronized with the running threads
+      void get_stat(HALHazardVersionStat &stat) const;
+      // Fill stats of at most size threads which have used this instance
+      int get_thread_stats(HALHazardThreadStat *stats, const int64_t size, int64_t &count) const;
+      // LOG_WARN the holder of a version held longer than stall_threshold_us,
+      // at most once per warn_interval_us. Checked on every min version
+      // refresh, start_reclaimer() to get periodic checks. 0 disables it.
+      int set_stall_watchdog(const int64_t stall_threshold_us, const int64_t warn_interval_us);
+    public:
+      // Hard cap of the nodes waiting for reclamation, 0 means no limit. When
+      // add_node would exceed it, a forced retire() is done first and policy
+      // of HALBackpressurePolicies is applied if that is not enough.
+      int set_memory_limit(
+        const int64_t max_waiting_count,
+        const int64_t max_waiting_bytes,
+        const int32_t policy,
+        HALBackpressureCallback callback = NULL,
+        void *callback_arg = NULL);
+      int64_t get_hazard_waiting_bytes() const;
+    public:
+      // Hand the retire functions of reclaimable nodes to executor, e.g. a
+      // HALRetirePool, instead of running them in the reclaiming thread.
+      // Batches not accepted run inline. NULL restores inline reclamation,
+      // the executor must outlive its use by this instance. Nodes handed to
+      // it count as waiting until their batch has run, the destructor waits
+      // for them.
+      void set_retire_executor(IHALRetireExecutor *executor);
+    private:
+      class ExitHook : public HALThreadExitHook {
+        public:
+          explicit ExitHook(HALHazardVersionT &host) : host_(host) {}
+          void on_thread_exit(const int64_t tn) { host_.on_thread_exit_(tn); }
+        private:
+          HALHazardVersionT &host_;
+      };
     private:
       int get_thread_store_(hazard_version::ThreadStore *&ts);
+      hazard_version::ThreadStore *locate_thread_store_(const int64_t tn) const;
+      hazard_version::ThreadChunk *alloc_chunk_(const int64_t chunk_idx);
       uint64_t get_min_version_(const bool force_flush);
+      void on_thread_exit_(const int64_t tn);
+      void check_stalled_readers_();
+      void retire_store_(hazard_version::ThreadStore *ts, const uint64_t version);
+      static void retire_done_(const int64_t count, const int64_t bytes, void *arg);
+      bool over_memory_limit_(const int64_t size) const;
+      int apply_backpressure_(hazard_version::ThreadStore *ts, const int64_t size);
+      static void *reclaimer_routine_(void *data);
+    private:
+      static const int64_t MAX_BACKPRESSURE_BACKOFF_US = 1000;
+      static const int64_t THREAD_CHUNK_SIZE = hazard_version::THREAD_CHUNK_SIZE;
+      static const int64_t THREAD_CHUNK_COUNT = (MaxThreadCnt + THREAD_CHUNK_SIZE - 1) / THREAD_CHUNK_SIZE;
     private:
       int64_t thread_waiting_threshold_;
       int64_t min_version_cache_timeus_;
+      bool asymmetric_fence_;
+      bool lazy_version_;
+
+      bool reclaimer_running_;
+      bool reclaimer_stop_;
+      int64_t reclaim_interval_us_;
+      pthread_t reclaimer_pd_;
+
+      int64_t stall_threshold_us_;
+      int64_t stall_warn_interval_us_;
+      int64_t last_stall_warn_time_;
+
+      int64_t max_waiting_count_;
+      int64_t max_waiting_bytes_;
+      int32_t backpressure_policy_;
+      HALBackpressureCallback backpressure_callback_;
+      void *backpressure_callback_arg_;
+
+      IHALRetireExecutor *retire_executor_;
 
       uint64_t version_ CACHE_ALIGNED;
 
       HALSpinLock thread_lock_ CACHE_ALIGNED;
-      hazard_version::ThreadStore threads_[MaxThreadCnt];
+      // Two level directory, chunks are allocated on demand and never freed
+      // before the destructor, so a ThreadStore never moves once used.
+      hazard_version::ThreadChunk *chunks_[THREAD_CHUNK_COUNT];
       hazard_version::ThreadStore *thread_list_;
       int64_t thread_count_;
+      hazard_version::ThreadGroup *group_list_;
 
-      int64_t hazard_waiting_count_ CACHE_ALIGNED;
+      struct {
+        int64_t hazard_waiting_count_;
+        int64_t hazard_waiting_bytes_;
+      } CACHE_ALIGNED;
+
+      ExitHook exit_hook_;
 
       struct {
         uint64_t curr_min_version_;
@@ -131,188 +405,190 @@ namespace hazard_version {
 
   ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-namespace hazard_version {
-  ThreadStore::ThreadStore() 
-    : enabled_(false),
-      tid_(0),
-      last_retire_version_(0),
-      curr_seq_(0),
-      curr_version_(UINT64_MAX),
-      hazard_waiting_list_(NULL),
-      hazard_waiting_count_(0),
-      next_(NULL) {
-  }
-
-  ThreadStore::~ThreadStore() {
-    while (NULL != hazard_waiting_list_) {
-      hazard_waiting_list_->retire();
-      hazard_waiting_list_ = hazard_waiting_list_->__get_next__();
-    }
-  }
-
-  void ThreadStore::set_enabled(const uint16_t tid) {
-    enabled_ = true;
-    tid_ = tid;
-  }
+  template <uint16_t MaxThreadCnt>
+  const int64_t HALHazardVersionT<MaxThreadCnt>::MAX_BACKPRESSURE_BACKOFF_US;
 
-  bool ThreadStore::is_enabled() const {
-    return enabled_;
-  }
+  template <uint16_t MaxThreadCnt>
+  const int64_t HALHazardVersionT<MaxThreadCnt>::THREAD_CHUNK_SIZE;
 
-  uint16_t  ThreadStore::get_tid() const {
-    return tid_;
-  }
+  template <uint16_t MaxThreadCnt>
+  const int64_t HALHazardVersionT<MaxThreadCnt>::THREAD_CHUNK_COUNT;
 
-  void ThreadStore::set_next(ThreadStore *ts) {
-    next_ = ts;
+  template <uint16_t MaxThreadCnt>
+  HALHazardVersionT<MaxThreadCnt>::HALHazardVersionT(
+    const int64_t thread_waiting_threshold,
+    const int64_t min_version_cache_timeus)
+    : thread_waiting_threshold_(thread_waiting_threshold),
+      min_version_cache_timeus_(min_version_cache_timeus),
+      asymmetric_fence_(false),
+      lazy_version_(false),
+      reclaimer_running_(false),
+      reclaimer_stop_(false),
+      reclaim_interval_us_(0),
+      reclaimer_pd_(),
+      stall_threshold_us_(0),
+      stall_warn_interval_us_(0),
+      last_stall_warn_time_(0),
+      max_waiting_count_(0),
+      max_waiting_bytes_(0),
+      backpressure_policy_(HALBackpressurePolicies::HAL_BACKPRESSURE_SPIN),
+      backpressure_callback_(NULL),
+      backpressure_callback_arg_(NULL),
+      retire_executor_(NULL),
+      version_(0), 
+      thread_lock_(),
+      thread_list_(NULL),
+      thread_count_(0),
+      group_list_(NULL),
+      hazard_waiting_count_(0),
+      hazard_waiting_bytes_(0),
+      exit_hook_(*this),
+      curr_min_version_(0),
+      curr_min_version_timestamp_(0) {
+    for (int64_t i = 0; i < THREAD_CHUNK_COUNT; i++) {
+      chunks_[i] = NULL;
+    }
+    gsi<HALThreadRegistry>().add_exit_hook(&exit_hook_);
   }
 
-  ThreadStore *ThreadStore::get_next() const {
-    return next_;
+  template <uint16_t MaxThreadCnt>
+  HALHazardVersionT<MaxThreadCnt>::~HALHazardVersionT() {
+    gsi<HALThreadRegistry>().del_exit_hook(&exit_hook_);
+    stop_reclaimer();
+    retire();
+    // Batches still run by the executor report back to this instance
+    while (0 < ATOMIC_LOAD(&hazard_waiting_count_)) {
+      usleep(1000);
+      retire();
+    }
+    for (int64_t i = 0; i < THREAD_CHUNK_COUNT; i++) {
+      if (NULL != chunks_[i]) {
+        void *buffer = chunks_[i]->buffer_;
+        chunks_[i]->~ThreadChunk();
+        hal_free(buffer);
+        chunks_[i] = NULL;
+      }
+    }
   }
 
-  int ThreadStore::acquire(const uint64_t version, VersionHandle &handle) {
-    assert(tid_ == gettn());
+  template <uint16_t MaxThreadCnt>
+  int HALHazardVersionT<MaxThreadCnt>::start_reclaimer(const int64_t reclaim_interval_us) {
     int ret = HAL_SUCCESS;
-    if (UINT64_MAX != curr_version_) {
-      LOG_WARN(CLIB, "current thread has already assigned a version handle, seq=%u", curr_seq_);
-      ret = HAL_EBUSY;
+    if (0 >= reclaim_interval_us) {
+      LOG_WARN(CLIB, "invalid param, reclaim_interval_us=%ld", reclaim_interval_us);
+      ret = HAL_INVALID_PARAM;
+    } else if (ATOMIC_LOAD(&reclaimer_running_)) {
+      LOG_WARN(CLIB, "reclaimer has already been started");
+      ret = HAL_INIT_REPETITIVE;
     } else {
-      curr_version_ = version;
-      handle.tid_ = tid_;
-      handle._ = 0;
-      handle.seq_ = curr_seq_;
+      reclaim_interval_us_ = reclaim_interval_us;
+      ATOMIC_STORE(&reclaimer_stop_, false);
+      int tmp_ret = pthread_create(&reclaimer_pd_, NULL, reclaimer_routine_, this);
+      if (0 != tmp_ret) {
+        LOG_WARN(CLIB, "pthread_create fail, errno=%d", tmp_ret);
+        ret = HAL_ERROR;
+      } else {
+        ATOMIC_STORE(&reclaimer_running_, true);
+      }
     }
     return ret;
   }
 
-  void ThreadStore::release(const VersionHandle &handle) {
-    assert(tid_ == gettn());
-    if (tid_ != handle.tid_
-        && curr_seq_ != handle.seq_) {
-      LOG_WARN(CLIB, "invalid handle, seq=%u tid=%hu", handle.seq_, handle.tid_);
+  template <uint16_t MaxThreadCnt>
+  int HALHazardVersionT<MaxThreadCnt>::enable_asymmetric_fence() {
+    int ret = HAL_SUCCESS;
+    if (0 < ATOMIC_LOAD(&thread_count_)) {
+      LOG_WARN(CLIB, "hazard version is already in use, thread_count=%ld", thread_count_);
+      ret = HAL_EBUSY;
+    } else if (!register_heavy_fence()) {
+      LOG_WARN(CLIB, "heavy fence not available, keep fenced mode");
+      ret = HAL_ERROR;
     } else {
-      curr_version_ = UINT64_MAX;
-      curr_seq_++;
+      asymmetric_fence_ = true;
     }
+    return ret;
   }
 
-  int ThreadStore::add_node(const uint64_t version, HALHazardNodeI *node) {
-    assert(tid_ == gettn());
+  template <uint16_t MaxThreadCnt>
+  int HALHazardVersionT<MaxThreadCnt>::enable_lazy_version() {
     int ret = HAL_SUCCESS;
-    node->__set_version__(version);
-    add_nodes_(node, node, 1);
+    if (0 < ATOMIC_LOAD(&thread_count_)) {
+      LOG_WARN(CLIB, "hazard version is already in use, thread_count=%ld", thread_count_);
+      ret = HAL_EBUSY;
+    } else {
+      lazy_version_ = true;
+    }
     return ret;
   }
 
-  int64_t ThreadStore::retire(const uint64_t version, ThreadStore &node_receiver) {
-    assert(this != &node_receiver || tid_ == gettn());
-    if (last_retire_version_ == version) {
-      return 0;
-    }
-    last_retire_version_ = version;
-
-    HALHazardNodeI *curr = ATOMIC_LOAD(&hazard_waiting_list_);
-    HALHazardNodeI *old = curr;
-    while (old != (curr = __sync_val_compare_and_swap(&hazard_waiting_list_, old, NULL))) {
-      old = curr;
-    }
-
-    HALHazardNodeI *list2retire = NULL;
-    int64_t move_count = 0;
-    int64_t retire_count = 0;
-    DummyHazardNode pseudo_head;
-    pseudo_head.__set_next__(curr);
-    HALHazardNodeI *iter = &pseudo_head;
-    while (NULL != iter->__get_next__()) {
-      if (iter->__get_next__()->__get_version__() <= version) {
-        retire_count++;
-        HALHazardNodeI *tmp = iter->__get_next__();
-        iter->__set_next__(iter->__get_next__()->__get_next__());
-
-        tmp->__set_next__(list2retire);
-        list2retire = tmp;
-      } else {
-        move_count++;
-        iter = iter->__get_next__();
-      }
-    }
-
-    HALHazardNodeI *move_list_head = NULL;
-    HALHazardNodeI *move_list_tail = NULL;
-    if (NULL != (move_list_head = pseudo_head.__get_next__())) {
-      move_list_tail = iter;
-    }
-    node_receiver.add_nodes_(move_list_head, move_list_tail, move_count);
-    __sync_add_and_fetch(&hazard_waiting_count_, -(move_count+retire_count));
-
-    while (NULL != list2retire) {
-      HALHazardNodeI *node2retire = list2retire;
-      list2retire = list2retire->__get_next__();
-      node2retire->retire();
+  template <uint16_t MaxThreadCnt>
+  void HALHazardVersionT<MaxThreadCnt>::stop_reclaimer() {
+    if (ATOMIC_LOAD(&reclaimer_running_)) {
+      ATOMIC_STORE(&reclaimer_stop_, true);
+      pthread_join(reclaimer_pd_, NULL);
+      ATOMIC_STORE(&reclaimer_running_, false);
     }
-    return retire_count;
-  }
-
-  uint64_t ThreadStore::get_version() const {
-    return curr_version_;
-  }
-
-  int64_t ThreadStore::get_hazard_waiting_count() const {
-    return ATOMIC_LOAD(&hazard_waiting_count_);
   }
 
-  void ThreadStore::add_nodes_(HALHazardNodeI *head, HALHazardNodeI *tail, const int64_t count) {
-    // Thread is only one thread add node, no ABA problem
-    assert(tid_ == gettn());
-    if (0 < count) {
-      HALHazardNodeI *curr = ATOMIC_LOAD(&hazard_waiting_list_);
-      HALHazardNodeI *old = curr;
-      tail->__set_next__(curr);
-      while (old != (curr = __sync_val_compare_and_swap(&hazard_waiting_list_, old, head))) {
-        old = curr;
-        tail->__set_next__(old);
-      }
-      __sync_add_and_fetch(&hazard_waiting_count_, count);
+  template <uint16_t MaxThreadCnt>
+  void *HALHazardVersionT<MaxThreadCnt>::reclaimer_routine_(void *data) {
+    HALHazardVersionT<MaxThreadCnt> *host = (HALHazardVersionT<MaxThreadCnt>*)data;
+    while (!ATOMIC_LOAD(&host->reclaimer_stop_)) {
+      host->retire();
+      usleep((useconds_t)host->reclaim_interval_us_);
     }
+    host->retire();
+    return NULL;
   }
-}
 
-  ////////////////////////////////////////////////////////////////////////////////////////////////////
+  template <uint16_t MaxThreadCnt>
+  int HALHazardVersionT<MaxThreadCnt>::add_node(HALHazardNodeI *node, const int64_t size) {
+    return add_node(node, hazard_version::retire_hazard_node, NULL, size);
+  }
 
   template <uint16_t MaxThreadCnt>
-  HALHazardVersionT<MaxThreadCnt>::HALHazardVersionT(
-    const int64_t thread_waiting_threshold,
-    const int64_t min_version_cache_timeus)
-    : thread_waiting_threshold_(thread_waiting_threshold),
-      min_version_cache_timeus_(min_version_cache_timeus),
-      version_(0), 
-      thread_lock_(),
-      thread_list_(NULL),
-      thread_count_(0),
-      hazard_waiting_count_(0),
-      curr_min_version_(0),
-      curr_min_version_timestamp_(0) {
+  template <class T>
+  int HALHazardVersionT<MaxThreadCnt>::add_object(T *obj) {
+    return add_node(obj, hazard_version::delete_object<T>, NULL, sizeof(T));
   }
 
   template <uint16_t MaxThreadCnt>
-  HALHazardVersionT<MaxThreadCnt>::~HALHazardVersionT() {
-    retire();
+  template <class T>
+  int HALHazardVersionT<MaxThreadCnt>::add_object(T *obj, IHALAllocator &allocator) {
+    return add_node(obj, hazard_version::free_object<T>, &allocator, sizeof(T));
   }
 
   template <uint16_t MaxThreadCnt>
-  int HALHazardVersionT<MaxThreadCnt>::add_node(HALHazardNodeI *node) {
+  int HALHazardVersionT<MaxThreadCnt>::add_node(void *ptr, HALRetireFunc retire_func, void *arg, const int64_t size) {
     int ret = HAL_SUCCESS;
     hazard_version::ThreadStore *ts = NULL;
-    if (NULL == node) {
-      LOG_WARN(CLIB, "invalid param, node null pointer");
+    if (NULL == ptr
+        || NULL == retire_func
+        || 0 > size) {
+      LOG_WARN(CLIB, "invalid param, ptr=%p retire_func=%p size=%ld", ptr, (void*)retire_func, size);
       ret = HAL_INVALID_PARAM;
     } else if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
       LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
-    } else if (HAL_SUCCESS != (ret = ts->add_node(__sync_add_and_fetch(&version_, 1), node))) {
-      LOG_WARN(CLIB, "add_node fail, ret=%d", ret);
+    } else if (over_memory_limit_(size)
+              && HAL_SUCCESS != (ret = apply_backpressure_(ts, size))) {
+      // node is not taken, caller still owns it
     } else {
-      __sync_add_and_fetch(&hazard_waiting_count_, 1);
+      uint64_t version = 0;
+      if (lazy_version_) {
+        // The fence keeps the caller's unlink before the load, as the atomic add does
+        __sync_synchronize();
+        version = ATOMIC_LOAD(&version_) + 1;
+      } else {
+        version = __sync_add_and_fetch(&version_, 1);
+      }
+      if (HAL_SUCCESS != (ret = ts->add_node(version, ptr, retire_func, arg, size))) {
+        LOG_WARN(CLIB, "add_node fail, ret=%d", ret);
+      } else {
+        __sync_add_and_fetch(&hazard_waiting_count_, 1);
+        if (0 < size) {
+          __sync_add_and_fetch(&hazard_waiting_bytes_, size);
+        }
+      }
     }
     return ret;
   }
@@ -321,8 +597,11 @@ namespace hazard_version {
   int HALHazardVersionT<MaxThreadCnt>::acquire(uint64_t &handle) {
     int ret = HAL_SUCCESS;
     hazard_version::ThreadStore *ts = NULL;
+    hazard_version::VersionHandle nested_handle(0);
     if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
       LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
+    } else if (ts->nested_acquire(nested_handle)) {
+      handle = nested_handle.u64_;
     } else {
       while (true) {
         const uint64_t version = ATOMIC_LOAD(&version_);
@@ -344,13 +623,17 @@ namespace hazard_version {
   template <uint16_t MaxThreadCnt>
   void HALHazardVersionT<MaxThreadCnt>::release(const uint64_t handle) {
     hazard_version::VersionHandle version_handle(handle);
-    if (MaxThreadCnt > version_handle.tid_) {
-      hazard_version::ThreadStore *ts = &threads_[version_handle.tid_];
-      ts->release(version_handle);
-      if (thread_waiting_threshold_ < ts->get_hazard_waiting_count()) {
-        uint64_t min_version = get_min_version_(false);
-        int64_t retire_count = ts->retire(min_version, *ts);
-        __sync_add_and_fetch(&hazard_waiting_count_, -retire_count);
+    hazard_version::ThreadStore *ts = NULL;
+    if (gettn() != version_handle.tid_) {
+      // the store of another thread is not ours to touch
+      LOG_WARN(CLIB, "invalid handle, seq=%u tid=%hu", version_handle.seq_, version_handle.tid_);
+    } else if (NULL != (ts = locate_thread_store_(version_handle.tid_))) {
+      if (!ts->release(version_handle)) {
+        // still inside an outer critical section
+      } else if (ATOMIC_LOAD(&reclaimer_running_)) {
+        // nodes are reclaimed by the background reclaimer
+      } else if (thread_waiting_threshold_ < ts->get_hazard_waiting_count()) {
+        retire_store_(ts, get_min_version_(false));
       } else if (thread_waiting_threshold_ * ATOMIC_LOAD(&thread_count_) < ATOMIC_LOAD(&hazard_waiting_count_)) {
         retire();
       }
@@ -361,22 +644,63 @@ namespace hazard_version {
   template <uint16_t MaxThreadCnt>
   int HALHazardVersionT<MaxThreadCnt>::get_thread_store_(hazard_version::ThreadStore *&ts) {
     int ret = HAL_SUCCESS;
-    uint16_t tn = (uint16_t)(gettn());
+    int64_t tn = gettn();
     if (MaxThreadCnt <= tn) {
-      LOG_WARN(CLIB, "thread number overflow, tn=%hu", tn);
+      LOG_WARN(CLIB, "thread number overflow, tn=%ld", tn);
       ret = HAL_TOO_MANY_THREADS;
-    } else {
-      ts = &threads_[tn];
-      if (!ts->is_enabled()) {
-        thread_lock_.lock();
+    } else if (NULL == (ts = locate_thread_store_(tn))
+              || !ts->is_enabled()) {
+      const int64_t chunk_idx = tn / THREAD_CHUNK_SIZE;
+      thread_lock_.lock();
+      hazard_version::ThreadChunk *chunk = chunks_[chunk_idx];
+      if (NULL == chunk) {
+        if (NULL == (chunk = alloc_chunk_(chunk_idx))) {
+          ret = HAL_ALLOCATE_FAIL;
+        } else {
+          chunk->group_.set_next(ATOMIC_LOAD(&group_list_));
+          ATOMIC_STORE(&group_list_, &chunk->group_);
+          ATOMIC_STORE(&chunks_[chunk_idx], chunk);
+        }
+      }
+      if (HAL_SUCCESS == ret) {
+        ts = &chunk->stores_[tn % THREAD_CHUNK_SIZE];
         if (!ts->is_enabled()) {
-          ts->set_enabled(tn);
+          ts->set_enabled((uint16_t)tn, &chunk->group_, asymmetric_fence_);
           ts->set_next(ATOMIC_LOAD(&thread_list_));
           ATOMIC_STORE(&thread_list_, ts);
           __sync_add_and_fetch(&thread_count_, 1);
         }
-        thread_lock_.unlock();
       }
+      thread_lock_.unlock();
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  hazard_version::ThreadStore *HALHazardVersionT<MaxThreadCnt>::locate_thread_store_(const int64_t tn) const {
+    hazard_version::ThreadStore *ret = NULL;
+    hazard_version::ThreadChunk *chunk = NULL;
+    if (0 <= tn
+        && MaxThreadCnt > tn
+        && NULL != (chunk = ATOMIC_LOAD(&chunks_[tn / THREAD_CHUNK_SIZE]))) {
+      ret = &chunk->stores_[tn % THREAD_CHUNK_SIZE];
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  hazard_version::ThreadChunk *HALHazardVersionT<MaxThreadCnt>::alloc_chunk_(const int64_t chunk_idx) {
+    hazard_version::ThreadChunk *ret = NULL;
+    // hal_malloc only guarantees 8 bytes alignment, the chunk needs a cache line
+    void *buffer = hal_malloc(sizeof(hazard_version::ThreadChunk) + CACHE_ALIGN_SIZE, HALModIds::HAZARD_VERSION);
+    if (NULL == buffer) {
+      LOG_WARN(CLIB, "hal_malloc thread chunk fail, chunk_idx=%ld", chunk_idx);
+    } else {
+      void *aligned = (void*)(((uint64_t)buffer + CACHE_ALIGN_SIZE) & ~((uint64_t)CACHE_ALIGN_SIZE - 1));
+      ret = new(aligned) hazard_version::ThreadChunk();
+      ret->buffer_ = buffer;
+      int64_t member_count = std::min(THREAD_CHUNK_SIZE, (int64_t)MaxThreadCnt - chunk_idx * THREAD_CHUNK_SIZE);
+      ret->group_.set_members(ret->stores_, member_count);
     }
     return ret;
   }
@@ -389,45 +713,231 @@ namespace hazard_version {
         && (ATOMIC_LOAD(&curr_min_version_timestamp_) + min_version_cache_timeus_) > get_cur_microseconds_time()) {
       // from cache
     } else {
-      ret = ATOMIC_LOAD(&version_);
-      hazard_version::ThreadStore *iter = ATOMIC_LOAD(&thread_list_);
+      if (lazy_version_) {
+        // Nodes added since the last refresh carry version_ + 1, advance so that
+        // they become reclaimable once the readers before them are gone.
+        ret = __sync_add_and_fetch(&version_, 1);
+      } else {
+        ret = ATOMIC_LOAD(&version_);
+      }
+      if (asymmetric_fence_) {
+        // Readers not yet visible here will see the new version on re-check
+        heavy_fence();
+      }
+      hazard_version::ThreadGroup *iter = ATOMIC_LOAD(&group_list_);
       while (NULL != iter) {
-        uint64_t ts_min_version = iter->get_version();
-        if (ret > ts_min_version) {
-          ret = ts_min_version;
+        uint64_t group_min_version = iter->get_min_version();
+        if (ret > group_min_version) {
+          ret = group_min_version;
         }
         iter = iter->get_next();
       }
       ATOMIC_STORE(&curr_min_version_, ret);
       ATOMIC_STORE(&curr_min_version_timestamp_, get_cur_microseconds_time());
+      if (0 < ATOMIC_LOAD(&stall_threshold_us_)) {
+        check_stalled_readers_();
+      }
     }
     //LOG_DEBUG(CLIB, "get_min_version_=%lu", ret);
     return ret;
   }
 
+  template <uint16_t MaxThreadCnt>
+  void HALHazardVersionT<MaxThreadCnt>::on_thread_exit_(const int64_t tn) {
+    // Nodes still protected stay in the store and are taken over by the next
+    // thread reusing tn, or reclaimed by retire() of any other thread.
+    hazard_version::ThreadStore *ts = locate_thread_store_(tn);
+    if (NULL != ts) {
+      if (ts->is_enabled()) {
+        ts->force_release();
+        retire_store_(ts, get_min_version_(true));
+      }
+    }
+  }
+
   template <uint16_t MaxThreadCnt>
   void HALHazardVersionT<MaxThreadCnt>::retire() {
+    // Stores are retired in place, the caller does not need a store of its own
+    uint64_t min_version = get_min_version_(true);
+    hazard_version::ThreadStore *iter = ATOMIC_LOAD(&thread_list_);
+    while (NULL != iter) {
+      retire_store_(iter, min_version);
+      iter = iter->get_next();
+    }
+  }
+
+  template <uint16_t MaxThreadCnt>
+  void HALHazardVersionT<MaxThreadCnt>::get_stat(HALHazardVersionStat &stat) const {
+    const int64_t now = get_coarse_microseconds_time();
+    memset(&stat, 0, sizeof(stat));
+    stat.curr_version_ = ATOMIC_LOAD(&version_);
+    stat.pending_bytes_ = ATOMIC_LOAD(&hazard_waiting_bytes_);
+    stat.oldest_version_ = UINT64_MAX;
+    stat.oldest_holder_tid_ = -1;
+    hazard_version::ThreadStore *iter = ATOMIC_LOAD(&thread_list_);
+    while (NULL != iter) {
+      HALHazardThreadStat thread_stat;
+      iter->get_stat(thread_stat, now);
+      if (stat.oldest_version_ > thread_stat.version_) {
+        stat.oldest_version_ = thread_stat.version_;
+        stat.oldest_holder_tid_ = thread_stat.tid_;
+        stat.oldest_hold_us_ = thread_stat.hold_us_;
+      }
+      stat.thread_count_++;
+      stat.pending_count_ += thread_stat.pending_count_;
+      iter->add_retire_stat(stat);
+      iter = iter->get_next();
+    }
+  }
+
+  template <uint16_t MaxThreadCnt>
+  int HALHazardVersionT<MaxThreadCnt>::get_thread_stats(HALHazardThreadStat *stats, const int64_t size, int64_t &count) const {
     int ret = HAL_SUCCESS;
-    hazard_version::ThreadStore *ts = NULL;
-    if (HAL_SUCCESS != (ret = get_thread_store_(ts))) {
-      LOG_WARN(CLIB, "get_thread_store_ fail, ret=%d", ret);
+    if (NULL == stats
+        || 0 >= size) {
+      LOG_WARN(CLIB, "invalid param, stats=%p size=%ld", stats, size);
+      ret = HAL_INVALID_PARAM;
     } else {
-      uint64_t min_version = get_min_version_(true);
+      const int64_t now = get_coarse_microseconds_time();
+      count = 0;
+      hazard_version::ThreadStore *iter = ATOMIC_LOAD(&thread_list_);
+      while (NULL != iter
+            && count < size) {
+        iter->get_stat(stats[count++], now);
+        iter = iter->get_next();
+      }
+    }
+    return ret;
+  }
 
-      int64_t retire_count = ts->retire(min_version, *ts);
-      __sync_add_and_fetch(&hazard_waiting_count_, -retire_count);
+  template <uint16_t MaxThreadCnt>
+  int HALHazardVersionT<MaxThreadCnt>::set_stall_watchdog(const int64_t stall_threshold_us, const int64_t warn_interval_us) {
+    int ret = HAL_SUCCESS;
+    if (0 > stall_threshold_us
+        || 0 > warn_interval_us) {
+      LOG_WARN(CLIB, "invalid param, stall_threshold_us=%ld warn_interval_us=%ld", stall_threshold_us, warn_interval_us);
+      ret = HAL_INVALID_PARAM;
+    } else {
+      ATOMIC_STORE(&stall_warn_interval_us_, warn_interval_us);
+      ATOMIC_STORE(&stall_threshold_us_, stall_threshold_us);
+    }
+    return ret;
+  }
 
+  template <uint16_t MaxThreadCnt>
+  void HALHazardVersionT<MaxThreadCnt>::check_stalled_readers_() {
+    const int64_t now = get_coarse_microseconds_time();
+    const int64_t last_warn_time = ATOMIC_LOAD(&last_stall_warn_time_);
+    if ((last_warn_time + ATOMIC_LOAD(&stall_warn_interval_us_)) > now) {
+      // rate limited
+    } else {
+      HALHazardThreadStat oldest;
+      memset(&oldest, 0, sizeof(oldest));
       hazard_version::ThreadStore *iter = ATOMIC_LOAD(&thread_list_);
       while (NULL != iter) {
-        if (iter != ts) {
-          int64_t retire_count = iter->retire(min_version, *ts);
-          __sync_add_and_fetch(&hazard_waiting_count_, -retire_count);
+        HALHazardThreadStat thread_stat;
+        iter->get_stat(thread_stat, now);
+        if (oldest.hold_us_ < thread_stat.hold_us_) {
+          oldest = thread_stat;
         }
         iter = iter->get_next();
       }
+      if (ATOMIC_LOAD(&stall_threshold_us_) < oldest.hold_us_
+          && __sync_bool_compare_and_swap(&last_stall_warn_time_, last_warn_time, now)) {
+        LOG_WARN(CLIB, "reader stalled, tid=%hu version=%lu hold_us=%ld curr_version=%lu hazard_waiting_count=%ld",
+                oldest.tid_, oldest.version_, oldest.hold_us_, ATOMIC_LOAD(&version_), ATOMIC_LOAD(&hazard_waiting_count_));
+      }
     }
   }
 
+  template <uint16_t MaxThreadCnt>
+  void HALHazardVersionT<MaxThreadCnt>::retire_store_(hazard_version::ThreadStore *ts, const uint64_t version) {
+    int64_t retire_bytes = 0;
+    int64_t retire_count = ts->retire(version, retire_bytes, ATOMIC_LOAD(&retire_executor_), retire_done_, this);
+    retire_done_(retire_count, retire_bytes, this);
+  }
+
+  template <uint16_t MaxThreadCnt>
+  void HALHazardVersionT<MaxThreadCnt>::retire_done_(const int64_t count, const int64_t bytes, void *arg) {
+    HALHazardVersionT *host = (HALHazardVersionT*)arg;
+    if (0 < count) {
+      __sync_add_and_fetch(&host->hazard_waiting_count_, -count);
+    }
+    if (0 < bytes) {
+      __sync_add_and_fetch(&host->hazard_waiting_bytes_, -bytes);
+    }
+  }
+
+  template <uint16_t MaxThreadCnt>
+  int HALHazardVersionT<MaxThreadCnt>::set_memory_limit(
+      const int64_t max_waiting_count,
+      const int64_t max_waiting_bytes,
+      const int32_t policy,
+      HALBackpressureCallback callback,
+      void *callback_arg) {
+    int ret = HAL_SUCCESS;
+    if (0 > max_waiting_count
+        || 0 > max_waiting_bytes
+        || 0 > policy
+        || HALBackpressurePolicies::HAL_BACKPRESSURE_END <= policy
+        || (HALBackpressurePolicies::HAL_BACKPRESSURE_CALLBACK == policy && NULL == callback)) {
+      LOG_WARN(CLIB, "invalid param, max_waiting_count=%ld max_waiting_bytes=%ld policy=%d callback=%p",
+              max_waiting_count, max_waiting_bytes, policy, (void*)callback);
+      ret = HAL_INVALID_PARAM;
+    } else {
+      backpressure_policy_ = policy;
+      backpressure_callback_ = callback;
+      backpressure_callback_arg_ = callback_arg;
+      ATOMIC_STORE(&max_waiting_bytes_, max_waiting_bytes);
+      ATOMIC_STORE(&max_waiting_count_, max_waiting_count);
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  bool HALHazardVersionT<MaxThreadCnt>::over_memory_limit_(const int64_t size) const {
+    const int64_t max_waiting_count = ATOMIC_LOAD(&max_waiting_count_);
+    const int64_t max_waiting_bytes = ATOMIC_LOAD(&max_waiting_bytes_);
+    return (0 < max_waiting_count && max_waiting_count <= ATOMIC_LOAD(&hazard_waiting_count_))
+        || (0 < max_waiting_bytes && max_waiting_bytes < ATOMIC_LOAD(&hazard_waiting_bytes_) + size);
+  }
+
+  template <uint16_t MaxThreadCnt>
+  int HALHazardVersionT<MaxThreadCnt>::apply_backpressure_(hazard_version::ThreadStore *ts, const int64_t size) {
+    int ret = HAL_SUCCESS;
+    retire();
+    if (!over_memory_limit_(size)) {
+      // forced retire is enough
+    } else if (HALBackpressurePolicies::HAL_BACKPRESSURE_ERROR == backpressure_policy_) {
+      ret = HAL_OVER_MEMORY_LIMIT;
+    } else if (HALBackpressurePolicies::HAL_BACKPRESSURE_CALLBACK == backpressure_policy_) {
+      backpressure_callback_(ATOMIC_LOAD(&hazard_waiting_count_), ATOMIC_LOAD(&hazard_waiting_bytes_), backpressure_callback_arg_);
+    } else if (ts->in_critical_section()) {
+      // Waiting here would wait for the caller itself
+      LOG_WARN(CLIB, "can not wait for readers inside critical section, hazard_waiting_count=%ld hazard_waiting_bytes=%ld",
+              ATOMIC_LOAD(&hazard_waiting_count_), ATOMIC_LOAD(&hazard_waiting_bytes_));
+      ret = HAL_OVER_MEMORY_LIMIT;
+    } else {
+      int64_t backoff_us = 1;
+      while (over_memory_limit_(size)) {
+        usleep((useconds_t)backoff_us);
+        backoff_us = std::min(backoff_us * 2, MAX_BACKPRESSURE_BACKOFF_US);
+        retire();
+      }
+    }
+    return ret;
+  }
+
+  template <uint16_t MaxThreadCnt>
+  void HALHazardVersionT<MaxThreadCnt>::set_retire_executor(IHALRetireExecutor *executor) {
+    ATOMIC_STORE(&retire_executor_, executor);
+  }
+
+  template <uint16_t MaxThreadCnt>
+  int64_t HALHazardVersionT<MaxThreadCnt>::get_hazard_waiting_bytes() const {
+    return ATOMIC_LOAD(&hazard_waiting_bytes_);
+  }
+
   template <uint16_t MaxThreadCnt>
   int64_t HALHazardVersionT<MaxThreadCnt>::get_hazard_waiting_count() const {
     return ATOMIC_LOAD(&hazard_waiting_count_);
@@ -0,0 +1,279 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_LINKED_QUEUE_H__
+#define __HAL_CLIB_LINKED_QUEUE_H__
+#include <stdint.h>
+#include <assert.h>
+
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_base_log.h"
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+  // Unbounded MPMC queue. Producers swap the tail and link the previous one
+  // afterwards, so a pop may return HAL_QUEUE_EMPTY for a push that has not
+  // finished linking yet. Dequeued nodes are reclaimed through the
+  // HALHazardVersion of the queue and cached for later pushes.
+  template <class T>
+  class HALLinkedQueue {
+    struct Node {
+      Node *next_;
+      typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type data_;
+      T *get_data() { return reinterpret_cast<T*>(&data_); }
+    };
+    // Treiber stack of reusable nodes. Pops are done inside a critical
+    // section and nodes come back only through retire_node_, so a node
+    // seen on top cannot be popped and pushed again meanwhile (no ABA).
+    // Declared before hazard_version_, which may still retire nodes into
+    // it while being destroyed, and freed after it.
+    struct FreeList {
+      FreeList() : top_(NULL), count_(0) {}
+      ~FreeList() {
+        while (NULL != top_) {
+          Node *next = top_->next_;
+          hal_free(top_);
+          top_ = next;
+        }
+      }
+      Node *top_;
+      int64_t count_;
+    } CACHE_ALIGNED;
+    public:
+      // At most max_cached_count retired nodes are kept for reuse, the rest
+      // are returned by hal_free.
+      HALLinkedQueue(const int64_t max_cached_count = 1024);
+      ~HALLinkedQueue();
+    public:
+      int push(const T &data);
+      int push(T &&data);
+      // All or nothing, the count datas are dequeued in order and no element
+      // of other producers can be interleaved with them.
+      int push_batch(const T *datas, const int64_t count);
+      int pop(T &data);
+      int64_t get_cached_count() const;
+    private:
+      template <class U>
+      int push_(U &&data);
+      Node *alloc_node_();
+      void free_node_(Node *node);
+      void link_(Node *first, Node *last);
+      static void retire_node_(void *ptr, void *arg);
+    private:
+      HALLinkedQueue(const HALLinkedQueue &);
+      HALLinkedQueue &operator =(const HALLinkedQueue &);
+    private:
+      int64_t max_cached_count_;
+      FreeList free_list_;
+      HALHazardVersion hazard_version_;
+      Node *head_ CACHE_ALIGNED;
+      Node *tail_ CACHE_ALIGNED;
+  };
+
+  template <class T>
+  HALLinkedQueue<T>::HALLinkedQueue(const int64_t max_cached_count)
+    : max_cached_count_(max_cached_count),
+      free_list_(),
+      hazard_version_(),
+      head_(NULL),
+      tail_(NULL) {
+    head_ = (Node*)hal_malloc(sizeof(Node), HALModIds::LINKED_QUEUE);
+    assert(NULL != head_);
+    head_->next_ = NULL;
+    tail_ = head_;
+  }
+
+  template <class T>
+  HALLinkedQueue<T>::~HALLinkedQueue() {
+    // Retired nodes, also those of a thread exiting meanwhile, go to
+    // free_list_ and are freed with it after hazard_version_
+    Node *node = head_->next_;
+    hal_free(head_);
+    while (NULL != node) {
+      Node *next = node->next_;
+      node->get_data()->~T();
+      hal_free(node);
+      node = next;
+    }
+    head_ = NULL;
+    tail_ = NULL;
+  }
+
+  template <class T>
+  int HALLinkedQueue<T>::push(const T &data) {
+    return push_(data);
+  }
+
+  template <class T>
+  int HALLinkedQueue<T>::push(T &&data) {
+    return push_(std::move(data));
+  }
+
+  template <class T>
+  template <class U>
+  int HALLinkedQueue<T>::push_(U &&data) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    Node *node = NULL;
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      if (NULL == (node = alloc_node_())) {
+        LOG_WARN(CLIB, "alloc node fail");
+        ret = HAL_ALLOCATE_FAIL;
+      } else {
+        new(node->get_data()) T(std::forward<U>(data));
+        link_(node, node);
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class T>
+  int HALLinkedQueue<T>::push_batch(const T *datas, const int64_t count) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    if (NULL == datas
+        || 0 >= count) {
+      LOG_WARN(CLIB, "invalid param, datas=%p count=%ld", datas, count);
+      ret = HAL_INVALID_PARAM;
+    } else if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      Node *first = NULL;
+      Node *last = NULL;
+      for (int64_t i = 0; i < count; i++) {
+        Node *node = alloc_node_();
+        if (NULL == node) {
+          LOG_WARN(CLIB, "alloc node fail, index=%ld count=%ld", i, count);
+          ret = HAL_ALLOCATE_FAIL;
+          break;
+        }
+        new(node->get_data()) T(datas[i]);
+        if (NULL == last) {
+          first = node;
+        } else {
+          last->next_ = node;
+        }
+        last = node;
+      }
+      if (HAL_SUCCESS == ret) {
+        link_(first, last);
+      } else {
+        // Never published, but they may have been on free_list_ while
+        // another thread read their next_, so they come back through
+        // retire_node_ as well
+        while (NULL != first) {
+          Node *next = first->next_;
+          first->get_data()->~T();
+          int tmp_ret = hazard_version_.add_node(first, retire_node_, this, sizeof(Node));
+          if (HAL_SUCCESS != tmp_ret) {
+            LOG_WARN(CLIB, "add_node fail, node leaked, ret=%d", tmp_ret);
+          }
+          first = next;
+        }
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class T>
+  int HALLinkedQueue<T>::pop(T &data) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      Node *curr = ATOMIC_LOAD(&head_);
+      Node *next = ATOMIC_LOAD(&curr->next_);
+      while (NULL != next) {
+        Node *old = __sync_val_compare_and_swap(&head_, curr, next);
+        if (old == curr) {
+          break;
+        }
+        curr = old;
+        next = ATOMIC_LOAD(&curr->next_);
+      }
+      if (NULL == next) {
+        ret = HAL_QUEUE_EMPTY;
+      } else {
+        // next is the new dummy, only the winner of the CAS touches its data
+        T *ptr = next->get_data();
+        data = std::move(*ptr);
+        ptr->~T();
+        int tmp_ret = hazard_version_.add_node(curr, retire_node_, this, sizeof(Node));
+        if (HAL_SUCCESS != tmp_ret) {
+          LOG_WARN(CLIB, "add_node fail, node leaked, ret=%d", tmp_ret);
+        }
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class T>
+  int64_t HALLinkedQueue<T>::get_cached_count() const {
+    return ATOMIC_LOAD(&free_list_.count_);
+  }
+
+  template <class T>
+  typename HALLinkedQueue<T>::Node *HALLinkedQueue<T>::alloc_node_() {
+    Node *node = ATOMIC_LOAD(&free_list_.top_);
+    while (NULL != node) {
+      Node *old = __sync_val_compare_and_swap(&free_list_.top_, node, ATOMIC_LOAD(&node->next_));
+      if (old == node) {
+        __sync_add_and_fetch(&free_list_.count_, -1);
+        break;
+      }
+      node = old;
+    }
+    if (NULL == node) {
+      node = (Node*)hal_malloc(sizeof(Node), HALModIds::LINKED_QUEUE);
+    }
+    if (NULL != node) {
+      node->next_ = NULL;
+    }
+    return node;
+  }
+
+  template <class T>
+  void HALLinkedQueue<T>::free_node_(Node *node) {
+    if (max_cached_count_ <= ATOMIC_LOAD(&free_list_.count_)) {
+      hal_free(node);
+    } else {
+      __sync_add_and_fetch(&free_list_.count_, 1);
+      Node *curr = ATOMIC_LOAD(&free_list_.top_);
+      Node *old = NULL;
+      do {
+        old = curr;
+        node->next_ = old;
+      } while (old != (curr = __sync_val_compare_and_swap(&free_list_.top_, old, node)));
+    }
+  }
+
+  template <class T>
+  void HALLinkedQueue<T>::link_(Node *first, Node *last) {
+    // xchg is a full barrier on x86, the datas are visible before prev is linked
+    Node *prev = __sync_lock_test_and_set(&tail_, last);
+    ATOMIC_STORE(&prev->next_, first);
+  }
+
+  template <class T>
+  void HALLinkedQueue<T>::retire_node_(void *ptr, void *arg) {
+    ((HALLinkedQueue<T>*)arg)->free_node_((Node*)ptr);
+  }
+
+}
+}
+
+#endif // __HAL_CLIB_LINKED_QUEUE_H__
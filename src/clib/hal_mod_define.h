@@ -4,6 +4,14 @@
 #ifdef HAL_MOD_DEF
 HAL_MOD_DEF(CLIB)
 HAL_MOD_DEF(FIXED_QUEUE)
+HAL_MOD_DEF(HAZARD_POINTER)
+HAL_MOD_DEF(HAZARD_VERSION)
+HAL_MOD_DEF(RETIRE_POOL)
+HAL_MOD_DEF(LINKED_QUEUE)
+HAL_MOD_DEF(STACK)
+HAL_MOD_DEF(HASH_MAP)
+HAL_MOD_DEF(SKIP_LIST)
+HAL_MOD_DEF(CACHE)
 HAL_MOD_DEF(END)
 #endif
 
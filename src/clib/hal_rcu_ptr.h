@@ -0,0 +1,122 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_RCU_PTR_H__
+#define __HAL_CLIB_RCU_PTR_H__
+#include <stdint.h>
+
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_base_log.h"
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+  // RCU style pointer for read-mostly objects such as configs or routing
+  // tables. Readers enter a critical section of HALHazardVersion and load the
+  // pointer, they never write a shared word. Writers swap in a new object and
+  // retire the old one, which is deleted once every reader that may still
+  // see it has left.
+  template <class T>
+  class HALRcuPtr {
+    public:
+      // Holds a critical section from read() until reset() or destruction,
+      // reclamation of every retired object is held back meanwhile.
+      class ReadGuard {
+        friend class HALRcuPtr;
+        public:
+          ReadGuard() : host_(NULL), ptr_(NULL), handle_(0) {}
+          ~ReadGuard() { reset(); }
+        public:
+          const T *get() const { return ptr_; }
+          const T *operator ->() const { return ptr_; }
+          const T &operator *() const { return *ptr_; }
+          void reset();
+        private:
+          ReadGuard(const ReadGuard &);
+          ReadGuard &operator =(const ReadGuard &);
+        private:
+          HALRcuPtr *host_;
+          const T *ptr_;
+          uint64_t handle_;
+      };
+    public:
+      // Takes ptr, which must come from new, NULL publishes nothing.
+      // asymmetric_fence moves the fence of readers to the rare min version
+      // refresh of writers, see HALHazardVersionT::enable_asymmetric_fence().
+      explicit HALRcuPtr(T *ptr = NULL, const bool asymmetric_fence = true);
+      ~HALRcuPtr();
+    public:
+      // guard.get() is NULL if nothing is published
+      int read(ReadGuard &guard);
+      // Publish ptr (from new, or NULL) and retire the replaced object.
+      // Concurrent updates are fine, each one retires what it replaced.
+      // Updates are the rare path, every one reclaims what no reader holds
+      // any more instead of waiting for the waiting count threshold.
+      int update(T *ptr);
+    private:
+      HALRcuPtr(const HALRcuPtr &);
+      HALRcuPtr &operator =(const HALRcuPtr &);
+    private:
+      HALHazardVersion hazard_version_;
+      T *ptr_ CACHE_ALIGNED;
+  };
+
+  template <class T>
+  void HALRcuPtr<T>::ReadGuard::reset() {
+    if (NULL != host_) {
+      host_->hazard_version_.release(handle_);
+      host_ = NULL;
+    }
+    ptr_ = NULL;
+    handle_ = 0;
+  }
+
+  template <class T>
+  HALRcuPtr<T>::HALRcuPtr(T *ptr, const bool asymmetric_fence)
+    : hazard_version_(),
+      ptr_(ptr) {
+    if (asymmetric_fence) {
+      // keeps the fenced mode on failure
+      hazard_version_.enable_asymmetric_fence();
+    }
+  }
+
+  template <class T>
+  HALRcuPtr<T>::~HALRcuPtr() {
+    hazard_version_.retire();
+    delete ptr_;
+    ptr_ = NULL;
+  }
+
+  template <class T>
+  int HALRcuPtr<T>::read(ReadGuard &guard) {
+    int ret = HAL_SUCCESS;
+    guard.reset();
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(guard.handle_))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      guard.host_ = this;
+      guard.ptr_ = ATOMIC_LOAD(&ptr_);
+    }
+    return ret;
+  }
+
+  template <class T>
+  int HALRcuPtr<T>::update(T *ptr) {
+    int ret = HAL_SUCCESS;
+    // xchg is a full barrier on x86, the new object is built before it is seen
+    T *old = __sync_lock_test_and_set(&ptr_, ptr);
+    if (NULL != old
+        && HAL_SUCCESS != (ret = hazard_version_.add_object(old))) {
+      LOG_WARN(CLIB, "add_object fail, object leaked, ret=%d", ret);
+    }
+    hazard_version_.retire();
+    return ret;
+  }
+
+}
+}
+
+#endif // __HAL_CLIB_RCU_PTR_H__
@@ -0,0 +1,162 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <assert.h>
+#include "hal_error.h"
+#include "hal_malloc.h"
+#include "hal_mod_define.h"
+#include "hal_base_log.h"
+#include "hal_retire_pool.h"
+
+namespace libhalog {
+namespace clib {
+
+  HALRetireBatch *HALRetireBatch::alloc() {
+    HALRetireBatch *ret = (HALRetireBatch*)hal_malloc(sizeof(HALRetireBatch), HALModIds::RETIRE_POOL);
+    if (NULL != ret) {
+      ret->count_ = 0;
+      ret->bytes_ = 0;
+      ret->done_func_ = NULL;
+      ret->done_arg_ = NULL;
+    }
+    return ret;
+  }
+
+  void HALRetireBatch::free(HALRetireBatch *batch) {
+    hal_free(batch);
+  }
+
+  void HALRetireBatch::run() {
+    for (int64_t i = 0; i < count_; i++) {
+      items_[i].retire_func_(items_[i].ptr_, items_[i].arg_);
+    }
+    if (NULL != done_func_) {
+      done_func_(count_, bytes_, done_arg_);
+    }
+    count_ = 0;
+    bytes_ = 0;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  HALRetirePool::HALRetirePool(const int64_t queue_length)
+    : running_(false),
+      stop_(false),
+      pds_(NULL),
+      thread_count_(0),
+      queue_(NULL),
+      queue_length_(0),
+      queue_head_(0),
+      queued_count_(0) {
+    assert(0 < queue_length);
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&cond_, NULL);
+    queue_ = (HALRetireBatch**)hal_malloc(sizeof(HALRetireBatch*) * queue_length, HALModIds::RETIRE_POOL);
+    assert(NULL != queue_);
+    queue_length_ = queue_length;
+  }
+
+  HALRetirePool::~HALRetirePool() {
+    stop();
+    hal_free(queue_);
+    queue_ = NULL;
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  int HALRetirePool::start(const int64_t thread_count) {
+    int ret = HAL_SUCCESS;
+    if (0 >= thread_count) {
+      LOG_WARN(CLIB, "invalid param, thread_count=%ld", thread_count);
+      ret = HAL_INVALID_PARAM;
+    } else if (running_) {
+      LOG_WARN(CLIB, "retire pool has already been started");
+      ret = HAL_INIT_REPETITIVE;
+    } else if (NULL == (pds_ = (pthread_t*)hal_malloc(sizeof(pthread_t) * thread_count, HALModIds::RETIRE_POOL))) {
+      LOG_WARN(CLIB, "hal_malloc pthread_t array fail, thread_count=%ld", thread_count);
+      ret = HAL_ALLOCATE_FAIL;
+    } else {
+      stop_ = false;
+      running_ = true;
+      for (thread_count_ = 0; thread_count_ < thread_count; thread_count_++) {
+        int tmp_ret = pthread_create(&pds_[thread_count_], NULL, worker_routine_, this);
+        if (0 != tmp_ret) {
+          LOG_WARN(CLIB, "pthread_create fail, errno=%d", tmp_ret);
+          ret = HAL_ERROR;
+          break;
+        }
+      }
+      if (HAL_SUCCESS != ret) {
+        stop();
+      }
+    }
+    return ret;
+  }
+
+  void HALRetirePool::stop() {
+    if (running_) {
+      pthread_mutex_lock(&mutex_);
+      stop_ = true;
+      pthread_cond_broadcast(&cond_);
+      pthread_mutex_unlock(&mutex_);
+      for (int64_t i = 0; i < thread_count_; i++) {
+        pthread_join(pds_[i], NULL);
+      }
+      hal_free(pds_);
+      pds_ = NULL;
+      thread_count_ = 0;
+      running_ = false;
+    }
+  }
+
+  int HALRetirePool::execute(HALRetireBatch *batch) {
+    int ret = HAL_SUCCESS;
+    if (NULL == batch) {
+      ret = HAL_INVALID_PARAM;
+    } else {
+      pthread_mutex_lock(&mutex_);
+      if (!running_ || stop_) {
+        ret = HAL_ERROR;
+      } else if (queue_length_ <= queued_count_) {
+        ret = HAL_QUEUE_FULL;
+      } else {
+        queue_[(queue_head_ + queued_count_) % queue_length_] = batch;
+        queued_count_++;
+        pthread_cond_signal(&cond_);
+      }
+      pthread_mutex_unlock(&mutex_);
+    }
+    return ret;
+  }
+
+  int64_t HALRetirePool::get_queued_count() const {
+    return ATOMIC_LOAD(&queued_count_);
+  }
+
+  void *HALRetirePool::worker_routine_(void *data) {
+    HALRetirePool *host = (HALRetirePool*)data;
+    while (true) {
+      HALRetireBatch *batch = NULL;
+      pthread_mutex_lock(&host->mutex_);
+      while (0 == host->queued_count_
+            && !host->stop_) {
+        pthread_cond_wait(&host->cond_, &host->mutex_);
+      }
+      if (0 < host->queued_count_) {
+        batch = host->queue_[host->queue_head_];
+        host->queue_head_ = (host->queue_head_ + 1) % host->queue_length_;
+        host->queued_count_--;
+      }
+      pthread_mutex_unlock(&host->mutex_);
+      if (NULL == batch) {
+        // stopped and drained
+        break;
+      }
+      batch->run();
+      HALRetireBatch::free(batch);
+    }
+    return NULL;
+  }
+
+}
+}
@@ -0,0 +1,80 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_RETIRE_POOL_H__
+#define __HAL_CLIB_RETIRE_POOL_H__
+#include <stdint.h>
+#include <pthread.h>
+#include "clib/hal_define.h"
+
+namespace libhalog {
+namespace clib {
+
+  // Called once no reader may hold ptr, arg is the one given to add_node
+  typedef void (*HALRetireFunc)(void *ptr, void *arg);
+  // Called once a batch has run, with the count and bytes of its items
+  typedef void (*HALRetireDoneFunc)(const int64_t count, const int64_t bytes, void *arg);
+
+  // Reclaimable objects handed to an executor in one piece
+  struct HALRetireBatch {
+    static const int64_t MAX_COUNT = 256;
+    struct Item {
+      void *ptr_;
+      HALRetireFunc retire_func_;
+      void *arg_;
+    };
+    int64_t count_;
+    int64_t bytes_;
+    // Lets the owner of the items account for them only after they are
+    // retired, may be NULL
+    HALRetireDoneFunc done_func_;
+    void *done_arg_;
+    Item items_[MAX_COUNT];
+
+    static HALRetireBatch *alloc();
+    static void free(HALRetireBatch *batch);
+    void run();
+  };
+
+  class IHALRetireExecutor {
+    public:
+      virtual ~IHALRetireExecutor() {}
+    public:
+      // On success the executor owns batch, runs it later and releases it by
+      // HALRetireBatch::free. On failure the caller runs the batch inline.
+      virtual int execute(HALRetireBatch *batch) = 0;
+  };
+
+  // Worker threads running retire batches off the critical path of the
+  // threads doing reclamation, with at most queue_length batches queued.
+  class HALRetirePool : public IHALRetireExecutor {
+    public:
+      HALRetirePool(const int64_t queue_length);
+      ~HALRetirePool();
+    public:
+      int start(const int64_t thread_count);
+      // Batches queued are run before the workers exit
+      void stop();
+      // HAL_QUEUE_FULL if queue_length batches are waiting
+      int execute(HALRetireBatch *batch);
+      int64_t get_queued_count() const;
+    private:
+      static void *worker_routine_(void *data);
+    private:
+      pthread_mutex_t mutex_;
+      pthread_cond_t cond_;
+      bool running_;
+      bool stop_;
+      pthread_t *pds_;
+      int64_t thread_count_;
+
+      HALRetireBatch **queue_;
+      int64_t queue_length_;
+      int64_t queue_head_;
+      int64_t queued_count_;
+  };
+
+}
+}
+
+#endif // __HAL_CLIB_RETIRE_POOL_H__
@@ -0,0 +1,281 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_RING_QUEUE_H__
+#define __HAL_CLIB_RING_QUEUE_H__
+#include <stdint.h>
+#include <assert.h>
+#include <sched.h>
+
+#include <new>
+#include <algorithm>
+#include <type_traits>
+
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+
+namespace libhalog {
+namespace clib {
+  // Bounded MPMC queue with the interface of HALFixedQueue. Producers and
+  // consumers take tickets by fetch_add instead of retrying a CAS (but for
+  // push_n), and a ticket maps to its slot by masking. Every slot carries the turn of the
+  // ticket it waits for:
+  //   ticket << 2      empty, the producer of ticket may write
+  //   ticket << 2 | 1  being written
+  //   ticket << 2 | 2  full, the consumer of ticket may read
+  // A consumer may take a ticket no producer has taken yet, it then skips
+  // the slot to the next round and reports empty, and the producer coming
+  // later for that ticket takes another one. Producers racing past the full
+  // check take tickets beyond the free slots, such a ticket is given back
+  // once no later one is taken instead of waiting for a consumer to come.
+  // A producer may still wait for a consumer of the previous round which
+  // has taken its ticket, waiters yield after a while since the thread
+  // holding the slot may be preempted.
+  template <class T>
+  class HALRingQueue {
+    struct Node {
+      uint64_t turn_;
+      typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type data_;
+      T *get_data() { return reinterpret_cast<T*>(&data_); }
+    } CACHE_ALIGNED;
+    public:
+      // length is rounded up to a power of 2
+      HALRingQueue(const int64_t length);
+      ~HALRingQueue();
+    public:
+      // HAL_QUEUE_FULL if every slot is taken, never waits for a consumer
+      int push(const T &data);
+      int pop(T &data);
+      // Take up to count tickets at once, in order. push_n claims only free
+      // slots with a CAS, pop_n takes its tickets with one fetch_add.
+      // push_count/pop_count is how many are done, HAL_QUEUE_FULL/EMPTY if 0.
+      int push_n(const T *datas, const int64_t count, int64_t &push_count);
+      int pop_n(T *datas, const int64_t count, int64_t &pop_count);
+      int64_t size() const;
+    private:
+      Node &get_node_(const uint64_t ticket) { return nodes_[ticket & mask_]; }
+      // HAL_ENTRY_NOT_EXIST if the ticket has been skipped by a consumer,
+      // HAL_QUEUE_FULL if it is given back
+      int produce_(const uint64_t ticket, const T &data);
+      // HAL_QUEUE_EMPTY if no producer has taken the ticket
+      int consume_(const uint64_t ticket, T &data);
+      static uint64_t empty_turn_(const uint64_t ticket) { return ticket << 2; }
+      static uint64_t writing_turn_(const uint64_t ticket) { return (ticket << 2) | 1; }
+      static uint64_t full_turn_(const uint64_t ticket) { return (ticket << 2) | 2; }
+      static void wait_(int64_t &spin_count);
+    private:
+      HALRingQueue(const HALRingQueue &);
+      HALRingQueue &operator =(const HALRingQueue &);
+    private:
+      static const int64_t SPIN_LIMIT = 1024;
+    private:
+      int64_t length_;
+      uint64_t mask_;
+      void *buffer_;
+      Node *nodes_;
+      uint64_t producer_ CACHE_ALIGNED;
+      uint64_t consumer_ CACHE_ALIGNED;
+  };
+
+  template <class T>
+  HALRingQueue<T>::HALRingQueue(const int64_t length)
+    : length_(1),
+      mask_(0),
+      buffer_(NULL),
+      nodes_(NULL),
+      producer_(0),
+      consumer_(0) {
+    assert(0 < length);
+    while (length_ < length) {
+      length_ <<= 1;
+    }
+    mask_ = (uint64_t)length_ - 1;
+    // hal_malloc does not align to cache lines
+    buffer_ = hal_malloc(sizeof(Node) * length_ + CACHE_ALIGN_SIZE, HALModIds::FIXED_QUEUE);
+    assert(NULL != buffer_);
+    nodes_ = (Node*)(((uint64_t)buffer_ + CACHE_ALIGN_SIZE - 1) & ~((uint64_t)CACHE_ALIGN_SIZE - 1));
+    for (int64_t i = 0; i < length_; i++) {
+      nodes_[i].turn_ = empty_turn_(i);
+    }
+  }
+
+  template <class T>
+  HALRingQueue<T>::~HALRingQueue() {
+    for (uint64_t ticket = consumer_; ticket < producer_; ticket++) {
+      Node &node = get_node_(ticket);
+      if (full_turn_(ticket) == node.turn_) {
+        node.get_data()->~T();
+      }
+    }
+    hal_free(buffer_);
+    buffer_ = NULL;
+    nodes_ = NULL;
+  }
+
+  template <class T>
+  int HALRingQueue<T>::push(const T &data) {
+    int ret = HAL_SUCCESS;
+    if (length_ <= (int64_t)(ATOMIC_LOAD(&producer_) - ATOMIC_LOAD(&consumer_))) {
+      ret = HAL_QUEUE_FULL;
+    } else {
+      while (HAL_ENTRY_NOT_EXIST == (ret = produce_(__sync_fetch_and_add(&producer_, 1), data))) {
+      }
+    }
+    return ret;
+  }
+
+  template <class T>
+  int HALRingQueue<T>::pop(T &data) {
+    int ret = HAL_SUCCESS;
+    // consumer_ first, so a stale producer_ only makes it look emptier
+    uint64_t consumer = ATOMIC_LOAD(&consumer_);
+    if (ATOMIC_LOAD(&producer_) <= consumer) {
+      ret = HAL_QUEUE_EMPTY;
+    } else {
+      ret = consume_(__sync_fetch_and_add(&consumer_, 1), data);
+    }
+    return ret;
+  }
+
+  template <class T>
+  int HALRingQueue<T>::push_n(const T *datas, const int64_t count, int64_t &push_count) {
+    int ret = HAL_SUCCESS;
+    push_count = 0;
+    if (NULL == datas
+        || 0 >= count) {
+      ret = HAL_INVALID_PARAM;
+    } else {
+      // Skipped tickets are given up, the rest of datas keeps its order on
+      // the following tickets. Tickets are claimed below consumer_ + length_
+      // only, so that none of them has to wait for a consumer to come.
+      while (push_count < count) {
+        const uint64_t ticket = ATOMIC_LOAD(&producer_);
+        const int64_t take = std::min(count - push_count, length_ - (int64_t)(ticket - ATOMIC_LOAD(&consumer_)));
+        if (0 >= take) {
+          break;
+        } else if (__sync_bool_compare_and_swap(&producer_, ticket, ticket + (uint64_t)take)) {
+          for (int64_t i = 0; i < take; i++) {
+            if (HAL_SUCCESS == produce_(ticket + i, datas[push_count])) {
+              push_count++;
+            }
+          }
+        }
+      }
+      if (0 == push_count) {
+        ret = HAL_QUEUE_FULL;
+      }
+    }
+    return ret;
+  }
+
+  template <class T>
+  int HALRingQueue<T>::pop_n(T *datas, const int64_t count, int64_t &pop_count) {
+    int ret = HAL_SUCCESS;
+    pop_count = 0;
+    if (NULL == datas
+        || 0 >= count) {
+      ret = HAL_INVALID_PARAM;
+    } else {
+      uint64_t consumer = ATOMIC_LOAD(&consumer_);
+      int64_t n = std::min(count, (int64_t)(ATOMIC_LOAD(&producer_) - consumer));
+      if (0 < n) {
+        const uint64_t ticket = __sync_fetch_and_add(&consumer_, (uint64_t)n);
+        for (int64_t i = 0; i < n; i++) {
+          if (HAL_SUCCESS == consume_(ticket + i, datas[pop_count])) {
+            pop_count++;
+          }
+        }
+      }
+      if (0 == pop_count) {
+        ret = HAL_QUEUE_EMPTY;
+      }
+    }
+    return ret;
+  }
+
+  template <class T>
+  int64_t HALRingQueue<T>::size() const {
+    // consumers running ahead of producers make it negative for a while
+    return std::max((int64_t)0, (int64_t)(ATOMIC_LOAD(&producer_) - ATOMIC_LOAD(&consumer_)));
+  }
+
+  template <class T>
+  int HALRingQueue<T>::produce_(const uint64_t ticket, const T &data) {
+    int ret = HAL_SUCCESS;
+    Node &node = get_node_(ticket);
+    int64_t spin_count = 0;
+    while (true) {
+      uint64_t turn = ATOMIC_LOAD_ACQUIRE(&node.turn_);
+      if (empty_turn_(ticket) == turn) {
+        // races with a consumer skipping the ticket
+        if (__sync_bool_compare_and_swap(&node.turn_, turn, writing_turn_(ticket))) {
+          new(node.get_data()) T(data);
+          ATOMIC_STORE_RELEASE(&node.turn_, full_turn_(ticket));
+          break;
+        }
+      } else if (empty_turn_(ticket) < turn) {
+        // skipped
+        ret = HAL_ENTRY_NOT_EXIST;
+        break;
+      } else if (length_ <= (int64_t)(ticket - ATOMIC_LOAD(&consumer_))) {
+        // No consumer has taken the previous round of the slot. Every later
+        // ticket is in the same case, so the last one given back lets the
+        // one before it go as well.
+        if (__sync_bool_compare_and_swap(&producer_, ticket + 1, ticket)) {
+          ret = HAL_QUEUE_FULL;
+          break;
+        }
+        wait_(spin_count);
+      } else {
+        // the consumer of the previous round has not finished
+        wait_(spin_count);
+      }
+    }
+    return ret;
+  }
+
+  template <class T>
+  int HALRingQueue<T>::consume_(const uint64_t ticket, T &data) {
+    int ret = HAL_SUCCESS;
+    Node &node = get_node_(ticket);
+    int64_t spin_count = 0;
+    while (true) {
+      uint64_t turn = ATOMIC_LOAD_ACQUIRE(&node.turn_);
+      if (full_turn_(ticket) == turn) {
+        T *ptr = node.get_data();
+        data = *ptr;
+        ptr->~T();
+        ATOMIC_STORE_RELEASE(&node.turn_, empty_turn_(ticket + length_));
+        break;
+      } else if (empty_turn_(ticket) == turn
+                && ATOMIC_LOAD(&producer_) <= ticket) {
+        // No producer holds the ticket, skip the slot to the next round
+        if (__sync_bool_compare_and_swap(&node.turn_, turn, empty_turn_(ticket + length_))) {
+          ret = HAL_QUEUE_EMPTY;
+          break;
+        }
+      } else {
+        // being written, about to be written, or the previous round is not
+        // done yet
+        wait_(spin_count);
+      }
+    }
+    return ret;
+  }
+
+  template <class T>
+  void HALRingQueue<T>::wait_(int64_t &spin_count) {
+    if (SPIN_LIMIT > ++spin_count) {
+      PAUSE();
+    } else {
+      spin_count = 0;
+      sched_yield();
+    }
+  }
+
+}
+}
+
+#endif // __HAL_CLIB_RING_QUEUE_H__
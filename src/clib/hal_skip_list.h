@@ -0,0 +1,423 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_SKIP_LIST_H__
+#define __HAL_CLIB_SKIP_LIST_H__
+#include <stdint.h>
+#include <assert.h>
+
+#include <new>
+#include <functional>
+
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_base_log.h"
+#include "clib/hal_util.h"
+#include "clib/hal_i_allocator.h"
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+  // Lock-free ordered map (Harris/Fraser skiplist). A node is erased by
+  // setting the low bit of its next pointers from the top level down, the
+  // mark of level 0 decides which erase wins. Writers unlink marked nodes
+  // they meet and the one unlinking the last level retires the node through
+  // HALHazardVersion. Readers only skip marked nodes, they never write.
+  //
+  // Nodes come from allocator, which must be thread safe and support free,
+  // so HALPageArena (neither) does not fit, a pool or HALDefaultAllocator does.
+  template <class K, class V, class Compare = std::less<K> >
+  class HALSkipList {
+    struct Node {
+      Node(const K &key, const V &value, const int32_t top_level)
+        : key_(key), value_(value), top_level_(top_level), unlinked_count_(0), fully_linked_(false) {}
+      // top_level_ next pointers follow the node in the same allocation
+      Node **next() { return (Node**)(this + 1); }
+      K key_;
+      V value_;
+      int32_t top_level_;
+      int32_t unlinked_count_;
+      bool fully_linked_;
+    };
+    public:
+      static const int64_t MAX_LEVEL = 24;
+    public:
+      // Holds a critical section from lower_bound()/begin() until reset() or
+      // destruction, so keep scans short or reclamation is held back.
+      class Iterator {
+        friend class HALSkipList;
+        public:
+          Iterator() : host_(NULL), node_(NULL), handle_(0) {}
+          ~Iterator() { reset(); }
+        public:
+          bool is_valid() const { return NULL != node_; }
+          const K &get_key() const { return node_->key_; }
+          const V &get_value() const { return node_->value_; }
+          void next() { node_ = HALSkipList::next_alive_(node_); }
+          void reset();
+        private:
+          Iterator(const Iterator &);
+          Iterator &operator =(const Iterator &);
+        private:
+          HALSkipList *host_;
+          Node *node_;
+          uint64_t handle_;
+      };
+    public:
+      HALSkipList(const Compare &compare = Compare());
+      HALSkipList(IHALAllocator &allocator, const Compare &compare = Compare());
+      ~HALSkipList();
+    public:
+      // HAL_ENTRY_EXIST if key is already in the list
+      int insert(const K &key, const V &value);
+      int get(const K &key, V &value);
+      int erase(const K &key);
+      // Position iter at the first key not less than key
+      int lower_bound(const K &key, Iterator &iter);
+      int begin(Iterator &iter);
+      int64_t size() const;
+    private:
+      void init_();
+      int32_t random_level_() const;
+      Node *alloc_node_(const K &key, const V &value, const int32_t top_level);
+      bool find_(const K &key, Node **preds, Node **succs);
+      Node *seek_(const K &key) const;
+      void on_unlinked_(Node *node);
+      int acquire_iter_(Iterator &iter);
+      static Node *next_alive_(Node *node);
+      static void free_node_(void *ptr, void *arg);
+      static bool is_marked_(Node *ptr) { return 0 != ((uint64_t)ptr & 1UL); }
+      static Node *mark_(Node *ptr) { return (Node*)((uint64_t)ptr | 1UL); }
+      static Node *unmark_(Node *ptr) { return (Node*)((uint64_t)ptr & ~1UL); }
+    private:
+      HALSkipList(const HALSkipList &);
+      HALSkipList &operator =(const HALSkipList &);
+    private:
+      Compare compare_;
+      HALDefaultAllocator default_allocator_;
+      IHALAllocator &allocator_;
+      HALHazardVersion hazard_version_;
+      Node *head_;
+      int64_t count_ CACHE_ALIGNED;
+  };
+
+  template <class K, class V, class Compare>
+  const int64_t HALSkipList<K, V, Compare>::MAX_LEVEL;
+
+  template <class K, class V, class Compare>
+  void HALSkipList<K, V, Compare>::Iterator::reset() {
+    if (NULL != host_) {
+      host_->hazard_version_.release(handle_);
+      host_ = NULL;
+    }
+    node_ = NULL;
+    handle_ = 0;
+  }
+
+  template <class K, class V, class Compare>
+  HALSkipList<K, V, Compare>::HALSkipList(const Compare &compare)
+    : compare_(compare),
+      default_allocator_(),
+      allocator_(default_allocator_),
+      hazard_version_(),
+      head_(NULL),
+      count_(0) {
+    init_();
+  }
+
+  template <class K, class V, class Compare>
+  HALSkipList<K, V, Compare>::HALSkipList(IHALAllocator &allocator, const Compare &compare)
+    : compare_(compare),
+      default_allocator_(),
+      allocator_(allocator),
+      hazard_version_(),
+      head_(NULL),
+      count_(0) {
+    init_();
+  }
+
+  template <class K, class V, class Compare>
+  void HALSkipList<K, V, Compare>::init_() {
+    // key_ and value_ of head are never constructed nor touched
+    head_ = (Node*)hal_malloc(sizeof(Node) + sizeof(Node*) * MAX_LEVEL, HALModIds::SKIP_LIST);
+    assert(NULL != head_);
+    head_->top_level_ = (int32_t)MAX_LEVEL;
+    head_->fully_linked_ = true;
+    for (int64_t i = 0; i < MAX_LEVEL; i++) {
+      head_->next()[i] = NULL;
+    }
+  }
+
+  template <class K, class V, class Compare>
+  HALSkipList<K, V, Compare>::~HALSkipList() {
+    hazard_version_.retire();
+    Node *node = unmark_(head_->next()[0]);
+    while (NULL != node) {
+      Node *next = unmark_(node->next()[0]);
+      free_node_(node, this);
+      node = next;
+    }
+    hal_free(head_);
+    head_ = NULL;
+  }
+
+  template <class K, class V, class Compare>
+  int HALSkipList<K, V, Compare>::insert(const K &key, const V &value) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    Node *preds[MAX_LEVEL];
+    Node *succs[MAX_LEVEL];
+    const int32_t top_level = random_level_();
+    Node *node = NULL;
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      while (true) {
+        if (find_(key, preds, succs)) {
+          ret = HAL_ENTRY_EXIST;
+          break;
+        }
+        if (NULL == node
+            && NULL == (node = alloc_node_(key, value, top_level))) {
+          ret = HAL_ALLOCATE_FAIL;
+          break;
+        }
+        node->next()[0] = succs[0];
+        if (__sync_bool_compare_and_swap(&preds[0]->next()[0], succs[0], node)) {
+          break;
+        }
+      }
+      if (HAL_SUCCESS == ret) {
+        __sync_add_and_fetch(&count_, 1);
+        // No erase marks node before it is fully linked, so its next
+        // pointers may be refreshed with plain stores here, a find_ retry
+        // also moves succs of the levels above. Never link in front of a
+        // marked succ: an erased node of the same key would be hidden behind
+        // node from the find_ of its eraser and never unlinked.
+        for (int32_t l = 1; l < top_level; l++) {
+          while (true) {
+            ATOMIC_STORE(&node->next()[l], succs[l]);
+            if ((NULL == succs[l] || !is_marked_(ATOMIC_LOAD(&succs[l]->next()[l])))
+                && __sync_bool_compare_and_swap(&preds[l]->next()[l], succs[l], node)) {
+              break;
+            }
+            find_(key, preds, succs);
+          }
+        }
+        ATOMIC_STORE(&node->fully_linked_, true);
+      } else if (NULL != node) {
+        // never published
+        free_node_(node, this);
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class Compare>
+  int HALSkipList<K, V, Compare>::get(const K &key, V &value) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      Node *node = seek_(key);
+      if (NULL == node
+          || compare_(key, node->key_)) {
+        ret = HAL_ENTRY_NOT_EXIST;
+      } else {
+        value = node->value_;
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class Compare>
+  int HALSkipList<K, V, Compare>::erase(const K &key) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    Node *preds[MAX_LEVEL];
+    Node *succs[MAX_LEVEL];
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      if (!find_(key, preds, succs)) {
+        ret = HAL_ENTRY_NOT_EXIST;
+      } else {
+        Node *node = succs[0];
+        while (!ATOMIC_LOAD(&node->fully_linked_)) {
+          PAUSE();
+        }
+        for (int32_t l = node->top_level_ - 1; l > 0; l--) {
+          Node *succ = ATOMIC_LOAD(&node->next()[l]);
+          while (!is_marked_(succ)
+                && !__sync_bool_compare_and_swap(&node->next()[l], succ, mark_(succ))) {
+            succ = ATOMIC_LOAD(&node->next()[l]);
+          }
+        }
+        ret = HAL_ENTRY_NOT_EXIST;
+        Node *succ = ATOMIC_LOAD(&node->next()[0]);
+        while (!is_marked_(succ)) {
+          if (__sync_bool_compare_and_swap(&node->next()[0], succ, mark_(succ))) {
+            __sync_add_and_fetch(&count_, -1);
+            // unlink from every level
+            find_(key, preds, succs);
+            ret = HAL_SUCCESS;
+            break;
+          }
+          succ = ATOMIC_LOAD(&node->next()[0]);
+        }
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class Compare>
+  int HALSkipList<K, V, Compare>::lower_bound(const K &key, Iterator &iter) {
+    int ret = HAL_SUCCESS;
+    if (HAL_SUCCESS == (ret = acquire_iter_(iter))) {
+      iter.node_ = seek_(key);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class Compare>
+  int HALSkipList<K, V, Compare>::begin(Iterator &iter) {
+    int ret = HAL_SUCCESS;
+    if (HAL_SUCCESS == (ret = acquire_iter_(iter))) {
+      iter.node_ = next_alive_(head_);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class Compare>
+  int64_t HALSkipList<K, V, Compare>::size() const {
+    return ATOMIC_LOAD(&count_);
+  }
+
+  template <class K, class V, class Compare>
+  int32_t HALSkipList<K, V, Compare>::random_level_() const {
+    // P(level > n) = 1/2^n
+    int32_t level = 1;
+    uint64_t r = fast_rand();
+    while (level < MAX_LEVEL && 0 != (r & 1)) {
+      level++;
+      r >>= 1;
+    }
+    return level;
+  }
+
+  template <class K, class V, class Compare>
+  typename HALSkipList<K, V, Compare>::Node *HALSkipList<K, V, Compare>::alloc_node_(const K &key, const V &value, const int32_t top_level) {
+    Node *ret = NULL;
+    void *buffer = allocator_.alloc(sizeof(Node) + sizeof(Node*) * top_level, HALModIds::SKIP_LIST);
+    if (NULL == buffer) {
+      LOG_WARN(CLIB, "alloc node fail, top_level=%d", top_level);
+    } else {
+      ret = new(buffer) Node(key, value, top_level);
+    }
+    return ret;
+  }
+
+  template <class K, class V, class Compare>
+  bool HALSkipList<K, V, Compare>::find_(const K &key, Node **preds, Node **succs) {
+    bool retry = true;
+    while (retry) {
+      retry = false;
+      Node *pred = head_;
+      for (int64_t l = MAX_LEVEL - 1; l >= 0 && !retry; l--) {
+        Node *curr = unmark_(ATOMIC_LOAD(&pred->next()[l]));
+        while (NULL != curr) {
+          Node *succ = ATOMIC_LOAD(&curr->next()[l]);
+          if (is_marked_(succ)) {
+            // pred is marked or changed, start over
+            if (!__sync_bool_compare_and_swap(&pred->next()[l], curr, unmark_(succ))) {
+              retry = true;
+              break;
+            }
+            on_unlinked_(curr);
+            curr = unmark_(succ);
+          } else if (compare_(curr->key_, key)) {
+            pred = curr;
+            curr = succ;
+          } else {
+            break;
+          }
+        }
+        preds[l] = pred;
+        succs[l] = curr;
+      }
+    }
+    return NULL != succs[0] && !compare_(key, succs[0]->key_);
+  }
+
+  template <class K, class V, class Compare>
+  typename HALSkipList<K, V, Compare>::Node *HALSkipList<K, V, Compare>::seek_(const K &key) const {
+    Node *pred = head_;
+    Node *curr = NULL;
+    for (int64_t l = MAX_LEVEL - 1; l >= 0; l--) {
+      curr = unmark_(ATOMIC_LOAD(&pred->next()[l]));
+      while (NULL != curr) {
+        Node *succ = ATOMIC_LOAD(&curr->next()[l]);
+        if (is_marked_(succ)) {
+          curr = unmark_(succ);
+        } else if (compare_(curr->key_, key)) {
+          pred = curr;
+          curr = succ;
+        } else {
+          break;
+        }
+      }
+    }
+    // curr is the first alive node not less than key on level 0
+    return curr;
+  }
+
+  template <class K, class V, class Compare>
+  void HALSkipList<K, V, Compare>::on_unlinked_(Node *node) {
+    // Every level is unlinked by exactly one successful CAS
+    if (node->top_level_ == __sync_add_and_fetch(&node->unlinked_count_, 1)) {
+      int tmp_ret = hazard_version_.add_node(node, free_node_, this, 0);
+      if (HAL_SUCCESS != tmp_ret) {
+        LOG_WARN(CLIB, "add_node fail, node leaked, ret=%d", tmp_ret);
+      }
+    }
+  }
+
+  template <class K, class V, class Compare>
+  int HALSkipList<K, V, Compare>::acquire_iter_(Iterator &iter) {
+    int ret = HAL_SUCCESS;
+    iter.reset();
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(iter.handle_))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      iter.host_ = this;
+    }
+    return ret;
+  }
+
+  template <class K, class V, class Compare>
+  typename HALSkipList<K, V, Compare>::Node *HALSkipList<K, V, Compare>::next_alive_(Node *node) {
+    Node *ret = unmark_(ATOMIC_LOAD(&node->next()[0]));
+    while (NULL != ret
+          && is_marked_(ATOMIC_LOAD(&ret->next()[0]))) {
+      ret = unmark_(ATOMIC_LOAD(&ret->next()[0]));
+    }
+    return ret;
+  }
+
+  template <class K, class V, class Compare>
+  void HALSkipList<K, V, Compare>::free_node_(void *ptr, void *arg) {
+    Node *node = (Node*)ptr;
+    node->~Node();
+    ((HALSkipList*)arg)->allocator_.free(node);
+  }
+
+}
+}
+
+#endif // __HAL_CLIB_SKIP_LIST_H__
@@ -0,0 +1,209 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_STACK_H__
+#define __HAL_CLIB_STACK_H__
+#include <stdint.h>
+
+#include <new>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include "clib/hal_error.h"
+#include "clib/hal_atomic.h"
+#include "clib/hal_malloc.h"
+#include "clib/hal_mod_define.h"
+#include "clib/hal_base_log.h"
+#include "clib/hal_util.h"
+#include "clib/hal_hazard_version.h"
+
+namespace libhalog {
+namespace clib {
+  // Treiber stack with an optional elimination backoff array. A push or pop
+  // losing the CAS on top_ meets its opposite in a random slot of the array
+  // instead of retrying at once, so concurrent pairs cancel without touching
+  // top_. Elimination is off by default until contended numbers show it pays.
+  // Nodes are reclaimed through the HALHazardVersion of the stack.
+  template <class T>
+  class HALStack {
+    struct Node {
+      Node *next_;
+      typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type data_;
+      T *get_data() { return reinterpret_cast<T*>(&data_); }
+    };
+    struct Slot {
+      Node *node_;
+    } CACHE_ALIGNED;
+    public:
+      static const int64_t MAX_ELIMINATION_WIDTH = 32;
+    public:
+      // elimination_width slots, 0 disables elimination. elimination_spin is
+      // the PAUSE count a push waits in a slot for a pop to take its node.
+      HALStack(const int64_t elimination_width = 0, const int64_t elimination_spin = 128);
+      ~HALStack();
+    public:
+      int push(const T &data);
+      int push(T &&data);
+      int pop(T &data);
+    private:
+      template <class U>
+      int push_(U &&data);
+      bool eliminate_push_(Node *node);
+      Node *eliminate_pop_();
+      static void retire_node_(void *ptr, void *arg);
+    private:
+      HALStack(const HALStack &);
+      HALStack &operator =(const HALStack &);
+    private:
+      int64_t elimination_width_;
+      int64_t elimination_spin_;
+      HALHazardVersion hazard_version_;
+      Node *top_ CACHE_ALIGNED;
+      // A node offered in a slot cannot be reclaimed and offered again while
+      // its pusher is still inside the critical section, so no ABA here.
+      Slot slots_[MAX_ELIMINATION_WIDTH];
+  };
+
+  template <class T>
+  const int64_t HALStack<T>::MAX_ELIMINATION_WIDTH;
+
+  template <class T>
+  HALStack<T>::HALStack(const int64_t elimination_width, const int64_t elimination_spin)
+    : elimination_width_(std::max((int64_t)0, std::min(elimination_width, MAX_ELIMINATION_WIDTH))),
+      elimination_spin_(elimination_spin),
+      hazard_version_(),
+      top_(NULL) {
+    for (int64_t i = 0; i < MAX_ELIMINATION_WIDTH; i++) {
+      slots_[i].node_ = NULL;
+    }
+  }
+
+  template <class T>
+  HALStack<T>::~HALStack() {
+    hazard_version_.retire();
+    while (NULL != top_) {
+      Node *next = top_->next_;
+      top_->get_data()->~T();
+      hal_free(top_);
+      top_ = next;
+    }
+  }
+
+  template <class T>
+  int HALStack<T>::push(const T &data) {
+    return push_(data);
+  }
+
+  template <class T>
+  int HALStack<T>::push(T &&data) {
+    return push_(std::move(data));
+  }
+
+  template <class T>
+  template <class U>
+  int HALStack<T>::push_(U &&data) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    Node *node = NULL;
+    if (NULL == (node = (Node*)hal_malloc(sizeof(Node), HALModIds::STACK))) {
+      LOG_WARN(CLIB, "alloc node fail");
+      ret = HAL_ALLOCATE_FAIL;
+    } else if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+      hal_free(node);
+    } else {
+      new(node->get_data()) T(std::forward<U>(data));
+      while (true) {
+        Node *top = ATOMIC_LOAD(&top_);
+        node->next_ = top;
+        if (__sync_bool_compare_and_swap(&top_, top, node)
+            || eliminate_push_(node)) {
+          break;
+        }
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class T>
+  int HALStack<T>::pop(T &data) {
+    int ret = HAL_SUCCESS;
+    uint64_t handle = 0;
+    if (HAL_SUCCESS != (ret = hazard_version_.acquire(handle))) {
+      LOG_WARN(CLIB, "acquire fail, ret=%d", ret);
+    } else {
+      Node *node = NULL;
+      while (true) {
+        Node *top = ATOMIC_LOAD(&top_);
+        if (NULL == top) {
+          ret = HAL_QUEUE_EMPTY;
+          break;
+        } else if (__sync_bool_compare_and_swap(&top_, top, ATOMIC_LOAD(&top->next_))) {
+          node = top;
+          break;
+        } else if (NULL != (node = eliminate_pop_())) {
+          break;
+        }
+      }
+      if (NULL != node) {
+        T *ptr = node->get_data();
+        data = std::move(*ptr);
+        ptr->~T();
+        int tmp_ret = hazard_version_.add_node(node, retire_node_, NULL, sizeof(Node));
+        if (HAL_SUCCESS != tmp_ret) {
+          LOG_WARN(CLIB, "add_node fail, node leaked, ret=%d", tmp_ret);
+        }
+      }
+      hazard_version_.release(handle);
+    }
+    return ret;
+  }
+
+  template <class T>
+  bool HALStack<T>::eliminate_push_(Node *node) {
+    bool bret = false;
+    if (0 < elimination_width_) {
+      Slot &slot = slots_[fast_rand() % (uint64_t)elimination_width_];
+      if (NULL == ATOMIC_LOAD(&slot.node_)
+          && __sync_bool_compare_and_swap(&slot.node_, NULL, node)) {
+        for (int64_t i = 0; i < elimination_spin_ && !bret; i++) {
+          PAUSE();
+          bret = (node != ATOMIC_LOAD(&slot.node_));
+        }
+        // withdraw, failing means a pop has just taken it
+        bret = bret || !__sync_bool_compare_and_swap(&slot.node_, node, NULL);
+      }
+    }
+    return bret;
+  }
+
+  template <class T>
+  typename HALStack<T>::Node *HALStack<T>::eliminate_pop_() {
+    Node *ret = NULL;
+    if (0 < elimination_width_) {
+      Slot &slot = slots_[fast_rand() % (uint64_t)elimination_width_];
+      for (int64_t i = 0; i < elimination_spin_; i++) {
+        Node *node = ATOMIC_LOAD(&slot.node_);
+        if (NULL != node
+            && __sync_bool_compare_and_swap(&slot.node_, node, NULL)) {
+          ret = node;
+          break;
+        }
+        PAUSE();
+      }
+    }
+    return ret;
+  }
+
+  template <class T>
+  void HALStack<T>::retire_node_(void *ptr, void *arg) {
+    UNUSED(arg);
+    hal_free(ptr);
+  }
+
+}
+}
+
+#endif // __HAL_CLIB_STACK_H__
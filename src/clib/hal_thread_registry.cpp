@@ -0,0 +1,152 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <assert.h>
+#include <string.h>
+#include <sched.h>
+#include "hal_error.h"
+#include "hal_base_log.h"
+#include "hal_thread_registry.h"
+
+namespace libhalog {
+namespace clib {
+
+  __thread int64_t hal_tn_ = -1;
+
+  int64_t register_thread_number() {
+    return gsi<HALThreadRegistry>().register_thread();
+  }
+
+  HALThreadRegistry::HALThreadRegistry()
+    : tn_lock_(),
+      next_tn_(0),
+      free_count_(0),
+      thread_count_(0),
+      hook_lock_(),
+      hook_list_(NULL),
+      cursor_list_(NULL) {
+    memset(free_tn_bits_, 0, sizeof(free_tn_bits_));
+    int tmp_ret = pthread_key_create(&key_, on_thread_exit_);
+    assert(0 == tmp_ret);
+    UNUSED(tmp_ret);
+  }
+
+  HALThreadRegistry::~HALThreadRegistry() {
+    pthread_key_delete(key_);
+  }
+
+  int64_t HALThreadRegistry::register_thread() {
+    if (-1 == hal_tn_) {
+      tn_lock_.lock();
+      if (0 < free_count_) {
+        int64_t i = 0;
+        while (0 == free_tn_bits_[i]) {
+          i++;
+        }
+        const int64_t bit = __builtin_ctzll(free_tn_bits_[i]);
+        free_tn_bits_[i] &= ~(1UL << bit);
+        free_count_--;
+        hal_tn_ = i * 64 + bit;
+      } else {
+        hal_tn_ = next_tn_++;
+      }
+      thread_count_++;
+      tn_lock_.unlock();
+      // Value must be non-NULL for the destructor to be called
+      pthread_setspecific(key_, (void*)(hal_tn_ + 1));
+    }
+    return hal_tn_;
+  }
+
+  int HALThreadRegistry::add_exit_hook(HALThreadExitHook *hook) {
+    int ret = HAL_SUCCESS;
+    if (NULL == hook) {
+      ret = HAL_INVALID_PARAM;
+    } else {
+      hook_lock_.lock();
+      hook->__prev__ = NULL;
+      hook->__next__ = hook_list_;
+      if (NULL != hook_list_) {
+        hook_list_->__prev__ = hook;
+      }
+      hook_list_ = hook;
+      hook_lock_.unlock();
+    }
+    return ret;
+  }
+
+  int HALThreadRegistry::del_exit_hook(HALThreadExitHook *hook) {
+    int ret = HAL_SUCCESS;
+    if (NULL == hook) {
+      ret = HAL_INVALID_PARAM;
+    } else {
+      hook_lock_.lock();
+      if (NULL != hook->__prev__) {
+        hook->__prev__->__next__ = hook->__next__;
+      } else if (hook_list_ == hook) {
+        hook_list_ = hook->__next__;
+      }
+      if (NULL != hook->__next__) {
+        hook->__next__->__prev__ = hook->__prev__;
+      }
+      for (ExitCursor *iter = cursor_list_; NULL != iter; iter = iter->next_) {
+        if (hook == iter->hook_) {
+          iter->hook_ = hook->__next__;
+        }
+      }
+      hook->__prev__ = NULL;
+      hook->__next__ = NULL;
+      hook_lock_.unlock();
+      // Wait for the exiting threads already in on_thread_exit of hook
+      while (0 != ATOMIC_LOAD(&hook->__calling__)) {
+        sched_yield();
+      }
+    }
+    return ret;
+  }
+
+  int64_t HALThreadRegistry::get_thread_count() const {
+    return ATOMIC_LOAD(&thread_count_);
+  }
+
+  void HALThreadRegistry::on_thread_exit_(void *data) {
+    int64_t tn = (int64_t)data - 1;
+    gsi<HALThreadRegistry>().unregister_thread_(tn);
+  }
+
+  void HALThreadRegistry::unregister_thread_(const int64_t tn) {
+    // A hook may reclaim objects owning hooks of their own, which are added
+    // or deleted then, so no lock is held while it runs
+    ExitCursor cursor;
+    hook_lock_.lock();
+    cursor.hook_ = hook_list_;
+    cursor.next_ = cursor_list_;
+    cursor_list_ = &cursor;
+    while (NULL != cursor.hook_) {
+      HALThreadExitHook *hook = cursor.hook_;
+      cursor.hook_ = hook->__next__;
+      hook->__calling__++;
+      hook_lock_.unlock();
+      hook->on_thread_exit(tn);
+      hook_lock_.lock();
+      ATOMIC_STORE(&hook->__calling__, hook->__calling__ - 1);
+    }
+    ExitCursor **link = &cursor_list_;
+    while (&cursor != *link) {
+      link = &(*link)->next_;
+    }
+    *link = cursor.next_;
+    hook_lock_.unlock();
+
+    tn_lock_.lock();
+    if (HAL_MAX_THREAD_COUNT > tn) {
+      free_tn_bits_[tn / 64] |= 1UL << (tn % 64);
+      free_count_++;
+    }
+    thread_count_--;
+    tn_lock_.unlock();
+    hal_tn_ = -1;
+  }
+
+}
+}
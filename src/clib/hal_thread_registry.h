@@ -0,0 +1,75 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#ifndef __HAL_CLIB_THREAD_REGISTRY_H__
+#define __HAL_CLIB_THREAD_REGISTRY_H__
+#include <stdint.h>
+#include <pthread.h>
+#include "clib/hal_define.h"
+#include "clib/hal_util.h"
+#include "clib/hal_spin_lock.h"
+
+namespace libhalog {
+namespace clib {
+  class HALThreadRegistry;
+
+  class HALThreadExitHook {
+    friend class HALThreadRegistry;
+    public:
+      HALThreadExitHook() : __prev__(NULL), __next__(NULL), __calling__(0) {}
+      virtual ~HALThreadExitHook() {}
+    public:
+      // Called in the exiting thread, gettn() still returns tn and tn is
+      // recycled after all hooks return.
+      virtual void on_thread_exit(const int64_t tn) = 0;
+    private:
+      HALThreadExitHook *__prev__;
+      HALThreadExitHook *__next__;
+      // Exiting threads running on_thread_exit of this hook
+      int64_t __calling__;
+  };
+
+  // Hands out thread numbers for gettn() and recycles them on thread exit.
+  // The lowest free number is taken first, so that numbers stay dense and
+  // tables indexed by them do not grow with the churn of threads.
+  class HALThreadRegistry {
+    public:
+      HALThreadRegistry();
+      ~HALThreadRegistry();
+    public:
+      int64_t register_thread();
+      // Hooks are called without any lock of the registry held, they may add
+      // or delete other hooks. del_exit_hook waits for the calls of hook
+      // still running, so it must not be called from hook itself.
+      int add_exit_hook(HALThreadExitHook *hook);
+      int del_exit_hook(HALThreadExitHook *hook);
+      int64_t get_thread_count() const;
+    private:
+      // Next hook to call by an exiting thread, moved on by del_exit_hook
+      // when that hook is deleted
+      struct ExitCursor {
+        HALThreadExitHook *hook_;
+        ExitCursor *next_;
+      };
+    private:
+      static void on_thread_exit_(void *data);
+      void unregister_thread_(const int64_t tn);
+    private:
+      pthread_key_t key_;
+
+      HALSpinLock tn_lock_ CACHE_ALIGNED;
+      int64_t next_tn_;
+      // Bit tn % 64 of word tn / 64 is set if tn is free
+      uint64_t free_tn_bits_[HAL_MAX_THREAD_COUNT / 64];
+      int64_t free_count_;
+      int64_t thread_count_;
+
+      HALSpinLock hook_lock_ CACHE_ALIGNED;
+      HALThreadExitHook *hook_list_;
+      ExitCursor *cursor_list_;
+  };
+
+}
+}
+
+#endif // __HAL_CLIB_THREAD_REGISTRY_H__
@@ -1,6 +1,16 @@
 // Libhalog
 // Author: likai.root@gmail.com
 
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <sys/syscall.h>
+#ifdef __NR_membarrier
+#include <linux/membarrier.h>
+#endif
 #include "hal_base_log.h"
 #include "hal_util.h"
 
@@ -11,6 +21,119 @@ namespace clib {
     LOG_INFO(CLIB, "new gsi [%s] [%p]", name, ptr);
   }
 
+  static inline int64_t json_escape_char_(const char c, char *dst, const int64_t dst_size) {
+    int64_t ret = 0;
+    const char *short_escape = NULL;
+    switch (c) {
+      case '"': short_escape = "\\\""; break;
+      case '\\': short_escape = "\\\\"; break;
+      case '\b': short_escape = "\\b"; break;
+      case '\f': short_escape = "\\f"; break;
+      case '\n': short_escape = "\\n"; break;
+      case '\r': short_escape = "\\r"; break;
+      case '\t': short_escape = "\\t"; break;
+      default: break;
+    }
+    if (NULL != short_escape) {
+      if (2 <= dst_size) {
+        dst[0] = short_escape[0];
+        dst[1] = short_escape[1];
+        ret = 2;
+      }
+    } else if (6 < dst_size) {
+      snprintf(dst, 7, "\\u%04x", (unsigned char)c);
+      ret = 6;
+    }
+    return ret;
+  }
+
+  static inline bool json_need_escape_(const char c) {
+    return ('"' == c || '\\' == c || 0x20 > (unsigned char)c);
+  }
+
+  int64_t json_escape(const char *src, const int64_t src_length, char *dst, const int64_t dst_size) {
+    int64_t src_pos = 0;
+    int64_t dst_pos = 0;
+#ifdef __SSE2__
+    // Scan 16 bytes at a time, only fall into the per char path on the byte which needs escaping
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl_max = _mm_set1_epi8(0x1f);
+    while (src_pos + 16 <= src_length
+        && dst_pos + 16 <= dst_size) {
+      __m128i chunk = _mm_loadu_si128((const __m128i*)(src + src_pos));
+      __m128i hit = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+          _mm_cmpeq_epi8(_mm_min_epu8(chunk, ctrl_max), chunk));
+      int mask = _mm_movemask_epi8(hit);
+      if (0 == mask) {
+        _mm_storeu_si128((__m128i*)(dst + dst_pos), chunk);
+        src_pos += 16;
+        dst_pos += 16;
+      } else {
+        int64_t clean = __builtin_ctz(mask);
+        memcpy(dst + dst_pos, src + src_pos, clean);
+        src_pos += clean;
+        dst_pos += clean;
+        int64_t escaped = json_escape_char_(src[src_pos], dst + dst_pos, dst_size - dst_pos);
+        if (0 == escaped) {
+          return dst_pos;
+        }
+        src_pos++;
+        dst_pos += escaped;
+      }
+    }
+#endif
+    while (src_pos < src_length
+        && dst_pos < dst_size) {
+      const char c = src[src_pos];
+      if (!json_need_escape_(c)) {
+        dst[dst_pos++] = c;
+      } else {
+        int64_t escaped = json_escape_char_(c, dst + dst_pos, dst_size - dst_pos);
+        if (0 == escaped) {
+          break;
+        }
+        dst_pos += escaped;
+      }
+      src_pos++;
+    }
+    return dst_pos;
+  }
+
+
+  static bool heavy_fence_registered_ = false;
+
+  bool register_heavy_fence() {
+    bool bret = ATOMIC_LOAD(&heavy_fence_registered_);
+#ifdef __NR_membarrier
+    if (!bret) {
+      long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+      if (0 > cmds
+          || 0 == (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) {
+        LOG_WARN(CLIB, "membarrier private expedited not supported, cmds=%ld", cmds);
+      } else if (0 != syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0)) {
+        LOG_WARN(CLIB, "membarrier register fail, errno=%d", errno);
+      } else {
+        ATOMIC_STORE(&heavy_fence_registered_, true);
+        bret = true;
+      }
+    }
+#endif
+    return bret;
+  }
+
+  void heavy_fence() {
+    bool fenced = false;
+#ifdef __NR_membarrier
+    fenced = (ATOMIC_LOAD(&heavy_fence_registered_)
+              && 0 == syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0));
+#endif
+    if (!fenced) {
+      __sync_synchronize();
+    }
+  }
+
 }
 }
 
@@ -25,6 +25,17 @@ namespace clib {
 
   void log_kv(const char *name, void *ptr);
 
+  // Escape src as the content of a json string, return the length written to dst.
+  // Output is truncated on an escape sequence boundary if dst is not large enough.
+  int64_t json_escape(const char *src, const int64_t src_length, char *dst, const int64_t dst_size);
+
+  // Asymmetric fence based on membarrier(2). Once registered, heavy_fence()
+  // acts as a full fence executed by every running thread of the process, so
+  // the other side may use compiler barriers only. Without registration or
+  // kernel support heavy_fence() is a plain full fence of the caller.
+  bool register_heavy_fence();
+  void heavy_fence();
+
   static inline int64_t gettid() {
     static __thread int64_t tid = -1;
     if (UNLIKELY(tid == -1)) {
@@ -33,11 +44,27 @@ namespace clib {
     return tid;
   }
 
+  // xorshift64 with a per-thread seed, for spreading threads over slots, not
+  // for anything needing quality randomness
+  static inline uint64_t fast_rand() {
+    static __thread uint64_t seed = 0;
+    if (UNLIKELY(0 == seed)) {
+      seed = (uint64_t)gettid() * 0x9E3779B97F4A7C15UL | 1;
+    }
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+  }
+
+  // Thread number is recycled when the thread exits, see HALThreadRegistry
+  extern __thread int64_t hal_tn_;
+  extern int64_t register_thread_number();
+
   static inline int64_t gettn() {
-    static int64_t gn = 0;
-    static __thread int64_t tn = -1;
-    if (-1 == tn) {
-      tn = __sync_fetch_and_add(&gn, 1);
+    int64_t tn = hal_tn_;
+    if (UNLIKELY(-1 == tn)) {
+      tn = register_thread_number();
     }
     return tn;
   }
@@ -99,6 +126,20 @@ namespace clib {
     return tv_to_microseconds(tp);
   }
 
+  // Not moved by settimeofday or NTP, for deadlines and intervals
+  static inline int64_t get_monotonic_microseconds_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((int64_t) ts.tv_sec) * 1000000 + (int64_t) ts.tv_nsec / 1000);
+  }
+
+  // Cheap enough for hot paths, resolution is the kernel tick
+  static inline int64_t get_coarse_microseconds_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (((int64_t) ts.tv_sec) * 1000000 + (int64_t) ts.tv_nsec / 1000);
+  }
+
   static inline const struct tm *get_cur_tm() {
     static __thread struct tm cur_tms[HAL_MAX_THREAD_COUNT];
     static __thread int64_t pos = 0;
@@ -3,96 +3,18 @@
 
 #include <unistd.h>
 #include <semaphore.h>
-#include "clib/hal_hazard_version.h"
+#include <algorithm>
+#include "clib/hal_fixed_queue.h"
 #include "clib/hal_util.h"
+#include "clib/hal_base_log.h"
 #include <gtest/gtest.h>
 
 using namespace libhalog;
 using namespace libhalog::clib;
 
-template <typename T>
-class LockFreeQueue;
-
-template <typename T>
-class FIFONode : public HALHazardNodeI {
-  friend class LockFreeQueue<T>;
-  public:
-    FIFONode() : next_(NULL) {}
-    FIFONode(const T &v) : next_(NULL), v_(v) {}
-    ~FIFONode() {};
-  public:
-    void retire() {memset(&v_, 0, sizeof(v_));}//{ delete this; }
-  public:
-    void set_next(FIFONode *next) { next_ = next; }
-    FIFONode *get_next() const { return next_; }
-  public:
-    T get_v() { return v_; }
-  private:
-    FIFONode *next_;
-    T v_;
-};
-
-template <typename T>
-class LockFreeQueue {
-  typedef FIFONode<T> Node;
-  public:
-    LockFreeQueue() : hazard_version_(), head_(NULL) {
-      head_ = new Node();
-      tail_ = head_;
-    }
-    ~LockFreeQueue() {
-      while (NULL != head_) {
-        Node *tmp = head_;
-        head_ = head_->get_next();
-        tmp->retire();
-      }
-    }
-  public:
-    void push(const T &v, Node *node) {
-#ifdef DO_NOT_CHECK
-      UNUSED(v);
-#else
-      node = new(node) Node(v);
-#endif
-      uint64_t handle = 0;
-      hazard_version_.acquire(handle);
-      Node *curr = ATOMIC_LOAD(&tail_);
-      Node *old = curr;
-      while (old != (curr = __sync_val_compare_and_swap(&tail_, old, node))) {
-        old = curr;
-      }
-      curr->set_next(node);
-      hazard_version_.release(handle);
-    }
-    bool pop(T &v) {
-      bool bret = false;
-      uint64_t handle = 0;
-      hazard_version_.acquire(handle);
-      Node *curr = ATOMIC_LOAD(&head_);
-      Node *old = curr;
-      Node *node = curr->get_next();
-      while (NULL != node
-          && old != (curr = __sync_val_compare_and_swap(&head_, old, node))) {
-        old = curr;
-        node = curr->get_next();
-      }
-      if (NULL != node) {
-#ifdef DO_NOT_CHECK
-        UNUSED(v);
-#else
-        v = node->get_v();
-#endif
-        hazard_version_.add_node(curr);
-        bret = true;
-      }
-      hazard_version_.release(handle);
-      return bret;
-    }
-  private:
-    HALHazardVersion hazard_version_;
-    Node *head_ CACHE_ALIGNED;
-    Node *tail_ CACHE_ALIGNED;
-};
+// One producer and consumers blocking on an empty HALFixedQueue, woken by
+// pthread_cond (0), sem_t (1) or the eventcount of push_wait/pop_wait (2).
+// usage: hv_fifo_notify.bin [0|1|2] [consumer count]
 
 struct QueueValue {
   int64_t a;
@@ -102,13 +24,15 @@ struct QueueValue {
 };
 
 struct GConf {
-  LockFreeQueue<QueueValue> queue;
+  HALFixedQueue<QueueValue> queue;
   int64_t loop_times;
   int64_t producer_count;
+  int64_t consumer_count;
 
   pthread_mutex_t mutex;
   pthread_cond_t cond;
   sem_t sem;
+  GConf(const int64_t length) : queue(length) {}
 };
 
 void set_cpu_affinity() {
@@ -128,19 +52,20 @@ void *pthread_consumer(void *data) {
   GConf *g_conf = (GConf*)data;
   QueueValue stack_value;
   while (true) {
-    if (g_conf->queue.pop(stack_value)) {
+    if (HAL_SUCCESS == g_conf->queue.pop(stack_value)) {
 #ifndef DO_NOT_CHECK
       assert((stack_value.a + stack_value.b) == stack_value.sum);
 #endif
     } else {
       pthread_mutex_lock(&g_conf->mutex);
-      if (g_conf->queue.pop(stack_value)) {
+      if (HAL_SUCCESS == g_conf->queue.pop(stack_value)) {
         pthread_mutex_unlock(&g_conf->mutex);
 #ifndef DO_NOT_CHECK
         assert((stack_value.a + stack_value.b) == stack_value.sum);
 #endif
       } else {
         if (0 == ATOMIC_LOAD(&(g_conf->producer_count))) {
+          pthread_mutex_unlock(&g_conf->mutex);
           break;
         }
         pthread_cond_wait(&g_conf->cond, &g_conf->mutex);
@@ -155,29 +80,15 @@ void *sem_consumer(void *data) {
   set_cpu_affinity();
   GConf *g_conf = (GConf*)data;
   QueueValue stack_value;
-  bool skip = false;
-  bool need_wait = true;
   while (true) {
-    if (g_conf->queue.pop(stack_value)) {
+    // one post for every value pushed and one for every consumer at the end
+    sem_wait(&g_conf->sem);
+    if (HAL_SUCCESS == g_conf->queue.pop(stack_value)) {
 #ifndef DO_NOT_CHECK
       assert((stack_value.a + stack_value.b) == stack_value.sum);
 #endif
-      skip = false;
-      if (need_wait) {
-        sem_wait(&g_conf->sem);
-      } else {
-        need_wait = true;
-      }
-    } else {
-      if (0 == ATOMIC_LOAD(&(g_conf->producer_count))) {
-        if (skip) {
-          break;
-        } else {
-          skip = true;
-        }
-      }
-      sem_wait(&g_conf->sem);
-      need_wait = false;
+    } else if (0 == ATOMIC_LOAD(&(g_conf->producer_count))) {
+      break;
     }
   }
   return NULL;
@@ -186,7 +97,6 @@ void *sem_consumer(void *data) {
 void *pthread_producer(void *data) {
   set_cpu_affinity();
   GConf *g_conf = (GConf*)data;
-  FIFONode<QueueValue> *nodes = new FIFONode<QueueValue>[g_conf->loop_times];
 #ifndef DO_NOT_CHECK
   int64_t sum_base = gettn() * g_conf->loop_times;
 #endif
@@ -198,13 +108,14 @@ void *pthread_producer(void *data) {
     stack_value.sum = sum_base + 2*i;
 #endif
     pthread_mutex_lock(&g_conf->mutex);
-    g_conf->queue.push(stack_value, &nodes[i]);
+    g_conf->queue.push(stack_value);
     pthread_cond_signal(&g_conf->cond);
     pthread_mutex_unlock(&g_conf->mutex);
   }
   pthread_mutex_lock(&g_conf->mutex);
   __sync_add_and_fetch(&(g_conf->producer_count), -1);
-  pthread_cond_signal(&g_conf->cond);
+  // every consumer sleeping on the empty queue has to see the end
+  pthread_cond_broadcast(&g_conf->cond);
   pthread_mutex_unlock(&g_conf->mutex);
   return NULL;
 }
@@ -212,7 +123,6 @@ void *pthread_producer(void *data) {
 void *sem_producer(void *data) {
   set_cpu_affinity();
   GConf *g_conf = (GConf*)data;
-  FIFONode<QueueValue> *nodes = new FIFONode<QueueValue>[g_conf->loop_times];
 #ifndef DO_NOT_CHECK
   int64_t sum_base = gettn() * g_conf->loop_times;
 #endif
@@ -223,46 +133,82 @@ void *sem_producer(void *data) {
     stack_value.b = i;
     stack_value.sum = sum_base + 2*i;
 #endif
-    g_conf->queue.push(stack_value, &nodes[i]);
+    g_conf->queue.push(stack_value);
     sem_post(&g_conf->sem);
   }
   __sync_add_and_fetch(&(g_conf->producer_count), -1);
-  sem_post(&g_conf->sem);
+  for (int64_t i = 0; i < g_conf->consumer_count; i++) {
+    sem_post(&g_conf->sem);
+  }
   return NULL;
 }
 
-void run_test(GConf *g_conf, const int64_t thread_count, const bool use_sem) {
+void *wait_consumer(void *data) {
+  set_cpu_affinity();
+  GConf *g_conf = (GConf*)data;
+  QueueValue stack_value;
+  while (true) {
+    // wakes up now and then to see whether the producer is done
+    if (HAL_SUCCESS == g_conf->queue.pop_wait(stack_value, get_monotonic_microseconds_time() + 10000)) {
+#ifndef DO_NOT_CHECK
+      assert((stack_value.a + stack_value.b) == stack_value.sum);
+#endif
+    } else if (0 == ATOMIC_LOAD(&(g_conf->producer_count))
+              && HAL_SUCCESS != g_conf->queue.pop(stack_value)) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+void *wait_producer(void *data) {
+  set_cpu_affinity();
+  GConf *g_conf = (GConf*)data;
+#ifndef DO_NOT_CHECK
+  int64_t sum_base = gettn() * g_conf->loop_times;
+#endif
+  QueueValue stack_value;
+  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+#ifndef DO_NOT_CHECK
+    stack_value.a = sum_base + i;
+    stack_value.b = i;
+    stack_value.sum = sum_base + 2*i;
+#endif
+    g_conf->queue.push_wait(stack_value, INT64_MAX);
+  }
+  __sync_add_and_fetch(&(g_conf->producer_count), -1);
+  return NULL;
+}
+
+void run_test(GConf *g_conf, const int64_t thread_count, const int notify_mode) {
+  static const char *mode_names[] = {"cond", "sem", "eventcount"};
+  typedef void *(*ThreadFunc)(void *);
+  static const ThreadFunc producers[] = {pthread_producer, sem_producer, wait_producer};
+  static const ThreadFunc consumers[] = {pthread_consumer, sem_consumer, wait_consumer};
   pthread_t *pds_consumer = new pthread_t[thread_count];
   pthread_t pds_producer;
   g_conf->producer_count = 1;
+  g_conf->consumer_count = thread_count;
   int64_t timeu = get_cur_microseconds_time();
-  if (use_sem) {
-    pthread_create(&pds_producer, NULL, sem_producer, g_conf);
-  } else {
-    pthread_create(&pds_producer, NULL, pthread_producer, g_conf);
-  }
+  pthread_create(&pds_producer, NULL, producers[notify_mode], g_conf);
   for (int64_t i = 0; i < thread_count; i++) {
-    if (use_sem) {
-      pthread_create(&pds_consumer[i], NULL, sem_consumer, g_conf);
-    } else {
-      pthread_create(&pds_consumer[i], NULL, pthread_consumer, g_conf);
-    }
+    pthread_create(&pds_consumer[i], NULL, consumers[notify_mode], g_conf);
   }
   pthread_join(pds_producer, NULL);
   for (int64_t i = 0; i < thread_count; i++) {
     pthread_join(pds_consumer[i], NULL);
   }
   timeu = get_cur_microseconds_time() - timeu;
-  fprintf(stdout, "use_sem=%s threads=%ld+%ld push+pop=%ld timeu=%ld tps=%0.2f\n",
-      use_sem ? "true" : "false", thread_count, thread_count, thread_count * 2 * g_conf->loop_times, timeu, 1000000.0 * (double)(thread_count * 2 * g_conf->loop_times) / (double)(timeu));
+  fprintf(stdout, "notify=%s threads=%ld+%ld push+pop=%ld timeu=%ld tps=%0.2f\n",
+      mode_names[notify_mode], thread_count, thread_count, thread_count * 2 * g_conf->loop_times, timeu, 1000000.0 * (double)(thread_count * 2 * g_conf->loop_times) / (double)(timeu));
   delete[] pds_consumer;
 }
 
 int main(const int argc, char **argv) {
-  int use_sem = 0;
+  int notify_mode = 0;
   int64_t cpu_count = 0;
   if (1 < argc) {
-    use_sem = atoi(argv[1]);
+    notify_mode = std::min(2, std::max(0, atoi(argv[1])));
   }
   if (2 < argc) {
     cpu_count = atoi(argv[2]);
@@ -275,9 +221,10 @@ int main(const int argc, char **argv) {
 
   int64_t memory = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
   int64_t available = memory * 4 / 10;
-  int64_t count = available / sizeof(FIFONode<QueueValue>) / consumer_count;
+  int64_t count = available / (sizeof(QueueValue) + 8) / consumer_count;
 
-  GConf g_conf;
+  // never full, only the consumers wait
+  GConf g_conf(count);
   g_conf.loop_times = count;
   pthread_mutex_init(&g_conf.mutex, NULL);
   pthread_cond_init(&g_conf.cond, NULL);
@@ -288,5 +235,5 @@ int main(const int argc, char **argv) {
 #else
   fprintf(stdout, "Run and check pop result...\n");
 #endif
-  run_test(&g_conf, consumer_count, 0 != use_sem);
+  run_test(&g_conf, consumer_count, notify_mode);
 }
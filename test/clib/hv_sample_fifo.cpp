@@ -2,25 +2,32 @@
 // Author: likai.root@gmail.com
 
 #include <unistd.h>
+#include <string.h>
 #include "clib/hal_hazard_version.h"
+#include "clib/hal_epoch_reclaim.h"
+#include "clib/hal_linked_queue.h"
 #include "clib/hal_util.h"
 #include <gtest/gtest.h>
 
 using namespace libhalog;
 using namespace libhalog::clib;
 
-template <typename T>
+// Throughput of HALLinkedQueue, or of a swap tail queue over each reclaimer
+// usage: hv_sample_fifo.bin [thread count] [batch size|hv|lazy|ebr]
+
+template <typename T, typename Reclaimer>
 class LockFreeQueue;
 
 template <typename T>
 class FIFONode : public HALHazardNodeI {
-  friend class LockFreeQueue<T>;
+  template <typename, typename> friend class LockFreeQueue;
   public:
     FIFONode() : next_(NULL) {}
     FIFONode(const T &v) : next_(NULL), v_(v) {}
     ~FIFONode() {};
   public:
-    void retire() {memset(&v_, 0, sizeof(v_));}//{ delete this; }
+    // Nodes come from an array freed by the caller
+    void retire() {}
   public:
     void set_next(FIFONode *next) { next_ = next; }
     FIFONode *get_next() const { return next_; }
@@ -31,7 +38,7 @@ class FIFONode : public HALHazardNodeI {
     T v_;
 };
 
-template <typename T>
+template <typename T, typename Reclaimer>
 class LockFreeQueue {
   typedef FIFONode<T> Node;
   public:
@@ -87,8 +94,9 @@ class LockFreeQueue {
       hazard_version_.release(handle);
       return bret;
     }
+    int enable_lazy_version() { return hazard_version_.enable_lazy_version(); }
   private:
-    HALHazardVersion hazard_version_;
+    Reclaimer hazard_version_;
     Node *head_ CACHE_ALIGNED;
     Node *tail_ CACHE_ALIGNED;
 };
@@ -100,9 +108,50 @@ struct QueueValue {
   QueueValue() : a(0), b(0), sum(0) {};
 };
 
+// LockFreeQueue takes nodes preallocated by the producer, HALLinkedQueue
+// allocates its own and also takes a batch at once
+template <typename Reclaimer>
+FIFONode<QueueValue> *alloc_nodes(LockFreeQueue<QueueValue, Reclaimer> &queue, const int64_t count) {
+  UNUSED(queue);
+  return new FIFONode<QueueValue>[count];
+}
+
+template <typename Reclaimer>
+void push_values(LockFreeQueue<QueueValue, Reclaimer> &queue, const QueueValue *values, const int64_t count, FIFONode<QueueValue> *nodes) {
+  for (int64_t i = 0; i < count; i++) {
+    queue.push(values[i], &nodes[i]);
+  }
+}
+
+template <typename Reclaimer>
+bool pop_value(LockFreeQueue<QueueValue, Reclaimer> &queue, QueueValue &v) {
+  return queue.pop(v);
+}
+
+FIFONode<QueueValue> *alloc_nodes(HALLinkedQueue<QueueValue> &queue, const int64_t count) {
+  UNUSED(queue);
+  UNUSED(count);
+  return NULL;
+}
+
+void push_values(HALLinkedQueue<QueueValue> &queue, const QueueValue *values, const int64_t count, FIFONode<QueueValue> *nodes) {
+  UNUSED(nodes);
+  if (1 == count) {
+    queue.push(values[0]);
+  } else {
+    queue.push_batch(values, count);
+  }
+}
+
+bool pop_value(HALLinkedQueue<QueueValue> &queue, QueueValue &v) {
+  return HAL_SUCCESS == queue.pop(v);
+}
+
+template <typename Queue>
 struct GConf {
-  LockFreeQueue<QueueValue> queue;
+  Queue queue;
   int64_t loop_times;
+  int64_t batch_size;
   int64_t producer_count;
 };
 
@@ -118,13 +167,14 @@ void set_cpu_affinity() {
   }
 }
 
+template <typename Queue>
 void *thread_consumer(void *data) {
   set_cpu_affinity();
-  GConf *g_conf = (GConf*)data;
+  GConf<Queue> *g_conf = (GConf<Queue>*)data;
   QueueValue stack_value;
   bool skip = false;
   while (true) {
-    if (g_conf->queue.pop(stack_value)) {
+    if (pop_value(g_conf->queue, stack_value)) {
 #ifndef DO_NOT_CHECK
       assert((stack_value.a + stack_value.b) == stack_value.sum);
 #endif
@@ -142,42 +192,47 @@ void *thread_consumer(void *data) {
   return NULL;
 }
 
+template <typename Queue>
 void *thread_producer(void *data) {
   set_cpu_affinity();
-  GConf *g_conf = (GConf*)data;
-  FIFONode<QueueValue> *nodes = new FIFONode<QueueValue>[g_conf->loop_times];
+  GConf<Queue> *g_conf = (GConf<Queue>*)data;
+  FIFONode<QueueValue> *nodes = alloc_nodes(g_conf->queue, g_conf->loop_times);
 #ifndef DO_NOT_CHECK
   int64_t sum_base = gettn() * g_conf->loop_times;
 #endif
-  QueueValue stack_value;
-  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+  QueueValue *stack_values = new QueueValue[g_conf->batch_size];
+  for (int64_t i = 0; i < g_conf->loop_times; i += g_conf->batch_size) {
 #ifndef DO_NOT_CHECK
-    stack_value.a = sum_base + i;
-    stack_value.b = i;
-    stack_value.sum = sum_base + 2*i;
+    for (int64_t j = 0; j < g_conf->batch_size; j++) {
+      stack_values[j].a = sum_base + i + j;
+      stack_values[j].b = i + j;
+      stack_values[j].sum = sum_base + 2*(i + j);
+    }
 #endif
-    g_conf->queue.push(stack_value, &nodes[i]);
+    push_values(g_conf->queue, stack_values, g_conf->batch_size, (NULL == nodes) ? NULL : &nodes[i]);
   }
+  delete[] stack_values;
   __sync_add_and_fetch(&(g_conf->producer_count), -1);
   return NULL;
 }
 
-void run_test(GConf *g_conf, const int64_t thread_count) {
+template <typename Queue>
+void run_test(GConf<Queue> *g_conf, const int64_t thread_count) {
   pthread_t *pds_consumer = new pthread_t[thread_count];
   pthread_t *pds_producer = new pthread_t[thread_count];
   g_conf->producer_count = thread_count;
   int64_t timeu = get_cur_microseconds_time();
   for (int64_t i = 0; i < thread_count; i++) {
-    pthread_create(&pds_consumer[i], NULL, thread_consumer, g_conf);
-    pthread_create(&pds_producer[i], NULL, thread_producer, g_conf);
+    pthread_create(&pds_consumer[i], NULL, thread_consumer<Queue>, g_conf);
+    pthread_create(&pds_producer[i], NULL, thread_producer<Queue>, g_conf);
   }
   for (int64_t i = 0; i < thread_count; i++) {
     pthread_join(pds_consumer[i], NULL);
     pthread_join(pds_producer[i], NULL);
   }
   timeu = get_cur_microseconds_time() - timeu;
-  fprintf(stdout, "threads=%ld+%ld push+pop=%ld timeu=%ld tps=%0.2f\n",
-      thread_count, thread_count, thread_count * 2 * g_conf->loop_times, timeu, 1000000.0 * (double)(thread_count * 2 * g_conf->loop_times) / (double)(timeu));
+  fprintf(stdout, "threads=%ld+%ld batch=%ld push+pop=%ld timeu=%ld tps=%0.2f\n",
+      thread_count, thread_count, g_conf->batch_size, thread_count * 2 * g_conf->loop_times, timeu, 1000000.0 * (double)(thread_count * 2 * g_conf->loop_times) / (double)(timeu));
   delete[] pds_producer;
   delete[] pds_consumer;
 }
@@ -187,22 +242,59 @@ int main(const int argc, char **argv) {
   if (1 < argc) {
     cpu_count = atoi(argv[1]);
   }
+  // batch size of HALLinkedQueue, or hv: HALHazardVersion, lazy: HALHazardVersion
+  // in lazy version mode, ebr: HALEpochReclaim of LockFreeQueue
+  bool use_lazy = (2 < argc && 0 == strcmp("lazy", argv[2]));
+  bool use_hv = use_lazy || (2 < argc && 0 == strcmp("hv", argv[2]));
+  bool use_ebr = (2 < argc && 0 == strcmp("ebr", argv[2]));
+  int64_t batch_size = 1;
+  if (2 < argc
+      && !use_hv
+      && !use_ebr) {
+    batch_size = atoi(argv[2]);
+  }
   if (0 >= cpu_count) {
     cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
   }
+  if (0 >= batch_size) {
+    batch_size = 1;
+  }
   int64_t producer_count = (cpu_count + 1) / 2;
 
-  int64_t memory = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
-  int64_t available = memory * 4 / 10;
-  int64_t count = available / sizeof(FIFONode<QueueValue>) / producer_count;
-
-  GConf g_conf;
-  g_conf.loop_times = count;
-
 #ifdef DO_NOT_CHECK
   fprintf(stdout, "Run without check pop result...\n");
 #else
   fprintf(stdout, "Run and check pop result...\n");
 #endif
-  run_test(&g_conf, producer_count);
+  if (use_hv
+      || use_ebr) {
+    // every push takes a node preallocated by the producer
+    int64_t memory = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+    int64_t available = memory * 4 / 10;
+    int64_t count = available / sizeof(FIFONode<QueueValue>) / producer_count;
+    if (use_ebr) {
+      fprintf(stdout, "Reclaimer is HALEpochReclaim\n");
+      GConf<LockFreeQueue<QueueValue, HALEpochReclaim> > g_conf;
+      g_conf.loop_times = count;
+      g_conf.batch_size = batch_size;
+      run_test(&g_conf, producer_count);
+    } else {
+      fprintf(stdout, "Reclaimer is HALHazardVersion%s\n", use_lazy ? " in lazy version mode" : "");
+      GConf<LockFreeQueue<QueueValue, HALHazardVersion> > g_conf;
+      if (use_lazy) {
+        g_conf.queue.enable_lazy_version();
+      }
+      g_conf.loop_times = count;
+      g_conf.batch_size = batch_size;
+      run_test(&g_conf, producer_count);
+    }
+  } else {
+    // nodes are recycled by the queue, so the loop count is not bound by
+    // the memory preallocated for every push
+    fprintf(stdout, "Queue is HALLinkedQueue\n");
+    GConf<HALLinkedQueue<QueueValue> > g_conf;
+    g_conf.loop_times = 10000000 / producer_count / batch_size * batch_size;
+    g_conf.batch_size = batch_size;
+    run_test(&g_conf, producer_count);
+  }
 }
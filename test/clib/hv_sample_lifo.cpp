@@ -2,25 +2,29 @@
 // Author: likai.root@gmail.com
 
 #include <unistd.h>
+#include <string.h>
 #include "clib/hal_hazard_version.h"
+#include "clib/hal_epoch_reclaim.h"
+#include "clib/hal_stack.h"
 #include "clib/hal_util.h"
 #include <gtest/gtest.h>
 
 using namespace libhalog;
 using namespace libhalog::clib;
 
-template <typename T>
+template <typename T, typename Reclaimer>
 class LockFreeStack;
 
 template <typename T>
 class LIFONode : public HALHazardNodeI {
-  friend class LockFreeStack<T>;
+  template <typename, typename> friend class LockFreeStack;
   public:
     LIFONode() : next_(NULL) {}
     LIFONode(const T &v) : next_(NULL), v_(v) {}
     ~LIFONode() {};
   public:
-    void retire() {memset(&v_, 0, sizeof(v_));}//{ delete this; }
+    // Nodes come from an array freed by the caller
+    void retire() {}
   public:
     void set_next(LIFONode *next) { next_ = next; }
     LIFONode *get_next() const { return next_; }
@@ -31,7 +35,7 @@ class LIFONode : public HALHazardNodeI {
     T v_;
 };
 
-template <typename T>
+template <typename T, typename Reclaimer>
 class LockFreeStack {
   typedef LIFONode<T> Node;
   public:
@@ -80,7 +84,7 @@ class LockFreeStack {
       return bret;
     }
   private:
-    HALHazardVersion hazard_version_;
+    Reclaimer hazard_version_;
     Node *top_ CACHE_ALIGNED;
 };
 
@@ -91,8 +95,49 @@ struct StackValue {
   StackValue() : a(0), b(0), sum(0) {};
 };
 
+// LockFreeStack takes nodes preallocated by the producer, HALStack
+// allocates its own
+template <typename Reclaimer>
+LIFONode<StackValue> *alloc_nodes(LockFreeStack<StackValue, Reclaimer> &stack, const int64_t count) {
+  UNUSED(stack);
+  return new LIFONode<StackValue>[count];
+}
+
+template <typename Reclaimer>
+bool push_value(LockFreeStack<StackValue, Reclaimer> &stack, const StackValue &v, LIFONode<StackValue> *node) {
+  stack.push(v, node);
+  return true;
+}
+
+template <typename Reclaimer>
+bool pop_value(LockFreeStack<StackValue, Reclaimer> &stack, StackValue &v) {
+  return stack.pop(v);
+}
+
+// HALStack with an 8 slot elimination array
+class EliminationStack : public HALStack<StackValue> {
+  public:
+    EliminationStack() : HALStack<StackValue>(8) {}
+};
+
+LIFONode<StackValue> *alloc_nodes(HALStack<StackValue> &stack, const int64_t count) {
+  UNUSED(stack);
+  UNUSED(count);
+  return NULL;
+}
+
+bool push_value(HALStack<StackValue> &stack, const StackValue &v, LIFONode<StackValue> *node) {
+  UNUSED(node);
+  return HAL_SUCCESS == stack.push(v);
+}
+
+bool pop_value(HALStack<StackValue> &stack, StackValue &v) {
+  return HAL_SUCCESS == stack.pop(v);
+}
+
+template <typename Stack>
 struct GConf {
-  LockFreeStack<StackValue> stack;
+  Stack stack;
   int64_t loop_times;
   int64_t producer_count;
 };
@@ -109,13 +154,14 @@ void set_cpu_affinity() {
   }
 }
 
+template <typename Stack>
 void *thread_consumer(void *data) {
   set_cpu_affinity();
-  GConf *g_conf = (GConf*)data;
+  GConf<Stack> *g_conf = (GConf<Stack>*)data;
   StackValue stack_value;
   bool skip = false;
   while (true) {
-    if (g_conf->stack.pop(stack_value)) {
+    if (pop_value(g_conf->stack, stack_value)) {
 #ifndef DO_NOT_CHECK
       assert((stack_value.a + stack_value.b) == stack_value.sum);
 #endif
@@ -133,10 +179,11 @@ void *thread_consumer(void *data) {
   return NULL;
 }
 
+template <typename Stack>
 void *thread_producer(void *data) {
   set_cpu_affinity();
-  GConf *g_conf = (GConf*)data;
-  LIFONode<StackValue> *nodes = new LIFONode<StackValue>[g_conf->loop_times];
+  GConf<Stack> *g_conf = (GConf<Stack>*)data;
+  LIFONode<StackValue> *nodes = alloc_nodes(g_conf->stack, g_conf->loop_times);
 #ifndef DO_NOT_CHECK
   int64_t sum_base = gettn() * g_conf->loop_times;
 #endif
@@ -147,20 +194,21 @@ void *thread_producer(void *data) {
     stack_value.b = i;
     stack_value.sum = sum_base + 2*i;
 #endif
-    g_conf->stack.push(stack_value, &nodes[i]);
+    push_value(g_conf->stack, stack_value, (NULL == nodes) ? NULL : &nodes[i]);
   }
   __sync_add_and_fetch(&(g_conf->producer_count), -1);
   return NULL;
 }
 
-void run_test(GConf *g_conf, const int64_t thread_count) {
+template <typename Stack>
+void run_test(GConf<Stack> *g_conf, const int64_t thread_count) {
   pthread_t *pds_consumer = new pthread_t[thread_count];
   pthread_t *pds_producer = new pthread_t[thread_count];
   g_conf->producer_count = thread_count;
   int64_t timeu = get_cur_microseconds_time();
   for (int64_t i = 0; i < thread_count; i++) {
-    pthread_create(&pds_consumer[i], NULL, thread_consumer, g_conf);
-    pthread_create(&pds_producer[i], NULL, thread_producer, g_conf);
+    pthread_create(&pds_consumer[i], NULL, thread_consumer<Stack>, g_conf);
+    pthread_create(&pds_producer[i], NULL, thread_producer<Stack>, g_conf);
   }
   for (int64_t i = 0; i < thread_count; i++) {
     pthread_join(pds_consumer[i], NULL);
@@ -178,6 +226,11 @@ int main(const int argc, char **argv) {
   if (1 < argc) {
     cpu_count = atoi(argv[1]);
   }
+  // hv: HALHazardVersion, ebr: HALEpochReclaim, stack: HALStack,
+  // elimination: HALStack with elimination backoff
+  bool use_ebr = (2 < argc && 0 == strcmp("ebr", argv[2]));
+  bool use_stack = (2 < argc && 0 == strcmp("stack", argv[2]));
+  bool use_elimination = (2 < argc && 0 == strcmp("elimination", argv[2]));
   if (0 >= cpu_count) {
     cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
   }
@@ -187,13 +240,30 @@ int main(const int argc, char **argv) {
   int64_t available = memory * 4 / 10;
   int64_t count = available / sizeof(LIFONode<StackValue>) / producer_count;
 
-  GConf g_conf;
-  g_conf.loop_times = count;
-
 #ifdef DO_NOT_CHECK
   fprintf(stdout, "Run without check pop result...\n");
 #else
   fprintf(stdout, "Run and check pop result...\n");
 #endif
-  run_test(&g_conf, producer_count);
+  if (use_stack) {
+    fprintf(stdout, "Stack is HALStack\n");
+    GConf<HALStack<StackValue> > g_conf;
+    g_conf.loop_times = count;
+    run_test(&g_conf, producer_count);
+  } else if (use_elimination) {
+    fprintf(stdout, "Stack is HALStack with elimination\n");
+    GConf<EliminationStack> g_conf;
+    g_conf.loop_times = count;
+    run_test(&g_conf, producer_count);
+  } else if (use_ebr) {
+    fprintf(stdout, "Reclaimer is HALEpochReclaim\n");
+    GConf<LockFreeStack<StackValue, HALEpochReclaim> > g_conf;
+    g_conf.loop_times = count;
+    run_test(&g_conf, producer_count);
+  } else {
+    fprintf(stdout, "Reclaimer is HALHazardVersion\n");
+    GConf<LockFreeStack<StackValue, HALHazardVersion> > g_conf;
+    g_conf.loop_times = count;
+    run_test(&g_conf, producer_count);
+  }
 }
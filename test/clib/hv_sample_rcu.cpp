@@ -0,0 +1,149 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include <string.h>
+#include "clib/hal_rcu_ptr.h"
+#include "clib/hal_spin_rwlock.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+// Reader scaling of HALRcuPtr against a pointer guarded by HALSpinRWLock,
+// while one writer swaps in a new routing table every update interval.
+// usage: hv_sample_rcu.bin [reader count] [rcu|locked] [update interval us]
+
+static const int64_t ROUTE_COUNT = 64;
+
+struct RouteTable {
+  int64_t version;
+  int64_t routes[ROUTE_COUNT];
+  RouteTable(const int64_t v) : version(v) {
+    for (int64_t i = 0; i < ROUTE_COUNT; i++) {
+      routes[i] = v + i;
+    }
+  }
+};
+
+class LockedPtr {
+  public:
+    class ReadGuard {
+      friend class LockedPtr;
+      public:
+        const RouteTable *operator ->() const { return ptr_; }
+      private:
+        HALRLockGuard guard_;
+        const RouteTable *ptr_;
+    };
+  public:
+    LockedPtr(RouteTable *ptr) : ptr_(ptr) {}
+    ~LockedPtr() { delete ptr_; }
+    int read(ReadGuard &guard) {
+      lock_.rlock();
+      guard.guard_.set_lock(&lock_);
+      guard.ptr_ = ptr_;
+      return HAL_SUCCESS;
+    }
+    int update(RouteTable *ptr) {
+      RouteTable *old = NULL;
+      {
+        HALWLockGuard guard;
+        lock_.lock();
+        guard.set_lock(&lock_);
+        old = ptr_;
+        ptr_ = ptr;
+      }
+      delete old;
+      return HAL_SUCCESS;
+    }
+  private:
+    HALSpinRWLock lock_;
+    RouteTable *ptr_;
+};
+
+template <typename Ptr>
+struct GConf {
+  Ptr ptr;
+  int64_t loop_times;
+  int64_t update_interval_us;
+  int64_t running_readers;
+  GConf() : ptr(new RouteTable(0)) {}
+};
+
+template <typename Ptr>
+void *thread_reader(void *data) {
+  GConf<Ptr> *g_conf = (GConf<Ptr>*)data;
+  int64_t sum = 0;
+  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+    typename Ptr::ReadGuard guard;
+    g_conf->ptr.read(guard);
+    sum += guard->routes[i % ROUTE_COUNT] - guard->version;
+  }
+  __sync_add_and_fetch(&g_conf->running_readers, -1);
+  if (0 == sum) {
+    fprintf(stdout, "unexpected sum\n");
+  }
+  return NULL;
+}
+
+template <typename Ptr>
+void *thread_writer(void *data) {
+  GConf<Ptr> *g_conf = (GConf<Ptr>*)data;
+  int64_t version = 0;
+  while (0 < ATOMIC_LOAD(&g_conf->running_readers)) {
+    g_conf->ptr.update(new RouteTable(++version));
+    usleep((useconds_t)g_conf->update_interval_us);
+  }
+  return NULL;
+}
+
+template <typename Ptr>
+void run_test(GConf<Ptr> *g_conf, const int64_t thread_count) {
+  g_conf->running_readers = thread_count;
+  pthread_t wpd;
+  pthread_t *pds = new pthread_t[thread_count];
+  int64_t timeu = get_cur_microseconds_time();
+  pthread_create(&wpd, NULL, thread_writer<Ptr>, g_conf);
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&pds[i], NULL, thread_reader<Ptr>, g_conf);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(pds[i], NULL);
+  }
+  timeu = get_cur_microseconds_time() - timeu;
+  pthread_join(wpd, NULL);
+  fprintf(stdout, "readers=%ld interval=%ldus reads=%ld timeu=%ld tps=%0.2f\n",
+      thread_count, g_conf->update_interval_us, thread_count * g_conf->loop_times, timeu, 1000000.0 * (double)(thread_count * g_conf->loop_times) / (double)(timeu));
+  delete[] pds;
+}
+
+int main(const int argc, char **argv) {
+  int64_t thread_count = 0;
+  if (1 < argc) {
+    thread_count = atoi(argv[1]);
+  }
+  bool use_locked = (2 < argc && 0 == strcmp("locked", argv[2]));
+  int64_t update_interval_us = 1000;
+  if (3 < argc) {
+    update_interval_us = atoi(argv[3]);
+  }
+  if (0 >= thread_count) {
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  if (use_locked) {
+    fprintf(stdout, "Ptr is HALSpinRWLock guarded\n");
+    GConf<LockedPtr> g_conf;
+    g_conf.loop_times = 20000000 / thread_count;
+    g_conf.update_interval_us = update_interval_us;
+    run_test(&g_conf, thread_count);
+  } else {
+    fprintf(stdout, "Ptr is HALRcuPtr\n");
+    GConf<HALRcuPtr<RouteTable> > g_conf;
+    g_conf.loop_times = 20000000 / thread_count;
+    g_conf.update_interval_us = update_interval_us;
+    run_test(&g_conf, thread_count);
+  }
+}
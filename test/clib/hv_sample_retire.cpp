@@ -0,0 +1,79 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include <stdio.h>
+#include "clib/hal_hazard_version.h"
+#include "clib/hal_util.h"
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+class RetireNode : public HALHazardNodeI {
+  public:
+    void retire() {}
+};
+
+struct GConf {
+  HALHazardVersion hv;
+  bool stop;
+  int64_t ready_count;
+  int64_t retire_times;
+};
+
+void *thread_reader(void *data) {
+  GConf *g_conf = (GConf*)data;
+  uint64_t handle = 0;
+  g_conf->hv.acquire(handle);
+  g_conf->hv.release(handle);
+  __sync_add_and_fetch(&(g_conf->ready_count), 1);
+  while (!ATOMIC_LOAD(&(g_conf->stop))) {
+    g_conf->hv.acquire(handle);
+    usleep(10);
+    g_conf->hv.release(handle);
+    usleep(1000);
+  }
+  return NULL;
+}
+
+void run_test(GConf *g_conf, const int64_t thread_count) {
+  pthread_t *pds_reader = new pthread_t[thread_count];
+  RetireNode *nodes = new RetireNode[g_conf->retire_times];
+  g_conf->stop = false;
+  g_conf->ready_count = 0;
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&pds_reader[i], NULL, thread_reader, g_conf);
+  }
+  while (thread_count > ATOMIC_LOAD(&(g_conf->ready_count))) {
+    usleep(1000);
+  }
+  int64_t timeu = get_cur_microseconds_time();
+  for (int64_t i = 0; i < g_conf->retire_times; i++) {
+    g_conf->hv.add_node(&nodes[i]);
+    g_conf->hv.retire();
+  }
+  timeu = get_cur_microseconds_time() - timeu;
+  ATOMIC_STORE(&(g_conf->stop), true);
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(pds_reader[i], NULL);
+  }
+  g_conf->hv.retire();
+  fprintf(stdout, "threads=%ld retire=%ld timeu=%ld retire_tps=%0.2f\n",
+      thread_count, g_conf->retire_times, timeu, 1000000.0 * (double)(g_conf->retire_times) / (double)(timeu));
+  delete[] nodes;
+  delete[] pds_reader;
+}
+
+int main(const int argc, char **argv) {
+  int64_t thread_count = 0;
+  if (1 < argc) {
+    thread_count = atoi(argv[1]);
+  }
+  if (0 >= thread_count) {
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  GConf g_conf;
+  g_conf.retire_times = 100000;
+  run_test(&g_conf, thread_count);
+}
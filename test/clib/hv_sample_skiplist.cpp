@@ -0,0 +1,126 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include <string.h>
+#include <map>
+#include "clib/hal_skip_list.h"
+#include "clib/hal_spin_rwlock.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+// Mixed get/insert/erase throughput of HALSkipList against std::map guarded
+// by HALSpinRWLock.
+// usage: hv_sample_skiplist.bin [thread count] [read percent] [hal|locked]
+
+class LockedMap {
+  public:
+    int insert(const int64_t key, const int64_t value) {
+      HALWLockGuard guard;
+      lock_.lock();
+      guard.set_lock(&lock_);
+      return map_.insert(std::make_pair(key, value)).second ? HAL_SUCCESS : HAL_ENTRY_EXIST;
+    }
+    int get(const int64_t key, int64_t &value) {
+      int ret = HAL_SUCCESS;
+      HALRLockGuard guard;
+      lock_.rlock();
+      guard.set_lock(&lock_);
+      std::map<int64_t, int64_t>::const_iterator iter = map_.find(key);
+      if (map_.end() == iter) {
+        ret = HAL_ENTRY_NOT_EXIST;
+      } else {
+        value = iter->second;
+      }
+      return ret;
+    }
+    int erase(const int64_t key) {
+      HALWLockGuard guard;
+      lock_.lock();
+      guard.set_lock(&lock_);
+      return (0 == map_.erase(key)) ? HAL_ENTRY_NOT_EXIST : HAL_SUCCESS;
+    }
+  private:
+    HALSpinRWLock lock_;
+    std::map<int64_t, int64_t> map_;
+};
+
+template <typename Map>
+struct GConf {
+  Map map;
+  int64_t key_count;
+  int64_t loop_times;
+  int64_t read_percent;
+};
+
+template <typename Map>
+void *thread_worker(void *data) {
+  GConf<Map> *g_conf = (GConf<Map>*)data;
+  int64_t value = 0;
+  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+    uint64_t r = fast_rand();
+    int64_t key = (int64_t)((r >> 8) % (uint64_t)g_conf->key_count);
+    int64_t op = (int64_t)(r % 100);
+    if (op < g_conf->read_percent) {
+      g_conf->map.get(key, value);
+    } else if (0 == (op & 1)) {
+      g_conf->map.insert(key, key);
+    } else {
+      g_conf->map.erase(key);
+    }
+  }
+  return NULL;
+}
+
+template <typename Map>
+void run_test(GConf<Map> *g_conf, const int64_t thread_count) {
+  for (int64_t i = 0; i < g_conf->key_count; i += 2) {
+    g_conf->map.insert(i, i);
+  }
+  pthread_t *pds = new pthread_t[thread_count];
+  int64_t timeu = get_cur_microseconds_time();
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&pds[i], NULL, thread_worker<Map>, g_conf);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(pds[i], NULL);
+  }
+  timeu = get_cur_microseconds_time() - timeu;
+  fprintf(stdout, "threads=%ld read=%ld%% ops=%ld timeu=%ld tps=%0.2f\n",
+      thread_count, g_conf->read_percent, thread_count * g_conf->loop_times, timeu, 1000000.0 * (double)(thread_count * g_conf->loop_times) / (double)(timeu));
+  delete[] pds;
+}
+
+int main(const int argc, char **argv) {
+  int64_t thread_count = 0;
+  if (1 < argc) {
+    thread_count = atoi(argv[1]);
+  }
+  int64_t read_percent = 90;
+  if (2 < argc) {
+    read_percent = atoi(argv[2]);
+  }
+  bool use_locked = (3 < argc && 0 == strcmp("locked", argv[3]));
+  if (0 >= thread_count) {
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  if (use_locked) {
+    fprintf(stdout, "Map is std::map with HALSpinRWLock\n");
+    GConf<LockedMap> g_conf;
+    g_conf.key_count = 1000000;
+    g_conf.loop_times = 10000000 / thread_count;
+    g_conf.read_percent = read_percent;
+    run_test(&g_conf, thread_count);
+  } else {
+    fprintf(stdout, "Map is HALSkipList\n");
+    GConf<HALSkipList<int64_t, int64_t> > g_conf;
+    g_conf.key_count = 1000000;
+    g_conf.loop_times = 10000000 / thread_count;
+    g_conf.read_percent = read_percent;
+    run_test(&g_conf, thread_count);
+  }
+}
@@ -1,7 +1,9 @@
 // Libhalog
 // Author: likai.root@gmail.com
 
+#include <string>
 #include "clib/hal_base_log.h"
+#include "clib/hal_error.h"
 #include "clib/hal_util.h"
 #include <gtest/gtest.h>
 
@@ -49,6 +51,73 @@ TEST(HALLog, mkdir) {
   log.write_log("clib", HALLogLevels::HAL_LOG_INFO, __FILE__, __LINE__, __FUNCTION__, "hello key=[%s]", "world");
 }
 
+TEST(HALLog, json_escape) {
+  char buf[1024];
+  const char *plain = "a plain message which is longer than sixteen bytes";
+  int64_t length = json_escape(plain, strlen(plain), buf, sizeof(buf));
+  EXPECT_EQ((int64_t)strlen(plain), length);
+  EXPECT_EQ(0, memcmp(plain, buf, length));
+
+  const char *special = "0123456789abcde\"quote\" back\\slash\nnew\tline\x01";
+  const char *expect = "0123456789abcde\\\"quote\\\" back\\\\slash\\nnew\\tline\\u0001";
+  length = json_escape(special, strlen(special), buf, sizeof(buf));
+  EXPECT_EQ((int64_t)strlen(expect), length);
+  EXPECT_EQ(0, memcmp(expect, buf, length));
+
+  // truncate on escape sequence boundary
+  length = json_escape("ab\"", 3, buf, 3);
+  EXPECT_EQ(2, length);
+}
+
+const int64_t JSON_TIME_LENGTH = sizeof("{\"time\":\"YYYY-mm-dd HH:MM:SS.uuuuuu\",") - 1;
+
+// Reads the log back and checks it is the header written at time with tid,
+// followed by expect
+void expect_json_line(const char *file_name, const std::string &expect) {
+  char buf[4096];
+  FILE *fp = fopen(file_name, "r");
+  ASSERT_TRUE(NULL != fp);
+  ASSERT_TRUE(NULL != fgets(buf, sizeof(buf), fp));
+  EXPECT_TRUE(NULL == fgets(buf + strlen(buf), (int)(sizeof(buf) - strlen(buf)), fp));
+  fclose(fp);
+  std::string line(buf);
+  ASSERT_LT(JSON_TIME_LENGTH, (int64_t)line.size());
+  EXPECT_EQ(0U, line.find("{\"time\":\""));
+  EXPECT_EQ(expect, line.substr(JSON_TIME_LENGTH));
+}
+
+TEST(HALLog, json) {
+  const char *file_name = "./log/test_base_log.json.log";
+  char tid[32];
+  snprintf(tid, sizeof(tid), "%ld", libhalog::clib::gettid());
+  HALLog *log = new HALLog();
+  EXPECT_EQ(HAL_INVALID_PARAM, log->set_format(HALLogFormats::HAL_LOG_FORMAT_END));
+  EXPECT_EQ(HAL_SUCCESS, log->set_format(HALLogFormats::HAL_LOG_FORMAT_JSON));
+  log->open_log(file_name, false, true);
+  // header fields are escaped as the message
+  log->write_log("cl\"ib", HALLogLevels::HAL_LOG_INFO, "dir/a\\b.cpp", 12, "f\tn", "hello key=[%s]", "\"world\"\n");
+  delete log;
+  expect_json_line(file_name, std::string("\"level\":\"INFO\",\"module\":\"cl\\\"ib\",\"file\":\"a\\\\b.cpp\",\"line\":12,"
+      "\"function\":\"f\\tn\",\"tid\":") + tid + ",\"msg\":\"hello key=[\\\"world\\\"\\n]\"}\n");
+
+  // a header over the 256 bytes limit is cut inside the function name, the
+  // cut leaves room for the longest tid and the NUL of snprintf
+  std::string function(256, 'f');
+  log = new HALLog();
+  EXPECT_EQ(HAL_SUCCESS, log->set_format(HALLogFormats::HAL_LOG_FORMAT_JSON));
+  log->open_log(file_name, false, true);
+  log->write_log("clib", HALLogLevels::HAL_LOG_INFO, "a.cpp", 12, function.c_str(), "hello");
+  delete log;
+  std::string prefix = "\"level\":\"INFO\",\"module\":\"clib\",\"file\":\"a.cpp\",\"line\":12,\"function\":\"";
+  const int64_t function_end = 256 - 1 - (int64_t)(sizeof("\",\"tid\":-9223372036854775808,\"msg\":\"") - 1);
+  expect_json_line(file_name, prefix + function.substr(0, function_end - JSON_TIME_LENGTH - prefix.size())
+      + "\",\"tid\":" + tid + ",\"msg\":\"hello\"}\n");
+
+  HALLog text_log;
+  text_log.open_log("./log/test_base_log.log", false, true);
+  text_log.write_log("clib", HALLogLevels::HAL_LOG_INFO, __FILE__, __LINE__, __FUNCTION__, "hello key=[%s]", "world");
+}
+
 struct ThreadTask {
   int64_t count;
   HALLog *log;
@@ -0,0 +1,140 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include "clib/hal_error.h"
+#include "clib/hal_cache.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+TEST(HALCache, simple) {
+  HALCache<int64_t, int64_t> cache(1 << 20);
+  int64_t v = 0;
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, cache.get(1, v));
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, cache.erase(1));
+  EXPECT_EQ(HAL_SUCCESS, cache.put(1, 10));
+  EXPECT_EQ(HAL_SUCCESS, cache.get(1, v));
+  EXPECT_EQ(10, v);
+  int64_t used_bytes = cache.get_used_bytes();
+  EXPECT_LT(0, used_bytes);
+  // overwrite keeps one entry with the new charge, the replaced one is
+  // charged until it is freed
+  EXPECT_EQ(HAL_SUCCESS, cache.put(1, 11, 100));
+  EXPECT_EQ(HAL_SUCCESS, cache.get(1, v));
+  EXPECT_EQ(11, v);
+  EXPECT_EQ(1, cache.size());
+  EXPECT_EQ(2 * used_bytes + 100, cache.get_used_bytes());
+  cache.reclaim();
+  EXPECT_EQ(used_bytes + 100, cache.get_used_bytes());
+  EXPECT_EQ(HAL_SUCCESS, cache.erase(1));
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, cache.get(1, v));
+  EXPECT_EQ(0, cache.size());
+  EXPECT_EQ(used_bytes + 100, cache.get_used_bytes());
+  cache.reclaim();
+  EXPECT_EQ(0, cache.get_used_bytes());
+
+  EXPECT_EQ(HAL_OVER_MEMORY_LIMIT, cache.put(2, 2, 1 << 20));
+  EXPECT_EQ(HAL_OVER_MEMORY_LIMIT, cache.put(2, 2, -1));
+
+  HALCacheStat stat;
+  cache.get_stat(stat);
+  EXPECT_EQ(2, stat.hit_count_);
+  EXPECT_EQ(2, stat.miss_count_);
+  EXPECT_EQ(0, stat.eviction_count_);
+  EXPECT_EQ(0, stat.entry_count_);
+  EXPECT_EQ(1 << 20, stat.capacity_);
+}
+
+TEST(HALCache, budget) {
+  // less than 100 entries of 1000 bytes and their own size each
+  const int64_t capacity = 100 * 1000;
+  HALCache<int64_t, int64_t> cache(capacity, 64);
+  for (int64_t i = 0; i < 10000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, cache.put(i, i, 1000));
+    EXPECT_GE(capacity, cache.get_used_bytes());
+  }
+  HALCacheStat stat;
+  cache.get_stat(stat);
+  EXPECT_LT(80, stat.entry_count_);
+  EXPECT_GE(100, stat.entry_count_);
+  EXPECT_EQ(10000 - stat.entry_count_, stat.eviction_count_);
+  // the last put is always there
+  int64_t v = 0;
+  EXPECT_EQ(HAL_SUCCESS, cache.get(9999, v));
+  EXPECT_EQ(9999, v);
+}
+
+TEST(HALCache, clock) {
+  const int64_t capacity = 100 * 1000;
+  HALCache<int64_t, int64_t> cache(capacity, 64);
+  int64_t v = 0;
+  for (int64_t i = 0; i < 10; i++) {
+    EXPECT_EQ(HAL_SUCCESS, cache.put(i, i, 1000));
+  }
+  // hot keys are hit between every put and survive a scan of cold ones
+  for (int64_t i = 10; i < 10000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, cache.put(i, i, 1000));
+    for (int64_t k = 0; k < 10; k++) {
+      EXPECT_EQ(HAL_SUCCESS, cache.get(k, v));
+      EXPECT_EQ(k, v);
+    }
+  }
+  HALCacheStat stat;
+  cache.get_stat(stat);
+  EXPECT_EQ(0, stat.miss_count_);
+  EXPECT_LT(9000, stat.eviction_count_);
+}
+
+struct GConf {
+  HALCache<int64_t, int64_t> cache;
+  int64_t key_count;
+  int64_t loop_times;
+  GConf() : cache(1000 * 1000) {}
+};
+
+void *thread_worker(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t v = 0;
+  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+    uint64_t r = fast_rand();
+    int64_t key = (int64_t)((r >> 8) % (uint64_t)g_conf->key_count);
+    if (0 == r % 4) {
+      EXPECT_EQ(HAL_SUCCESS, g_conf->cache.put(key, key * 2, 100));
+    } else if (HAL_SUCCESS == g_conf->cache.get(key, v)) {
+      EXPECT_EQ(key * 2, v);
+    } else if (0 == r % 3) {
+      g_conf->cache.erase(key);
+    }
+  }
+  return NULL;
+}
+
+TEST(HALCache, concurrent) {
+  const int64_t thread_count = 4;
+  GConf g_conf;
+  g_conf.key_count = 100000;
+  g_conf.loop_times = 200000;
+
+  pthread_t pds[thread_count];
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&pds[i], NULL, thread_worker, &g_conf);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(pds[i], NULL);
+  }
+  HALCacheStat stat;
+  g_conf.cache.reclaim();
+  g_conf.cache.get_stat(stat);
+  EXPECT_GE(stat.capacity_, stat.used_bytes_);
+  EXPECT_LT(0, stat.eviction_count_);
+  EXPECT_LT(0, stat.hit_count_);
+  EXPECT_LT(0, stat.miss_count_);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,214 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include "clib/hal_epoch_reclaim.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+class GObject: public HALHazardNodeI {
+  public:
+    GObject(int64_t &counter) : counter_(counter) {
+      __sync_add_and_fetch(&counter_, 1);
+      data_[0] = '^';
+    }
+    virtual ~GObject() {
+    }
+    bool operator== (const GObject &o) const {
+      return (data_[0] == o.data_[0]);
+    }
+    virtual void retire() {
+      data_[0] = '$';
+      __sync_add_and_fetch(&counter_, -1);
+    }
+  protected:
+    int64_t &counter_;
+    char data_[1];
+};
+
+TEST(HALEpochReclaim, simple) {
+  HALEpochReclaim er;
+  int64_t counter = 0;
+
+  // test entire retire
+  uint64_t handle = 0;
+  int ret = er.acquire(handle);
+  EXPECT_EQ(HAL_SUCCESS, ret);
+  for (int64_t i = 0; i < 64; i++) {
+    int ret = er.add_node(new GObject(counter));
+    EXPECT_EQ(HAL_SUCCESS, ret);
+    EXPECT_EQ(i+1, counter);
+  }
+  EXPECT_EQ(64, er.get_hazard_waiting_count());
+  er.retire();
+  EXPECT_EQ(64, counter);
+  er.release(handle);
+  er.retire();
+  EXPECT_EQ(0, counter);
+  EXPECT_EQ(0, er.get_hazard_waiting_count());
+
+  // test partial retire, a reader pins the whole epoch it entered
+  for (int64_t i = 0; i < 32; i++) {
+    int ret = er.add_node(new GObject(counter));
+    EXPECT_EQ(HAL_SUCCESS, ret);
+  }
+  ret = er.acquire(handle);
+  EXPECT_EQ(HAL_SUCCESS, ret);
+  for (int64_t i = 32; i < 64; i++) {
+    int ret = er.add_node(new GObject(counter));
+    EXPECT_EQ(HAL_SUCCESS, ret);
+  }
+  er.retire();
+  EXPECT_EQ(64, counter);
+  er.release(handle);
+  er.retire();
+  EXPECT_EQ(0, counter);
+
+  // test nested acquire in one thread
+  uint64_t inner_handle = 0;
+  ret = er.acquire(handle);
+  EXPECT_EQ(HAL_SUCCESS, ret);
+  ret = er.acquire(inner_handle);
+  EXPECT_EQ(HAL_SUCCESS, ret);
+  ret = er.add_node(new GObject(counter));
+  EXPECT_EQ(HAL_SUCCESS, ret);
+  er.release(inner_handle);
+  er.retire();
+  EXPECT_EQ(1, counter);
+  er.release(handle);
+  er.retire();
+  EXPECT_EQ(0, counter);
+}
+
+struct GConf {
+  GConf(int64_t &c) : counter(c) {}
+  int64_t &counter;
+  int64_t read_loops;
+  int64_t write_loops;
+  GObject *v;
+  HALEpochReclaim er;
+};
+
+void *read_thread_func(void *data) {
+  GConf *g_conf = (GConf*)data;
+  GObject checker(g_conf->counter);
+  for (int64_t i = 0; i < g_conf->read_loops; i++) {
+    uint64_t handle;
+    int ret = g_conf->er.acquire(handle);
+    assert(HAL_SUCCESS == ret);
+    GObject *v = ATOMIC_LOAD(&(g_conf->v));
+    assert(*v == checker);
+    g_conf->er.release(handle);
+  }
+  checker.retire();
+  return NULL;
+}
+
+void *write_thread_func(void *data) {
+  GConf *g_conf = (GConf*)data;
+  for (int64_t i = 0; i < g_conf->write_loops; i++) {
+    GObject *v = new GObject(g_conf->counter);
+    GObject *curr = ATOMIC_LOAD(&(g_conf->v));
+    GObject *old = curr;
+    while (old != (curr = __sync_val_compare_and_swap(&(g_conf->v), old, v))) {
+      old = curr;
+    }
+    uint64_t handle;
+    g_conf->er.acquire(handle);
+    g_conf->er.add_node(old);
+    g_conf->er.release(handle);
+  }
+  g_conf->er.retire();
+  return NULL;
+}
+
+void run_cc(int64_t &counter) {
+  int64_t cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  int64_t read_count = (cpu_count + 1) / 2;
+  int64_t write_count = (cpu_count + 1) / 2;
+
+  GConf g_conf(counter);
+  g_conf.read_loops = 10000000;
+  g_conf.write_loops = 1000000;
+  g_conf.v = new GObject(g_conf.counter);
+
+  pthread_t *rpd = new pthread_t[read_count];
+  pthread_t *wpd = new pthread_t[write_count];
+  for (int64_t i = 0; i < read_count; i++) {
+    pthread_create(&rpd[i], NULL, read_thread_func, &g_conf);
+  }
+  for (int64_t i = 0; i < write_count; i++) {
+    pthread_create(&wpd[i], NULL, write_thread_func, &g_conf);
+  }
+  for (int64_t i = 0; i < read_count; i++) {
+    pthread_join(rpd[i], NULL);
+  }
+  for (int64_t i = 0; i < write_count; i++) {
+    pthread_join(wpd[i], NULL);
+  }
+  delete[] wpd;
+  delete[] rpd;
+  g_conf.v->retire();
+}
+
+TEST(HALEpochReclaim, cc) {
+  int64_t counter = 0;
+  // limbo lists left by exited threads are retired when GConf is destroyed
+  run_cc(counter);
+  EXPECT_EQ(0, counter);
+}
+
+struct ExitTask {
+  HALEpochReclaim *er;
+  int64_t *counter;
+};
+
+void *exit_active_func(void *data) {
+  ExitTask *task = (ExitTask*)data;
+  uint64_t handle = 0;
+  // exits inside the critical section, with nodes in its limbo lists
+  task->er->acquire(handle);
+  for (int64_t i = 0; i < 16; i++) {
+    task->er->add_node(new GObject(*task->counter));
+  }
+  return NULL;
+}
+
+TEST(HALEpochReclaim, thread_exit) {
+  HALEpochReclaim er;
+  int64_t counter = 0;
+  ExitTask task = {&er, &counter};
+  pthread_t pd;
+
+  // an exited thread neither holds the epoch back nor keeps its nodes
+  for (int64_t i = 0; i < 100; i++) {
+    pthread_create(&pd, NULL, exit_active_func, &task);
+    pthread_join(pd, NULL);
+    er.retire();
+    EXPECT_EQ(0, counter);
+    EXPECT_EQ(0, er.get_hazard_waiting_count());
+  }
+
+  // nodes a reader still pins are handed off and retired by another thread
+  uint64_t handle = 0;
+  EXPECT_EQ(HAL_SUCCESS, er.acquire(handle));
+  for (int64_t i = 0; i < 100; i++) {
+    pthread_create(&pd, NULL, exit_active_func, &task);
+    pthread_join(pd, NULL);
+  }
+  EXPECT_EQ(1600, counter);
+  EXPECT_EQ(1600, er.get_hazard_waiting_count());
+  er.release(handle);
+  er.retire();
+  er.retire();
+  EXPECT_EQ(0, counter);
+  EXPECT_EQ(0, er.get_hazard_waiting_count());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,191 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include "clib/hal_error.h"
+#include "clib/hal_event_count.h"
+#include "clib/hal_fixed_queue.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+TEST(HALEventCount, simple) {
+  HALEventCount ec;
+  // nobody waits, nothing to wake
+  ec.notify();
+  ec.notify_all();
+
+  uint32_t key = ec.prepare_wait();
+  ec.cancel_wait();
+
+  // a notify between prepare_wait and wait is not lost
+  key = ec.prepare_wait();
+  ec.notify();
+  EXPECT_EQ(HAL_SUCCESS, ec.wait(key, get_monotonic_microseconds_time() + 1000000));
+
+  key = ec.prepare_wait();
+  int64_t timeu = get_monotonic_microseconds_time();
+  EXPECT_EQ(HAL_TIMEOUT, ec.wait(key, timeu + 10000));
+  EXPECT_LE(timeu + 10000, get_monotonic_microseconds_time());
+}
+
+TEST(HALFixedQueue, wait_timeout) {
+  HALFixedQueue<int64_t> queue(2);
+  int64_t v = 0;
+  int64_t timeu = get_monotonic_microseconds_time();
+  EXPECT_EQ(HAL_TIMEOUT, queue.pop_wait(v, timeu + 10000));
+  EXPECT_LE(timeu + 10000, get_monotonic_microseconds_time());
+  EXPECT_EQ(HAL_SUCCESS, queue.push_wait(1, timeu));
+  EXPECT_EQ(HAL_SUCCESS, queue.push_wait(2, timeu));
+  timeu = get_monotonic_microseconds_time();
+  EXPECT_EQ(HAL_TIMEOUT, queue.push_wait(3, timeu + 10000));
+  EXPECT_LE(timeu + 10000, get_monotonic_microseconds_time());
+  EXPECT_EQ(HAL_SUCCESS, queue.pop_wait(v, timeu));
+  EXPECT_EQ(1, v);
+  EXPECT_EQ(HAL_SUCCESS, queue.pop_wait(v, timeu));
+  EXPECT_EQ(2, v);
+}
+
+struct WaitTask {
+  HALFixedQueue<int64_t> *queue;
+  int64_t value;
+  int ret;
+};
+
+void *pop_wait_func(void *data) {
+  WaitTask *task = (WaitTask*)data;
+  task->ret = task->queue->pop_wait(task->value, get_monotonic_microseconds_time() + 10000000);
+  return NULL;
+}
+
+void *push_wait_func(void *data) {
+  WaitTask *task = (WaitTask*)data;
+  task->ret = task->queue->push_wait(task->value, get_monotonic_microseconds_time() + 10000000);
+  return NULL;
+}
+
+TEST(HALFixedQueue, wait_plain_other_side) {
+  const int64_t thread_count = 2;
+  HALFixedQueue<int64_t> queue(2);
+  WaitTask tasks[thread_count];
+  pthread_t pds[thread_count];
+  int64_t timeu = get_monotonic_microseconds_time();
+
+  // pop_wait sleeping on the empty queue is woken by push
+  tasks[0].queue = &queue;
+  tasks[0].ret = HAL_ERROR;
+  pthread_create(&pds[0], NULL, pop_wait_func, &tasks[0]);
+  usleep(10000);
+  EXPECT_EQ(HAL_SUCCESS, queue.push(1));
+  pthread_join(pds[0], NULL);
+  EXPECT_EQ(HAL_SUCCESS, tasks[0].ret);
+  EXPECT_EQ(1, tasks[0].value);
+
+  // every pop_wait is woken by one push_n
+  for (int64_t i = 0; i < thread_count; i++) {
+    tasks[i].queue = &queue;
+    tasks[i].ret = HAL_ERROR;
+    pthread_create(&pds[i], NULL, pop_wait_func, &tasks[i]);
+  }
+  usleep(10000);
+  int64_t datas[thread_count] = {2, 3};
+  int64_t push_count = 0;
+  EXPECT_EQ(HAL_SUCCESS, queue.push_n(datas, thread_count, push_count));
+  EXPECT_EQ(thread_count, push_count);
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(pds[i], NULL);
+    EXPECT_EQ(HAL_SUCCESS, tasks[i].ret);
+  }
+  EXPECT_EQ(5, tasks[0].value + tasks[1].value);
+
+  // push_wait sleeping on the full queue is woken by pop, and by pop_n
+  int64_t v = 0;
+  EXPECT_EQ(HAL_SUCCESS, queue.push(4));
+  EXPECT_EQ(HAL_SUCCESS, queue.push(5));
+  tasks[0].value = 6;
+  tasks[0].ret = HAL_ERROR;
+  pthread_create(&pds[0], NULL, push_wait_func, &tasks[0]);
+  usleep(10000);
+  EXPECT_EQ(HAL_SUCCESS, queue.pop(v));
+  EXPECT_EQ(4, v);
+  pthread_join(pds[0], NULL);
+  EXPECT_EQ(HAL_SUCCESS, tasks[0].ret);
+  tasks[0].value = 7;
+  tasks[0].ret = HAL_ERROR;
+  pthread_create(&pds[0], NULL, push_wait_func, &tasks[0]);
+  usleep(10000);
+  int64_t pop_count = 0;
+  EXPECT_EQ(HAL_SUCCESS, queue.pop_n(datas, 1, pop_count));
+  EXPECT_EQ(5, datas[0]);
+  pthread_join(pds[0], NULL);
+  EXPECT_EQ(HAL_SUCCESS, tasks[0].ret);
+
+  // nobody waited for a deadline
+  EXPECT_GT(timeu + 5000000, get_monotonic_microseconds_time());
+}
+
+struct GConf {
+  HALFixedQueue<int64_t> queue;
+  int64_t loop_times;
+  int64_t pop_count;
+  int64_t sum;
+  GConf() : queue(16) {}
+};
+
+void *thread_producer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+    EXPECT_EQ(HAL_SUCCESS, g_conf->queue.push_wait(i, INT64_MAX));
+    if (0 == i % 1000) {
+      // let consumers fall asleep on the empty queue
+      usleep(1000);
+    }
+  }
+  return NULL;
+}
+
+void *thread_consumer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t v = 0;
+  while (true) {
+    int ret = g_conf->queue.pop_wait(v, get_monotonic_microseconds_time() + 1000000);
+    if (HAL_SUCCESS == ret) {
+      __sync_add_and_fetch(&g_conf->sum, v);
+      __sync_add_and_fetch(&g_conf->pop_count, 1);
+    } else {
+      // no value is left behind by a lost wake up
+      EXPECT_EQ(HAL_TIMEOUT, ret);
+      break;
+    }
+  }
+  return NULL;
+}
+
+TEST(HALFixedQueue, wait) {
+  const int64_t thread_count = 4;
+  GConf g_conf;
+  g_conf.loop_times = 100000;
+  g_conf.pop_count = 0;
+  g_conf.sum = 0;
+
+  pthread_t ppd[thread_count];
+  pthread_t cpd[thread_count];
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&ppd[i], NULL, thread_producer, &g_conf);
+    pthread_create(&cpd[i], NULL, thread_consumer, &g_conf);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(ppd[i], NULL);
+    pthread_join(cpd[i], NULL);
+  }
+  EXPECT_EQ(thread_count * g_conf.loop_times, g_conf.pop_count);
+  EXPECT_EQ(thread_count * (g_conf.loop_times - 1) * g_conf.loop_times / 2, g_conf.sum);
+  EXPECT_EQ(0, g_conf.queue.size());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
@@ -2,7 +2,10 @@
 // Author: likai.root@gmail.com
 
 #include <unistd.h>
+#include <string.h>
+#include <algorithm>
 #include "clib/hal_fixed_queue.h"
+#include "clib/hal_ring_queue.h"
 #include "clib/hal_util.h"
 #include "clib/hal_base_log.h"
 #include <gtest/gtest.h>
@@ -10,6 +13,12 @@
 using namespace libhalog;
 using namespace libhalog::clib;
 
+// Producer/consumer throughput of HALFixedQueue or HALRingQueue, with
+// push/pop or with push_n/pop_n for every batch size given. spsc, mpsc and
+// spmc run HALFixedQueue of that policy with one thread on the single side.
+// usage: test_fixed_queue.bin [cpu count] [fixed|ring|spsc|mpsc|spmc] [batch size...]
+// e.g.   ./test_fixed_queue.bin 4 ring 1 8 32 128 256
+
 struct QueueValue {
   int64_t a;
   int64_t b;
@@ -17,9 +26,11 @@ struct QueueValue {
   QueueValue() : a(0), b(0), sum(0) {};
 };
 
+template <typename Queue>
 struct GConf {
-  HALFixedQueue<QueueValue> queue;
+  Queue queue;
   int64_t loop_times;
+  int64_t batch_size;
   int64_t producer_count;
   GConf(const int64_t count) : queue(count) {}
 };
@@ -36,15 +47,27 @@ void set_cpu_affinity() {
   }
 }
 
+template <typename Queue>
 void *thread_consumer(void *data) {
   set_cpu_affinity();
-  GConf *g_conf = (GConf*)data;
+  GConf<Queue> *g_conf = (GConf<Queue>*)data;
   QueueValue stack_value;
+  QueueValue *values = new QueueValue[g_conf->batch_size];
+  int64_t pop_count = 0;
   bool skip = false;
   while (true) {
-    if (HAL_SUCCESS == g_conf->queue.pop(stack_value)) {
+    if (1 == g_conf->batch_size
+        && HAL_SUCCESS == g_conf->queue.pop(stack_value)) {
 #ifndef DO_NOT_CHECK
       assert((stack_value.a + stack_value.b) == stack_value.sum);
+#endif
+      skip = false;
+    } else if (1 < g_conf->batch_size
+              && HAL_SUCCESS == g_conf->queue.pop_n(values, g_conf->batch_size, pop_count)) {
+#ifndef DO_NOT_CHECK
+      for (int64_t i = 0; i < pop_count; i++) {
+        assert((values[i].a + values[i].b) == values[i].sum);
+      }
 #endif
       skip = false;
     } else {
@@ -57,48 +80,84 @@ void *thread_consumer(void *data) {
       }
     }
   }
+  delete[] values;
   return NULL;
 }
 
+template <typename Queue>
 void *thread_producer(void *data) {
   set_cpu_affinity();
-  GConf *g_conf = (GConf*)data;
+  GConf<Queue> *g_conf = (GConf<Queue>*)data;
 #ifndef DO_NOT_CHECK
   int64_t sum_base = gettn() * g_conf->loop_times;
 #endif
-  QueueValue stack_value;
-  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+  QueueValue *values = new QueueValue[g_conf->batch_size];
+  int64_t push_count = 0;
+  for (int64_t i = 0; i < g_conf->loop_times; ) {
+    int64_t n = std::min(g_conf->batch_size, g_conf->loop_times - i);
 #ifndef DO_NOT_CHECK
-    stack_value.a = sum_base + i;
-    stack_value.b = i;
-    stack_value.sum = sum_base + 2*i;
+    for (int64_t j = 0; j < n; j++) {
+      values[j].a = sum_base + i + j;
+      values[j].b = i + j;
+      values[j].sum = sum_base + 2*(i + j);
+    }
 #endif
-    while (HAL_SUCCESS != g_conf->queue.push(stack_value)) {}
+    if (1 == g_conf->batch_size) {
+      while (HAL_SUCCESS != g_conf->queue.push(values[0])) {}
+    } else {
+      // a batch may go in by parts when the queue is nearly full
+      for (int64_t j = 0; j < n; ) {
+        if (HAL_SUCCESS == g_conf->queue.push_n(values + j, n - j, push_count)) {
+          j += push_count;
+        }
+      }
+    }
+    i += n;
   }
+  delete[] values;
   __sync_add_and_fetch(&(g_conf->producer_count), -1);
   return NULL;
 }
 
-void run_test(GConf *g_conf, const int64_t thread_count) {
-  pthread_t *pds_consumer = new pthread_t[thread_count];
-  pthread_t *pds_producer = new pthread_t[thread_count];
-  g_conf->producer_count = thread_count;
+template <typename Queue>
+void run_test(GConf<Queue> *g_conf, const int64_t producer_count, const int64_t consumer_count) {
+  pthread_t *pds_consumer = new pthread_t[consumer_count];
+  pthread_t *pds_producer = new pthread_t[producer_count];
+  g_conf->producer_count = producer_count;
   int64_t timeu = get_cur_microseconds_time();
-  for (int64_t i = 0; i < thread_count; i++) {
-    pthread_create(&pds_consumer[i], NULL, thread_consumer, g_conf);
-    pthread_create(&pds_producer[i], NULL, thread_producer, g_conf);
+  for (int64_t i = 0; i < consumer_count; i++) {
+    pthread_create(&pds_consumer[i], NULL, thread_consumer<Queue>, g_conf);
+  }
+  for (int64_t i = 0; i < producer_count; i++) {
+    pthread_create(&pds_producer[i], NULL, thread_producer<Queue>, g_conf);
   }
-  for (int64_t i = 0; i < thread_count; i++) {
+  for (int64_t i = 0; i < consumer_count; i++) {
     pthread_join(pds_consumer[i], NULL);
+  }
+  for (int64_t i = 0; i < producer_count; i++) {
     pthread_join(pds_producer[i], NULL);
   }
   timeu = get_cur_microseconds_time() - timeu;
-  fprintf(stdout, "threads=%ld+%ld push+pop=%ld timeu=%ld tps=%0.2f\n",
-      thread_count, thread_count, thread_count * 2 * g_conf->loop_times, timeu, 1000000.0 * (double)(thread_count * 2 * g_conf->loop_times) / (double)(timeu));
+  fprintf(stdout, "threads=%ld+%ld batch=%ld push+pop=%ld timeu=%ld tps=%0.2f\n",
+      producer_count, consumer_count, g_conf->batch_size, producer_count * 2 * g_conf->loop_times, timeu, 1000000.0 * (double)(producer_count * 2 * g_conf->loop_times) / (double)(timeu));
   delete[] pds_producer;
   delete[] pds_consumer;
 }
 
+template <typename Queue>
+void run_batches(const int64_t queue_length, const int64_t loop_times, const int64_t producer_count, const int64_t consumer_count, const int argc, char **argv) {
+  GConf<Queue> g_conf(queue_length);
+  g_conf.loop_times = loop_times;
+  if (3 >= argc) {
+    g_conf.batch_size = 1;
+    run_test(&g_conf, producer_count, consumer_count);
+  }
+  for (int64_t i = 3; i < argc; i++) {
+    g_conf.batch_size = std::max(1, atoi(argv[i]));
+    run_test(&g_conf, producer_count, consumer_count);
+  }
+}
+
 int main(const int argc, char **argv) {
   int64_t cpu_count = 0;
   if (1 < argc) {
@@ -107,19 +166,32 @@ int main(const int argc, char **argv) {
   if (0 >= cpu_count) {
     cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
   }
-  int64_t producer_count = (cpu_count + 1) / 2;
+  int64_t thread_count = (cpu_count + 1) / 2;
+  const char *mode = (2 < argc) ? argv[2] : "fixed";
 
   int64_t memory = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
   int64_t available = memory * 4 / 10;
-  int64_t count = available / (sizeof(QueueValue) + 8) / producer_count;
-
-  GConf g_conf(count / 100);
-  g_conf.loop_times = count;
+  int64_t count = available / (sizeof(QueueValue) + 8) / thread_count;
 
 #ifdef DO_NOT_CHECK
   fprintf(stdout, "Run without check pop result...\n");
 #else
   fprintf(stdout, "Run and check pop result...\n");
 #endif
-  run_test(&g_conf, producer_count);
+  if (0 == strcmp("ring", mode)) {
+    fprintf(stdout, "Queue is HALRingQueue\n");
+    run_batches<HALRingQueue<QueueValue> >(count / 100, count, thread_count, thread_count, argc, argv);
+  } else if (0 == strcmp("spsc", mode)) {
+    fprintf(stdout, "Queue is HALFixedQueue<HALQueueSPSC>\n");
+    run_batches<HALFixedQueue<QueueValue, HALQueueSPSC> >(count / 100, count, 1, 1, argc, argv);
+  } else if (0 == strcmp("mpsc", mode)) {
+    fprintf(stdout, "Queue is HALFixedQueue<HALQueueMPSC>\n");
+    run_batches<HALFixedQueue<QueueValue, HALQueueMPSC> >(count / 100, count / thread_count, thread_count, 1, argc, argv);
+  } else if (0 == strcmp("spmc", mode)) {
+    fprintf(stdout, "Queue is HALFixedQueue<HALQueueSPMC>\n");
+    run_batches<HALFixedQueue<QueueValue, HALQueueSPMC> >(count / 100, count, 1, thread_count, argc, argv);
+  } else {
+    fprintf(stdout, "Queue is HALFixedQueue\n");
+    run_batches<HALFixedQueue<QueueValue> >(count / 100, count, thread_count, thread_count, argc, argv);
+  }
 }
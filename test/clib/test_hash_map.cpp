@@ -0,0 +1,158 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include <string>
+#include "clib/hal_error.h"
+#include "clib/hal_hash_map.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+TEST(HALHashMap, simple) {
+  HALHashMap<int64_t, int64_t> map;
+  int64_t v = 0;
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, map.get(1, v));
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, map.erase(1));
+  EXPECT_EQ(HAL_SUCCESS, map.put(1, 10));
+  EXPECT_EQ(HAL_SUCCESS, map.get(1, v));
+  EXPECT_EQ(10, v);
+  EXPECT_EQ(HAL_SUCCESS, map.put(1, 11));
+  EXPECT_EQ(HAL_SUCCESS, map.get(1, v));
+  EXPECT_EQ(11, v);
+  EXPECT_EQ(1, map.size());
+  EXPECT_EQ(HAL_SUCCESS, map.erase(1));
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, map.get(1, v));
+  EXPECT_EQ(0, map.size());
+}
+
+struct ConstHash {
+  uint64_t operator()(const std::string &key) const {
+    UNUSED(key);
+    return 7;
+  }
+};
+
+TEST(HALHashMap, custom_hash) {
+  // every key in one chain
+  HALHashMap<std::string, int64_t, ConstHash> map(16);
+  char buf[32];
+  for (int64_t i = 0; i < 100; i++) {
+    snprintf(buf, sizeof(buf), "key%ld", i);
+    EXPECT_EQ(HAL_SUCCESS, map.put(buf, i));
+  }
+  int64_t v = 0;
+  for (int64_t i = 0; i < 100; i += 2) {
+    snprintf(buf, sizeof(buf), "key%ld", i);
+    EXPECT_EQ(HAL_SUCCESS, map.erase(buf));
+  }
+  for (int64_t i = 0; i < 100; i++) {
+    snprintf(buf, sizeof(buf), "key%ld", i);
+    if (0 == i % 2) {
+      EXPECT_EQ(HAL_ENTRY_NOT_EXIST, map.get(buf, v));
+    } else {
+      EXPECT_EQ(HAL_SUCCESS, map.get(buf, v));
+      EXPECT_EQ(i, v);
+    }
+  }
+  EXPECT_EQ(50, map.size());
+}
+
+TEST(HALHashMap, grow) {
+  HALHashMap<int64_t, int64_t> map(16);
+  EXPECT_EQ(16, map.get_bucket_count());
+  int64_t v = 0;
+  for (int64_t i = 0; i < 10000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, map.put(i, i * 2));
+    // keys are reachable at any point of a migration
+    for (int64_t j = i; j >= 0 && j > i - 8; j--) {
+      EXPECT_EQ(HAL_SUCCESS, map.get(j, v));
+      EXPECT_EQ(j * 2, v);
+    }
+  }
+  EXPECT_EQ(10000, map.size());
+  int64_t load_factor = HALHashMap<int64_t, int64_t>::LOAD_FACTOR;
+  EXPECT_LE(10000 / load_factor, map.get_bucket_count());
+  for (int64_t i = 0; i < 10000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, map.get(i, v));
+    EXPECT_EQ(i * 2, v);
+  }
+  for (int64_t i = 0; i < 10000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, map.erase(i));
+  }
+  EXPECT_EQ(0, map.size());
+}
+
+struct GConf {
+  GConf() : map(16) {}
+  HALHashMap<int64_t, int64_t> map;
+  int64_t key_count;
+  int64_t writer_count;
+  int64_t running_writers;
+};
+
+void *thread_writer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t writer = __sync_fetch_and_add(&g_conf->writer_count, 1);
+  // keys of one writer are k with k % 4 == writer
+  for (int64_t round = 0; round < 3; round++) {
+    for (int64_t k = writer; k < g_conf->key_count; k += 4) {
+      EXPECT_EQ(HAL_SUCCESS, g_conf->map.put(k, k * 2 + round));
+    }
+    if (round < 2) {
+      for (int64_t k = writer; k < g_conf->key_count; k += 8) {
+        EXPECT_EQ(HAL_SUCCESS, g_conf->map.erase(k));
+      }
+    }
+  }
+  __sync_add_and_fetch(&g_conf->running_writers, -1);
+  return NULL;
+}
+
+void *thread_reader(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t v = 0;
+  while (0 < ATOMIC_LOAD(&g_conf->running_writers)) {
+    int64_t k = (int64_t)(fast_rand() % (uint64_t)g_conf->key_count);
+    int ret = g_conf->map.get(k, v);
+    if (HAL_SUCCESS == ret) {
+      EXPECT_LE(k * 2, v);
+      EXPECT_GE(k * 2 + 2, v);
+    } else {
+      EXPECT_EQ(HAL_ENTRY_NOT_EXIST, ret);
+    }
+  }
+  return NULL;
+}
+
+TEST(HALHashMap, concurrent) {
+  const int64_t thread_count = 4;
+  GConf g_conf;
+  g_conf.key_count = 50000;
+  g_conf.writer_count = 0;
+  g_conf.running_writers = thread_count;
+
+  pthread_t wpd[thread_count];
+  pthread_t rpd[thread_count];
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&wpd[i], NULL, thread_writer, &g_conf);
+    pthread_create(&rpd[i], NULL, thread_reader, &g_conf);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(wpd[i], NULL);
+    pthread_join(rpd[i], NULL);
+  }
+  EXPECT_EQ(g_conf.key_count, g_conf.map.size());
+  int64_t v = 0;
+  for (int64_t k = 0; k < g_conf.key_count; k++) {
+    EXPECT_EQ(HAL_SUCCESS, g_conf.map.get(k, v));
+    EXPECT_EQ(k * 2 + 2, v);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
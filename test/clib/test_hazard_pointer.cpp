@@ -0,0 +1,204 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include "clib/hal_hazard_pointer.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+class GObject: public HALHazardNodeI {
+  public:
+    GObject(int64_t &counter) : counter_(counter) {
+      __sync_add_and_fetch(&counter_, 1);
+      data_[0] = '^';
+    }
+    virtual ~GObject() {
+    }
+    bool operator== (const GObject &o) const {
+      return (data_[0] == o.data_[0]);
+    }
+    virtual void retire() {
+      data_[0] = '$';
+      __sync_add_and_fetch(&counter_, -1);
+    }
+  protected:
+    int64_t &counter_;
+    char data_[1];
+};
+
+TEST(HALHazardPointer, simple) {
+  HALHazardPointer hp;
+  int64_t counter = 0;
+
+  GObject *v = new GObject(counter);
+  GObject *p = hp.protect(0, &v);
+  EXPECT_EQ(v, p);
+  EXPECT_EQ(HAL_SUCCESS, hp.add_node(v));
+  for (int64_t i = 1; i < 32; i++) {
+    EXPECT_EQ(HAL_SUCCESS, hp.add_node(new GObject(counter)));
+  }
+  hp.retire();
+  EXPECT_EQ(1, counter);
+  EXPECT_EQ(1, hp.get_hazard_waiting_count());
+  hp.clear(0);
+  hp.retire();
+  EXPECT_EQ(0, counter);
+  EXPECT_EQ(0, hp.get_hazard_waiting_count());
+
+  GObject *nil = NULL;
+  EXPECT_EQ(nil, hp.protect(4, &v));
+  EXPECT_EQ(HAL_INVALID_PARAM, hp.set(-1, NULL));
+}
+
+TEST(HALHazardPointer, bounded) {
+  HALHazardPointerT<HAL_MAX_THREAD_COUNT, 2> hp(16);
+  int64_t counter = 0;
+
+  // a stalled reader pins only the nodes it points to
+  GObject *v0 = new GObject(counter);
+  GObject *v1 = new GObject(counter);
+  hp.protect(0, &v0);
+  hp.protect(1, &v1);
+  hp.add_node(v0);
+  hp.add_node(v1);
+  for (int64_t i = 0; i < 100000; i++) {
+    hp.add_node(new GObject(counter));
+    EXPECT_GE(16 + 2, hp.get_hazard_waiting_count());
+  }
+  hp.retire();
+  EXPECT_EQ(2, counter);
+  hp.clear_all();
+  hp.retire();
+  EXPECT_EQ(0, counter);
+}
+
+struct GConf {
+  GConf(int64_t &c) : counter(c) {}
+  int64_t &counter;
+  int64_t read_loops;
+  int64_t write_loops;
+  GObject *v;
+  HALHazardPointer hp;
+};
+
+void *read_thread_func(void *data) {
+  GConf *g_conf = (GConf*)data;
+  GObject checker(g_conf->counter);
+  for (int64_t i = 0; i < g_conf->read_loops; i++) {
+    GObject *v = g_conf->hp.protect(0, &(g_conf->v));
+    assert(*v == checker);
+    g_conf->hp.clear(0);
+  }
+  checker.retire();
+  return NULL;
+}
+
+void *write_thread_func(void *data) {
+  GConf *g_conf = (GConf*)data;
+  for (int64_t i = 0; i < g_conf->write_loops; i++) {
+    GObject *v = new GObject(g_conf->counter);
+    GObject *curr = ATOMIC_LOAD(&(g_conf->v));
+    GObject *old = curr;
+    while (old != (curr = __sync_val_compare_and_swap(&(g_conf->v), old, v))) {
+      old = curr;
+    }
+    g_conf->hp.add_node(old);
+  }
+  g_conf->hp.retire();
+  return NULL;
+}
+
+void run_cc(int64_t &counter) {
+  int64_t cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  int64_t read_count = (cpu_count + 1) / 2;
+  int64_t write_count = (cpu_count + 1) / 2;
+
+  GConf g_conf(counter);
+  g_conf.read_loops = 10000000;
+  g_conf.write_loops = 1000000;
+  g_conf.v = new GObject(g_conf.counter);
+
+  pthread_t *rpd = new pthread_t[read_count];
+  pthread_t *wpd = new pthread_t[write_count];
+  for (int64_t i = 0; i < read_count; i++) {
+    pthread_create(&rpd[i], NULL, read_thread_func, &g_conf);
+  }
+  for (int64_t i = 0; i < write_count; i++) {
+    pthread_create(&wpd[i], NULL, write_thread_func, &g_conf);
+  }
+  for (int64_t i = 0; i < read_count; i++) {
+    pthread_join(rpd[i], NULL);
+  }
+  for (int64_t i = 0; i < write_count; i++) {
+    pthread_join(wpd[i], NULL);
+  }
+  delete[] wpd;
+  delete[] rpd;
+  g_conf.v->retire();
+}
+
+TEST(HALHazardPointer, cc) {
+  int64_t counter = 0;
+  run_cc(counter);
+  EXPECT_EQ(0, counter);
+}
+
+struct ExitTask {
+  HALHazardPointer *hp;
+  int64_t *counter;
+  GObject *protected_node;
+  GObject *retired_node;
+};
+
+void *exit_protect_func(void *data) {
+  ExitTask *task = (ExitTask*)data;
+  // exits with a slot still set and a node of its own retired
+  task->hp->protect(0, &task->protected_node);
+  task->hp->add_node(task->retired_node);
+  return NULL;
+}
+
+TEST(HALHazardPointer, thread_exit) {
+  HALHazardPointer hp;
+  int64_t counter = 0;
+  ExitTask task = {&hp, &counter, NULL, NULL};
+  pthread_t pd;
+
+  // the slots of an exited thread protect nothing
+  for (int64_t i = 0; i < 100; i++) {
+    task.protected_node = new GObject(counter);
+    task.retired_node = new GObject(counter);
+    pthread_create(&pd, NULL, exit_protect_func, &task);
+    pthread_join(pd, NULL);
+    EXPECT_EQ(HAL_SUCCESS, hp.add_node(task.protected_node));
+    hp.retire();
+    EXPECT_EQ(0, counter);
+    EXPECT_EQ(0, hp.get_hazard_waiting_count());
+  }
+
+  // nodes of an exited thread a reader still points to are handed off and
+  // retired by another thread
+  for (int64_t i = 0; i < 100; i++) {
+    GObject *v = new GObject(counter);
+    hp.protect(1, &v);
+    task.protected_node = NULL;
+    task.retired_node = v;
+    pthread_create(&pd, NULL, exit_protect_func, &task);
+    pthread_join(pd, NULL);
+  }
+  hp.retire();
+  EXPECT_EQ(1, counter);
+  EXPECT_EQ(1, hp.get_hazard_waiting_count());
+  hp.clear(1);
+  hp.retire();
+  EXPECT_EQ(0, counter);
+  EXPECT_EQ(0, hp.get_hazard_waiting_count());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
@@ -3,6 +3,7 @@
 
 #include <unistd.h>
 #include "clib/hal_hazard_version.h"
+#include "clib/hal_i_allocator.h"
 #include "clib/hal_util.h"
 #include <gtest/gtest.h>
 
@@ -70,14 +71,326 @@ TEST(HALHazardVersion, simple) {
   hv.retire();
   EXPECT_EQ(0, counter);
 
-  // test acquire in one thread over limit
+  // test nested acquire in one thread
   for (int64_t n = 0; n < 2; n++) {
+    uint64_t inner_handle = 0;
     int ret = hv.acquire(handle);
     EXPECT_EQ(HAL_SUCCESS, ret);
-    ret = hv.acquire(handle);
-    EXPECT_EQ(HAL_EBUSY, ret);
+    ret = hv.acquire(inner_handle);
+    EXPECT_EQ(HAL_SUCCESS, ret);
+    ret = hv.add_node(new GObject(counter));
+    EXPECT_EQ(HAL_SUCCESS, ret);
+    hv.release(inner_handle);
+    hv.retire();
+    EXPECT_EQ(1, counter);
     hv.release(handle);
+    hv.retire();
+    EXPECT_EQ(0, counter);
+  }
+}
+
+TEST(HALHazardVersion, stale_handle) {
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  uint64_t stale = 0;
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(stale));
+  hv.release(stale);
+
+  uint64_t outer = 0;
+  uint64_t inner = 0;
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(outer));
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(inner));
+  // same tid with an old seq, and another tid with the current seq
+  hazard_version::VersionHandle other(inner);
+  other.tid_ = (uint16_t)(other.tid_ + 1);
+  hv.release(stale);
+  hv.release(other.u64_);
+  hv.release(stale);
+  // neither ended a level, the outer section still pins the node
+  hv.release(inner);
+  EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+  hv.retire();
+  EXPECT_EQ(1, counter);
+  hv.release(outer);
+  hv.retire();
+  EXPECT_EQ(0, counter);
+  // releasing outside of any critical section changes nothing either
+  hv.release(outer);
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(outer));
+  hv.release(outer);
+}
+
+TEST(HALHazardVersion, reclaimer) {
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  EXPECT_EQ(HAL_INVALID_PARAM, hv.start_reclaimer(0));
+  EXPECT_EQ(HAL_SUCCESS, hv.start_reclaimer(1000));
+  EXPECT_EQ(HAL_INIT_REPETITIVE, hv.start_reclaimer(1000));
+
+  uint64_t handle = 0;
+  int ret = hv.acquire(handle);
+  EXPECT_EQ(HAL_SUCCESS, ret);
+  for (int64_t i = 0; i < 256; i++) {
+    int ret = hv.add_node(new GObject(counter));
+    EXPECT_EQ(HAL_SUCCESS, ret);
+  }
+  usleep(10000);
+  EXPECT_EQ(256, ATOMIC_LOAD(&counter));
+  hv.release(handle);
+  EXPECT_EQ(256, ATOMIC_LOAD(&counter));
+  for (int64_t i = 0; i < 1000 && 0 != ATOMIC_LOAD(&counter); i++) {
+    usleep(1000);
+  }
+  EXPECT_EQ(0, ATOMIC_LOAD(&counter));
+  hv.stop_reclaimer();
+}
+
+struct PlainObject {
+  PlainObject(int64_t &counter) : counter_(counter) {
+    __sync_add_and_fetch(&counter_, 1);
+  }
+  ~PlainObject() {
+    __sync_add_and_fetch(&counter_, -1);
+  }
+  int64_t &counter_;
+};
+
+class CountingAllocator : public IHALAllocator {
+  public:
+    CountingAllocator() : alloc_count_(0), free_count_(0) {}
+    void *alloc(const int64_t size, const int mod_id) {
+      alloc_count_++;
+      return hal_malloc(size, mod_id);
+    }
+    void free(void *ptr) {
+      free_count_++;
+      hal_free(ptr);
+    }
+  public:
+    int64_t alloc_count_;
+    int64_t free_count_;
+};
+
+TEST(HALHazardVersion, deleter) {
+  HALHazardVersion hv;
+  CountingAllocator allocator;
+  int64_t counter = 0;
+
+  EXPECT_EQ(HAL_INVALID_PARAM, hv.add_node(NULL, hazard_version::delete_object<PlainObject>, NULL));
+  EXPECT_EQ(HAL_INVALID_PARAM, hv.add_node(&counter, NULL, NULL));
+
+  uint64_t handle = 0;
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+  for (int64_t i = 0; i < 16; i++) {
+    EXPECT_EQ(HAL_SUCCESS, hv.add_object(new PlainObject(counter)));
+    void *buf = allocator.alloc(sizeof(PlainObject), HALModIds::HAZARD_VERSION);
+    EXPECT_EQ(HAL_SUCCESS, hv.add_object(new(buf) PlainObject(counter), allocator));
+  }
+  hv.retire();
+  EXPECT_EQ(32, counter);
+  EXPECT_EQ(0, allocator.free_count_);
+  hv.release(handle);
+  hv.retire();
+  EXPECT_EQ(0, counter);
+  EXPECT_EQ(16, allocator.free_count_);
+}
+
+TEST(HALHazardVersion, stat) {
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  HALHazardVersionStat stat;
+  hv.get_stat(stat);
+  EXPECT_EQ(0, stat.thread_count_);
+  EXPECT_EQ(UINT64_MAX, stat.oldest_version_);
+  EXPECT_EQ(-1, stat.oldest_holder_tid_);
+
+  EXPECT_EQ(HAL_INVALID_PARAM, hv.set_stall_watchdog(-1, 0));
+  EXPECT_EQ(HAL_SUCCESS, hv.set_stall_watchdog(10000, 1000000));
+
+  uint64_t handle = 0;
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+  for (int64_t i = 0; i < 8; i++) {
+    EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
   }
+  usleep(50000);
+  // warns about this thread once
+  hv.retire();
+  hv.retire();
+  hv.get_stat(stat);
+  EXPECT_EQ(1, stat.thread_count_);
+  EXPECT_EQ(gettn(), stat.oldest_holder_tid_);
+  EXPECT_GT(stat.curr_version_, stat.oldest_version_);
+  EXPECT_LE(10000, stat.oldest_hold_us_);
+  EXPECT_EQ(8, stat.pending_count_);
+  EXPECT_EQ(0, stat.retired_count_);
+
+  HALHazardThreadStat thread_stats[4];
+  int64_t count = 0;
+  EXPECT_EQ(HAL_INVALID_PARAM, hv.get_thread_stats(NULL, 4, count));
+  EXPECT_EQ(HAL_SUCCESS, hv.get_thread_stats(thread_stats, 4, count));
+  EXPECT_EQ(1, count);
+  EXPECT_EQ(gettn(), thread_stats[0].tid_);
+  EXPECT_EQ(8, thread_stats[0].pending_count_);
+
+  hv.release(handle);
+  hv.retire();
+  hv.get_stat(stat);
+  EXPECT_EQ(UINT64_MAX, stat.oldest_version_);
+  EXPECT_EQ(0, stat.pending_count_);
+  EXPECT_EQ(8, stat.retired_count_);
+  EXPECT_EQ(1, stat.retire_pass_count_);
+  EXPECT_EQ(0, counter);
+}
+
+void count_backpressure(const int64_t waiting_count, const int64_t waiting_bytes, void *arg) {
+  UNUSED(waiting_count);
+  UNUSED(waiting_bytes);
+  (*(int64_t*)arg)++;
+}
+
+struct HoldTask {
+  HALHazardVersion *hv;
+  bool acquired;
+};
+
+void *hold_version_func(void *data) {
+  HoldTask *task = (HoldTask*)data;
+  uint64_t handle = 0;
+  task->hv->acquire(handle);
+  ATOMIC_STORE(&task->acquired, true);
+  usleep(20000);
+  task->hv->release(handle);
+  return NULL;
+}
+
+TEST(HALHazardVersion, memory_limit) {
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  uint64_t handle = 0;
+
+  EXPECT_EQ(HAL_INVALID_PARAM, hv.set_memory_limit(-1, 0, HALBackpressurePolicies::HAL_BACKPRESSURE_ERROR));
+  EXPECT_EQ(HAL_INVALID_PARAM, hv.set_memory_limit(4, 0, HALBackpressurePolicies::HAL_BACKPRESSURE_END));
+  EXPECT_EQ(HAL_INVALID_PARAM, hv.set_memory_limit(4, 0, HALBackpressurePolicies::HAL_BACKPRESSURE_CALLBACK));
+
+  // error policy, node is not taken
+  EXPECT_EQ(HAL_SUCCESS, hv.set_memory_limit(4, 0, HALBackpressurePolicies::HAL_BACKPRESSURE_ERROR));
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+  for (int64_t i = 0; i < 4; i++) {
+    EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+  }
+  GObject *node = new GObject(counter);
+  EXPECT_EQ(HAL_OVER_MEMORY_LIMIT, hv.add_node(node));
+  EXPECT_EQ(4, hv.get_hazard_waiting_count());
+  hv.release(handle);
+  // forced retire makes room
+  EXPECT_EQ(HAL_SUCCESS, hv.add_node(node));
+  EXPECT_EQ(1, hv.get_hazard_waiting_count());
+  hv.retire();
+  EXPECT_EQ(0, counter);
+
+  // byte budget and callback policy, node is taken anyway
+  int64_t callback_count = 0;
+  EXPECT_EQ(HAL_SUCCESS, hv.set_memory_limit(0, 2 * sizeof(PlainObject),
+        HALBackpressurePolicies::HAL_BACKPRESSURE_CALLBACK, count_backpressure, &callback_count));
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+  for (int64_t i = 0; i < 3; i++) {
+    EXPECT_EQ(HAL_SUCCESS, hv.add_object(new PlainObject(counter)));
+  }
+  EXPECT_EQ(1, callback_count);
+  EXPECT_EQ((int64_t)(3 * sizeof(PlainObject)), hv.get_hazard_waiting_bytes());
+
+  // spin policy can not wait inside the critical section of the caller
+  EXPECT_EQ(HAL_SUCCESS, hv.set_memory_limit(2, 0, HALBackpressurePolicies::HAL_BACKPRESSURE_SPIN));
+  node = new GObject(counter);
+  EXPECT_EQ(HAL_OVER_MEMORY_LIMIT, hv.add_node(node));
+  hv.release(handle);
+  hv.retire();
+  EXPECT_EQ(0, hv.get_hazard_waiting_bytes());
+
+  // spin policy waits for the reader of another thread
+  HoldTask task = {&hv, false};
+  pthread_t pd;
+  pthread_create(&pd, NULL, hold_version_func, &task);
+  while (!ATOMIC_LOAD(&task.acquired)) {
+    usleep(100);
+  }
+  EXPECT_EQ(HAL_SUCCESS, hv.add_node(node));
+  EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+  EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+  EXPECT_GE(2, hv.get_hazard_waiting_count());
+  pthread_join(pd, NULL);
+  hv.retire();
+  EXPECT_EQ(0, counter);
+}
+
+struct ChunkTask {
+  HALHazardVersion *hv;
+  int64_t *counter;
+  pthread_barrier_t *barrier;
+};
+
+void *chunk_thread_func(void *data) {
+  ChunkTask *task = (ChunkTask*)data;
+  // Keep all threads alive so that they hold distinct thread numbers
+  pthread_barrier_wait(task->barrier);
+  uint64_t handle = 0;
+  EXPECT_EQ(HAL_SUCCESS, task->hv->acquire(handle));
+  EXPECT_EQ(HAL_SUCCESS, task->hv->add_node(new GObject(*task->counter)));
+  task->hv->release(handle);
+  pthread_barrier_wait(task->barrier);
+  return NULL;
+}
+
+TEST(HALHazardVersion, lazy_chunk) {
+  // ThreadStores are allocated on demand, an idle instance stays small
+  EXPECT_GT(16384UL, sizeof(HALHazardVersion));
+
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  const int64_t thread_count = 40;
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, (unsigned)thread_count);
+  ChunkTask task = {&hv, &counter, &barrier};
+  pthread_t pds[thread_count];
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&pds[i], NULL, chunk_thread_func, &task);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(pds[i], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+  hv.retire();
+  EXPECT_EQ(0, counter);
+}
+
+struct SweepTask {
+  HALHazardVersion *hv;
+  bool stop;
+};
+
+void *sweep_thread_func(void *data) {
+  SweepTask *task = (SweepTask*)data;
+  while (!ATOMIC_LOAD(&task->stop)) {
+    task->hv->retire();
+  }
+  return NULL;
+}
+
+TEST(HALHazardVersion, concurrent_sweep) {
+  // Chunks fill up and get linked while another thread sweeps them
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  SweepTask task = {&hv, false};
+  pthread_t pd;
+  pthread_create(&pd, NULL, sweep_thread_func, &task);
+  for (int64_t i = 0; i < 1000000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+  }
+  ATOMIC_STORE(&task.stop, true);
+  pthread_join(pd, NULL);
+  hv.retire();
+  EXPECT_EQ(0, counter);
+  EXPECT_EQ(0, hv.get_hazard_waiting_count());
 }
 
 struct GConf {
@@ -142,6 +455,100 @@ void *debug_thread_func(void *data) {
   return NULL;
 }
 
+TEST(HALHazardVersion, asymmetric_fence) {
+  int64_t counter = 0;
+  {
+    HALHazardVersion hv;
+    EXPECT_EQ(HAL_SUCCESS, hv.enable_asymmetric_fence());
+    uint64_t handle = 0;
+    EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+    EXPECT_EQ(HAL_EBUSY, hv.enable_asymmetric_fence());
+    EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+    hv.retire();
+    EXPECT_EQ(1, counter);
+    hv.release(handle);
+    hv.retire();
+    EXPECT_EQ(0, counter);
+  }
+
+  GConf g_conf;
+  g_conf.stop = false;
+  g_conf.counter = 0;
+  g_conf.read_loops = 1000000;
+  g_conf.write_loops = 1000000;
+  EXPECT_EQ(HAL_SUCCESS, g_conf.hv.enable_asymmetric_fence());
+  g_conf.v = new GObject(g_conf.counter);
+  pthread_t rpd[2];
+  pthread_t wpd[2];
+  for (int64_t i = 0; i < 2; i++) {
+    pthread_create(&rpd[i], NULL, read_thread_func, &g_conf);
+    pthread_create(&wpd[i], NULL, write_thread_func, &g_conf);
+  }
+  for (int64_t i = 0; i < 2; i++) {
+    pthread_join(rpd[i], NULL);
+    pthread_join(wpd[i], NULL);
+  }
+  g_conf.v->retire();
+  g_conf.hv.retire();
+  EXPECT_EQ(0, g_conf.counter);
+}
+
+TEST(HALHazardVersion, lazy_version) {
+  int64_t counter = 0;
+  {
+    HALHazardVersion hv;
+    EXPECT_EQ(HAL_SUCCESS, hv.enable_lazy_version());
+    // version is only advanced by retire, nodes added since the last retire are
+    // pinned by a reader acquiring before the next one
+    uint64_t handle = 0;
+    EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+    EXPECT_EQ(HAL_EBUSY, hv.enable_lazy_version());
+    for (int64_t i = 0; i < 32; i++) {
+      EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+    }
+    hv.retire();
+    EXPECT_EQ(32, counter);
+    hv.release(handle);
+    hv.retire();
+    EXPECT_EQ(0, counter);
+
+    for (int64_t i = 0; i < 32; i++) {
+      EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+    }
+    hv.retire();
+    EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+    for (int64_t i = 0; i < 32; i++) {
+      EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(counter)));
+    }
+    hv.retire();
+    EXPECT_EQ(32, counter);
+    hv.release(handle);
+    hv.retire();
+    EXPECT_EQ(0, counter);
+  }
+
+  GConf g_conf;
+  g_conf.stop = false;
+  g_conf.counter = 0;
+  g_conf.read_loops = 1000000;
+  g_conf.write_loops = 1000000;
+  EXPECT_EQ(HAL_SUCCESS, g_conf.hv.enable_lazy_version());
+  g_conf.v = new GObject(g_conf.counter);
+  pthread_t rpd[2];
+  pthread_t wpd[2];
+  for (int64_t i = 0; i < 2; i++) {
+    pthread_create(&rpd[i], NULL, read_thread_func, &g_conf);
+    pthread_create(&wpd[i], NULL, write_thread_func, &g_conf);
+  }
+  for (int64_t i = 0; i < 2; i++) {
+    pthread_join(rpd[i], NULL);
+    pthread_join(wpd[i], NULL);
+  }
+  g_conf.v->retire();
+  g_conf.hv.retire();
+  EXPECT_EQ(0, g_conf.counter);
+}
+
 TEST(HALHazardVersion, cc) {
   int64_t cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
   int64_t read_count = (cpu_count + 1) / 2;
@@ -1,6 +1,15 @@
-./hv_sample_$1.bin 2
-./hv_sample_$1.bin 4
-./hv_sample_$1.bin 6
-./hv_sample_$1.bin 8
-./hv_sample_$1.bin 10
-./hv_sample_$1.bin 12
+# usage: ./test_hv_perf.sh fifo|lifo|retire|hashmap|skiplist|rcu [thread counts] [hv|ebr|stack|elimination of lifo, batch size|hv|lazy|ebr of fifo, read percent of hashmap/skiplist, rcu|locked of rcu]
+# e.g.   ./test_hv_perf.sh retire "1 2 4 8 16 32 64 128 256 512"
+#        ./test_hv_perf.sh lifo "2 4 6 8 10 12" ebr
+#        ./test_hv_perf.sh lifo "2 4 6 8 10 12" stack
+#        ./test_hv_perf.sh lifo "2 4 6 8 10 12" elimination
+#        ./test_hv_perf.sh fifo "2 4 6 8 10 12" 16
+#        ./test_hv_perf.sh fifo "2 4 6 8 10 12" ebr
+#        ./test_hv_perf.sh fifo "12 16 24" lazy
+#        ./test_hv_perf.sh hashmap "1 2 4 8 16" 90
+#        ./test_hv_perf.sh skiplist "1 2 4 8 16" 90
+#        ./test_hv_perf.sh rcu "1 2 4 8 16" locked
+THREADS=${2:-"2 4 6 8 10 12"}
+for t in $THREADS; do
+  ./hv_sample_$1.bin $t $3
+done
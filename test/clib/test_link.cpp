@@ -0,0 +1,121 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include "clib/hal_error.h"
+#include "clib/hal_cache.h"
+#include "clib/hal_epoch_reclaim.h"
+#include "clib/hal_hash_map.h"
+#include "clib/hal_hazard_pointer.h"
+#include "clib/hal_hazard_version.h"
+#include "clib/hal_linked_queue.h"
+#include "clib/hal_rcu_ptr.h"
+#include "clib/hal_skip_list.h"
+#include "clib/hal_stack.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+// Defined in test_link_other.cpp
+int other_add_node(HALHazardVersion &hv, HALHazardNodeI *node);
+int other_add_node(HALEpochReclaim &er, HALHazardNodeI *node);
+int other_add_node(HALHazardPointer &hp, HALHazardNodeI *node);
+int other_push(HALLinkedQueue<int64_t> &queue, const int64_t v);
+int other_push(HALStack<int64_t> &stack, const int64_t v);
+int other_put(HALHashMap<int64_t, int64_t> &map, const int64_t key, const int64_t value);
+int other_insert(HALSkipList<int64_t, int64_t> &list, const int64_t key, const int64_t value);
+int other_update(HALRcuPtr<int64_t> &rcu, const int64_t v);
+int other_put(HALCache<int64_t, int64_t> &cache, const int64_t key, const int64_t value);
+
+class GObject: public HALHazardNodeI {
+  public:
+    GObject(int64_t &counter) : counter_(counter) {
+      counter_++;
+    }
+    virtual void retire() {
+      counter_--;
+    }
+  private:
+    int64_t &counter_;
+};
+
+TEST(HALLink, hazard_version) {
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  GObject obj(counter);
+  EXPECT_EQ(HAL_SUCCESS, other_add_node(hv, &obj));
+  hv.retire();
+  EXPECT_EQ(0, counter);
+}
+
+TEST(HALLink, epoch_reclaim) {
+  HALEpochReclaim er;
+  int64_t counter = 0;
+  GObject obj(counter);
+  EXPECT_EQ(HAL_SUCCESS, other_add_node(er, &obj));
+  er.retire();
+  er.retire();
+  EXPECT_EQ(0, counter);
+}
+
+TEST(HALLink, hazard_pointer) {
+  HALHazardPointer hp;
+  int64_t counter = 0;
+  GObject obj(counter);
+  EXPECT_EQ(HAL_SUCCESS, other_add_node(hp, &obj));
+  hp.retire();
+  EXPECT_EQ(0, counter);
+}
+
+TEST(HALLink, linked_queue) {
+  HALLinkedQueue<int64_t> queue;
+  int64_t v = 0;
+  EXPECT_EQ(HAL_SUCCESS, other_push(queue, 1));
+  EXPECT_EQ(HAL_SUCCESS, queue.pop(v));
+  EXPECT_EQ(1, v);
+}
+
+TEST(HALLink, stack) {
+  HALStack<int64_t> stack;
+  int64_t v = 0;
+  EXPECT_EQ(HAL_SUCCESS, other_push(stack, 1));
+  EXPECT_EQ(HAL_SUCCESS, stack.pop(v));
+  EXPECT_EQ(1, v);
+}
+
+TEST(HALLink, hash_map) {
+  HALHashMap<int64_t, int64_t> map;
+  int64_t v = 0;
+  EXPECT_EQ(HAL_SUCCESS, other_put(map, 1, 2));
+  EXPECT_EQ(HAL_SUCCESS, map.get(1, v));
+  EXPECT_EQ(2, v);
+}
+
+TEST(HALLink, skip_list) {
+  HALSkipList<int64_t, int64_t> list;
+  int64_t v = 0;
+  EXPECT_EQ(HAL_SUCCESS, other_insert(list, 1, 2));
+  EXPECT_EQ(HAL_SUCCESS, list.get(1, v));
+  EXPECT_EQ(2, v);
+}
+
+TEST(HALLink, rcu_ptr) {
+  HALRcuPtr<int64_t> rcu;
+  EXPECT_EQ(HAL_SUCCESS, other_update(rcu, 1));
+  HALRcuPtr<int64_t>::ReadGuard guard;
+  EXPECT_EQ(HAL_SUCCESS, rcu.read(guard));
+  EXPECT_EQ(1, *guard);
+}
+
+TEST(HALLink, cache) {
+  HALCache<int64_t, int64_t> cache(1 << 20);
+  int64_t v = 0;
+  EXPECT_EQ(HAL_SUCCESS, other_put(cache, 1, 2));
+  EXPECT_EQ(HAL_SUCCESS, cache.get(1, v));
+  EXPECT_EQ(2, v);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
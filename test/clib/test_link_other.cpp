@@ -0,0 +1,55 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+// Second translation unit of test_link.bin, every header included by both
+// units has to link without multiple definitions.
+
+#include "clib/hal_error.h"
+#include "clib/hal_cache.h"
+#include "clib/hal_epoch_reclaim.h"
+#include "clib/hal_hash_map.h"
+#include "clib/hal_hazard_pointer.h"
+#include "clib/hal_hazard_version.h"
+#include "clib/hal_linked_queue.h"
+#include "clib/hal_rcu_ptr.h"
+#include "clib/hal_skip_list.h"
+#include "clib/hal_stack.h"
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+int other_add_node(HALHazardVersion &hv, HALHazardNodeI *node) {
+  return hv.add_node(node);
+}
+
+int other_add_node(HALEpochReclaim &er, HALHazardNodeI *node) {
+  return er.add_node(node);
+}
+
+int other_add_node(HALHazardPointer &hp, HALHazardNodeI *node) {
+  return hp.add_node(node);
+}
+
+int other_push(HALLinkedQueue<int64_t> &queue, const int64_t v) {
+  return queue.push(v);
+}
+
+int other_push(HALStack<int64_t> &stack, const int64_t v) {
+  return stack.push(v);
+}
+
+int other_put(HALHashMap<int64_t, int64_t> &map, const int64_t key, const int64_t value) {
+  return map.put(key, value);
+}
+
+int other_insert(HALSkipList<int64_t, int64_t> &list, const int64_t key, const int64_t value) {
+  return list.insert(key, value);
+}
+
+int other_update(HALRcuPtr<int64_t> &rcu, const int64_t v) {
+  return rcu.update(new int64_t(v));
+}
+
+int other_put(HALCache<int64_t, int64_t> &cache, const int64_t key, const int64_t value) {
+  return cache.put(key, value);
+}
@@ -0,0 +1,204 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include <memory>
+#include "clib/hal_error.h"
+#include "clib/hal_linked_queue.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+TEST(HALLinkedQueue, simple) {
+  HALLinkedQueue<int64_t> queue;
+  int64_t v = 0;
+  EXPECT_EQ(HAL_QUEUE_EMPTY, queue.pop(v));
+  for (int64_t i = 0; i < 1000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, queue.push(i));
+  }
+  for (int64_t i = 0; i < 1000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, queue.pop(v));
+    EXPECT_EQ(i, v);
+  }
+  EXPECT_EQ(HAL_QUEUE_EMPTY, queue.pop(v));
+}
+
+TEST(HALLinkedQueue, batch) {
+  HALLinkedQueue<int64_t> queue;
+  int64_t datas[64];
+  for (int64_t i = 0; i < 64; i++) {
+    datas[i] = i;
+  }
+  EXPECT_EQ(HAL_INVALID_PARAM, queue.push_batch(NULL, 1));
+  EXPECT_EQ(HAL_INVALID_PARAM, queue.push_batch(datas, 0));
+  EXPECT_EQ(HAL_SUCCESS, queue.push(-1));
+  EXPECT_EQ(HAL_SUCCESS, queue.push_batch(datas, 64));
+  EXPECT_EQ(HAL_SUCCESS, queue.push(64));
+
+  int64_t v = 0;
+  for (int64_t i = -1; i <= 64; i++) {
+    EXPECT_EQ(HAL_SUCCESS, queue.pop(v));
+    EXPECT_EQ(i, v);
+  }
+  EXPECT_EQ(HAL_QUEUE_EMPTY, queue.pop(v));
+}
+
+TEST(HALLinkedQueue, move_only) {
+  HALLinkedQueue<std::unique_ptr<int64_t> > queue;
+  for (int64_t i = 0; i < 10; i++) {
+    std::unique_ptr<int64_t> ptr(new int64_t(i));
+    EXPECT_EQ(HAL_SUCCESS, queue.push(std::move(ptr)));
+    EXPECT_TRUE(NULL == ptr.get());
+  }
+  std::unique_ptr<int64_t> ptr;
+  for (int64_t i = 0; i < 5; i++) {
+    EXPECT_EQ(HAL_SUCCESS, queue.pop(ptr));
+    EXPECT_EQ(i, *ptr);
+  }
+  // the rest are released by the destructor of queue
+}
+
+struct Counted {
+  static int64_t alive;
+  int64_t v;
+  Counted(const int64_t value = 0) : v(value) { __sync_add_and_fetch(&alive, 1); }
+  Counted(const Counted &other) : v(other.v) { __sync_add_and_fetch(&alive, 1); }
+  ~Counted() { __sync_add_and_fetch(&alive, -1); }
+  Counted &operator =(const Counted &other) { v = other.v; return *this; }
+};
+int64_t Counted::alive = 0;
+
+TEST(HALLinkedQueue, destruct) {
+  {
+    HALLinkedQueue<Counted> queue;
+    Counted c;
+    for (int64_t i = 0; i < 100; i++) {
+      EXPECT_EQ(HAL_SUCCESS, queue.push(Counted(i)));
+    }
+    EXPECT_EQ(101, Counted::alive);
+    for (int64_t i = 0; i < 50; i++) {
+      EXPECT_EQ(HAL_SUCCESS, queue.pop(c));
+      EXPECT_EQ(i, c.v);
+    }
+    EXPECT_EQ(51, Counted::alive);
+  }
+  EXPECT_EQ(0, Counted::alive);
+}
+
+TEST(HALLinkedQueue, node_cache) {
+  HALLinkedQueue<int64_t> queue(16);
+  int64_t v = 0;
+  for (int64_t i = 0; i < 100; i++) {
+    EXPECT_EQ(HAL_SUCCESS, queue.push(i));
+  }
+  for (int64_t i = 0; i < 100; i++) {
+    EXPECT_EQ(HAL_SUCCESS, queue.pop(v));
+  }
+  // pops only retire, nodes come back once the cached min version expires
+  EXPECT_GE(16, queue.get_cached_count());
+  usleep(300000);
+  EXPECT_EQ(HAL_SUCCESS, queue.push(100));
+  int64_t cached_count = queue.get_cached_count();
+  EXPECT_LT(0, cached_count);
+  EXPECT_GE(16, cached_count);
+  // pushes take nodes from the cache first
+  EXPECT_EQ(HAL_SUCCESS, queue.push(101));
+  EXPECT_EQ(cached_count - 1, queue.get_cached_count());
+  for (int64_t i = 100; i < 102; i++) {
+    EXPECT_EQ(HAL_SUCCESS, queue.pop(v));
+    EXPECT_EQ(i, v);
+  }
+}
+
+struct QueueValue {
+  int64_t producer;
+  int64_t seq;
+};
+
+struct GConf {
+  HALLinkedQueue<QueueValue> queue;
+  int64_t loop_times;
+  int64_t producer_count;
+  int64_t running_producers;
+  int64_t pop_count;
+  int64_t seq_sum;
+};
+
+void *thread_producer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t producer = __sync_fetch_and_add(&g_conf->producer_count, 1);
+  QueueValue values[8];
+  for (int64_t i = 0; i < g_conf->loop_times; ) {
+    if (0 == i % 3 && i + 8 <= g_conf->loop_times) {
+      for (int64_t j = 0; j < 8; j++) {
+        values[j].producer = producer;
+        values[j].seq = i + j;
+      }
+      EXPECT_EQ(HAL_SUCCESS, g_conf->queue.push_batch(values, 8));
+      i += 8;
+    } else {
+      values[0].producer = producer;
+      values[0].seq = i;
+      EXPECT_EQ(HAL_SUCCESS, g_conf->queue.push(values[0]));
+      i += 1;
+    }
+  }
+  __sync_add_and_fetch(&g_conf->running_producers, -1);
+  return NULL;
+}
+
+void *thread_consumer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t last_seq[16];
+  for (int64_t i = 0; i < 16; i++) {
+    last_seq[i] = -1;
+  }
+  QueueValue value;
+  bool skip = false;
+  while (true) {
+    if (HAL_SUCCESS == g_conf->queue.pop(value)) {
+      // elements of one producer are seen in push order by every consumer
+      EXPECT_LT(last_seq[value.producer], value.seq);
+      last_seq[value.producer] = value.seq;
+      __sync_add_and_fetch(&g_conf->pop_count, 1);
+      __sync_add_and_fetch(&g_conf->seq_sum, value.seq);
+      skip = false;
+    } else if (0 == ATOMIC_LOAD(&g_conf->running_producers)) {
+      if (skip) {
+        break;
+      }
+      skip = true;
+    }
+  }
+  return NULL;
+}
+
+TEST(HALLinkedQueue, mpmc) {
+  const int64_t thread_count = 4;
+  GConf g_conf;
+  g_conf.loop_times = 100000;
+  g_conf.producer_count = 0;
+  g_conf.running_producers = thread_count;
+  g_conf.pop_count = 0;
+  g_conf.seq_sum = 0;
+
+  pthread_t ppd[thread_count];
+  pthread_t cpd[thread_count];
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&ppd[i], NULL, thread_producer, &g_conf);
+    pthread_create(&cpd[i], NULL, thread_consumer, &g_conf);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(ppd[i], NULL);
+    pthread_join(cpd[i], NULL);
+  }
+  EXPECT_EQ(thread_count * g_conf.loop_times, g_conf.pop_count);
+  EXPECT_EQ(thread_count * (g_conf.loop_times - 1) * g_conf.loop_times / 2, g_conf.seq_sum);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
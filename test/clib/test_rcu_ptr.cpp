@@ -0,0 +1,124 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include "clib/hal_error.h"
+#include "clib/hal_rcu_ptr.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+struct Config {
+  static int64_t alive;
+  int64_t version;
+  int64_t check;
+  Config(const int64_t v) : version(v), check(v * 2) { __sync_add_and_fetch(&alive, 1); }
+  ~Config() { __sync_add_and_fetch(&alive, -1); }
+};
+int64_t Config::alive = 0;
+
+TEST(HALRcuPtr, simple) {
+  {
+    HALRcuPtr<Config> ptr;
+    HALRcuPtr<Config>::ReadGuard guard;
+    EXPECT_EQ(HAL_SUCCESS, ptr.read(guard));
+    EXPECT_TRUE(NULL == guard.get());
+    guard.reset();
+
+    EXPECT_EQ(HAL_SUCCESS, ptr.update(new Config(1)));
+    EXPECT_EQ(HAL_SUCCESS, ptr.read(guard));
+    EXPECT_EQ(1, guard->version);
+    EXPECT_EQ(2, (*guard).check);
+    // read again moves guard to the latest object
+    EXPECT_EQ(HAL_SUCCESS, ptr.update(new Config(2)));
+    EXPECT_EQ(HAL_SUCCESS, ptr.read(guard));
+    EXPECT_EQ(2, guard->version);
+    guard.reset();
+
+    EXPECT_EQ(HAL_SUCCESS, ptr.update(NULL));
+    EXPECT_EQ(HAL_SUCCESS, ptr.read(guard));
+    EXPECT_TRUE(NULL == guard.get());
+    guard.reset();
+    EXPECT_EQ(HAL_SUCCESS, ptr.update(new Config(3)));
+  }
+  EXPECT_EQ(0, Config::alive);
+}
+
+TEST(HALRcuPtr, retire) {
+  {
+    HALRcuPtr<Config> ptr(new Config(1), false);
+    HALRcuPtr<Config>::ReadGuard guard;
+    EXPECT_EQ(HAL_SUCCESS, ptr.read(guard));
+    const Config *first = guard.get();
+    EXPECT_EQ(HAL_SUCCESS, ptr.update(new Config(2)));
+    EXPECT_EQ(HAL_SUCCESS, ptr.update(new Config(3)));
+    // both retired ones may still be seen by guard
+    EXPECT_EQ(1, first->version);
+    EXPECT_EQ(3, Config::alive);
+    guard.reset();
+    // the next update reclaims all of them
+    EXPECT_EQ(HAL_SUCCESS, ptr.update(new Config(4)));
+    EXPECT_EQ(1, Config::alive);
+  }
+  EXPECT_EQ(0, Config::alive);
+}
+
+struct GConf {
+  HALRcuPtr<Config> ptr;
+  int64_t loop_times;
+  int64_t running_writers;
+  GConf() : ptr(new Config(0)) {}
+};
+
+void *thread_writer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+    EXPECT_EQ(HAL_SUCCESS, g_conf->ptr.update(new Config(i)));
+  }
+  __sync_add_and_fetch(&g_conf->running_writers, -1);
+  return NULL;
+}
+
+void *thread_reader(void *data) {
+  GConf *g_conf = (GConf*)data;
+  while (0 < ATOMIC_LOAD(&g_conf->running_writers)) {
+    HALRcuPtr<Config>::ReadGuard guard;
+    EXPECT_EQ(HAL_SUCCESS, g_conf->ptr.read(guard));
+    EXPECT_TRUE(NULL != guard.get());
+    // a retired object is never deleted under a reader
+    if (NULL != guard.get()) {
+      EXPECT_EQ(guard->version * 2, guard->check);
+    }
+  }
+  return NULL;
+}
+
+TEST(HALRcuPtr, concurrent) {
+  const int64_t thread_count = 4;
+  {
+    GConf g_conf;
+    g_conf.loop_times = 10000;
+    g_conf.running_writers = thread_count;
+
+    pthread_t wpd[thread_count];
+    pthread_t rpd[thread_count];
+    for (int64_t i = 0; i < thread_count; i++) {
+      pthread_create(&wpd[i], NULL, thread_writer, &g_conf);
+      pthread_create(&rpd[i], NULL, thread_reader, &g_conf);
+    }
+    for (int64_t i = 0; i < thread_count; i++) {
+      pthread_join(wpd[i], NULL);
+      pthread_join(rpd[i], NULL);
+    }
+    HALRcuPtr<Config>::ReadGuard guard;
+    EXPECT_EQ(HAL_SUCCESS, g_conf.ptr.read(guard));
+    EXPECT_EQ(g_conf.loop_times - 1, guard->version);
+  }
+  EXPECT_EQ(0, Config::alive);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,150 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include "clib/hal_error.h"
+#include "clib/hal_retire_pool.h"
+#include "clib/hal_hazard_version.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+struct RetireRecord {
+  int64_t counter;
+  int64_t retire_tid;
+};
+
+void record_retire(void *ptr, void *arg) {
+  RetireRecord *record = (RetireRecord*)arg;
+  ATOMIC_STORE(&record->retire_tid, clib::gettid());
+  __sync_add_and_fetch(&record->counter, -1);
+  delete (int64_t*)ptr;
+}
+
+HALRetireBatch *make_batch(RetireRecord &record, const int64_t count) {
+  HALRetireBatch *batch = HALRetireBatch::alloc();
+  for (int64_t i = 0; i < count; i++) {
+    __sync_add_and_fetch(&record.counter, 1);
+    HALRetireBatch::Item &item = batch->items_[batch->count_++];
+    item.ptr_ = new int64_t(i);
+    item.retire_func_ = record_retire;
+    item.arg_ = &record;
+  }
+  return batch;
+}
+
+TEST(HALRetirePool, simple) {
+  HALRetirePool pool(2);
+  RetireRecord record = {0, 0};
+
+  HALRetireBatch *batch = make_batch(record, 8);
+  EXPECT_EQ(HAL_INVALID_PARAM, pool.execute(NULL));
+  EXPECT_EQ(HAL_ERROR, pool.execute(batch));
+  EXPECT_EQ(HAL_INVALID_PARAM, pool.start(0));
+  EXPECT_EQ(HAL_SUCCESS, pool.start(2));
+  EXPECT_EQ(HAL_INIT_REPETITIVE, pool.start(2));
+
+  EXPECT_EQ(HAL_SUCCESS, pool.execute(batch));
+  for (int64_t i = 0; i < 1000 && 0 != ATOMIC_LOAD(&record.counter); i++) {
+    usleep(1000);
+  }
+  EXPECT_EQ(0, ATOMIC_LOAD(&record.counter));
+  EXPECT_NE(clib::gettid(), ATOMIC_LOAD(&record.retire_tid));
+
+  // queued batches are run by stop
+  for (int64_t i = 0; i < 2; i++) {
+    EXPECT_EQ(HAL_SUCCESS, pool.execute(make_batch(record, 8)));
+  }
+  pool.stop();
+  EXPECT_EQ(0, record.counter);
+  EXPECT_EQ(0, pool.get_queued_count());
+}
+
+class GObject : public HALHazardNodeI {
+  public:
+    GObject(RetireRecord &record) : record_(record) {
+      __sync_add_and_fetch(&record_.counter, 1);
+    }
+    virtual void retire() {
+      ATOMIC_STORE(&record_.retire_tid, clib::gettid());
+      __sync_add_and_fetch(&record_.counter, -1);
+      delete this;
+    }
+  private:
+    RetireRecord &record_;
+};
+
+TEST(HALRetirePool, hazard_version) {
+  HALRetirePool pool(4);
+  EXPECT_EQ(HAL_SUCCESS, pool.start(1));
+  HALHazardVersion hv;
+  hv.set_retire_executor(&pool);
+  RetireRecord record = {0, 0};
+
+  uint64_t handle = 0;
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+  for (int64_t i = 0; i < 1000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(record)));
+  }
+  hv.release(handle);
+  hv.retire();
+  pool.stop();
+  EXPECT_EQ(0, hv.get_hazard_waiting_count());
+  EXPECT_EQ(0, record.counter);
+  EXPECT_NE(clib::gettid(), record.retire_tid);
+
+  // the stopped pool refuses batches, they run inline
+  EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(record)));
+  hv.retire();
+  EXPECT_EQ(0, record.counter);
+  EXPECT_EQ(clib::gettid(), record.retire_tid);
+  hv.set_retire_executor(NULL);
+}
+
+// Keeps the batches until the test runs them
+class HoldExecutor : public IHALRetireExecutor {
+  public:
+    HoldExecutor() : count_(0) {}
+    int execute(HALRetireBatch *batch) {
+      batches_[count_++] = batch;
+      return HAL_SUCCESS;
+    }
+    void run_all() {
+      for (int64_t i = 0; i < count_; i++) {
+        batches_[i]->run();
+        HALRetireBatch::free(batches_[i]);
+      }
+      count_ = 0;
+    }
+  private:
+    HALRetireBatch *batches_[16];
+    int64_t count_;
+};
+
+TEST(HALRetirePool, waiting_until_run) {
+  HoldExecutor executor;
+  HALHazardVersion hv;
+  hv.set_retire_executor(&executor);
+  RetireRecord record = {0, 0};
+
+  for (int64_t i = 0; i < 1000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, hv.add_node(new GObject(record), 100));
+  }
+  hv.retire();
+  // swept but not run yet, still counted against the memory limit
+  EXPECT_EQ(1000, record.counter);
+  EXPECT_EQ(1000, hv.get_hazard_waiting_count());
+  EXPECT_EQ(100000, hv.get_hazard_waiting_bytes());
+  executor.run_all();
+  EXPECT_EQ(0, record.counter);
+  EXPECT_EQ(0, hv.get_hazard_waiting_count());
+  EXPECT_EQ(0, hv.get_hazard_waiting_bytes());
+  hv.set_retire_executor(NULL);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
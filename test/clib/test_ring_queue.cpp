@@ -0,0 +1,271 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <string>
+#include "clib/hal_error.h"
+#include "clib/hal_ring_queue.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+TEST(HALRingQueue, simple) {
+  // rounded up to 8
+  HALRingQueue<int64_t> queue(5);
+  int64_t v = 0;
+  EXPECT_EQ(HAL_QUEUE_EMPTY, queue.pop(v));
+  for (int64_t round = 0; round < 3; round++) {
+    for (int64_t i = 0; i < 8; i++) {
+      EXPECT_EQ(HAL_SUCCESS, queue.push(i));
+    }
+    EXPECT_EQ(HAL_QUEUE_FULL, queue.push(8));
+    EXPECT_EQ(8, queue.size());
+    for (int64_t i = 0; i < 8; i++) {
+      EXPECT_EQ(HAL_SUCCESS, queue.pop(v));
+      EXPECT_EQ(i, v);
+    }
+    EXPECT_EQ(HAL_QUEUE_EMPTY, queue.pop(v));
+    EXPECT_EQ(0, queue.size());
+  }
+}
+
+TEST(HALRingQueue, batch) {
+  HALRingQueue<int64_t> queue(16);
+  int64_t datas[32];
+  for (int64_t i = 0; i < 32; i++) {
+    datas[i] = i;
+  }
+  int64_t count = 0;
+  EXPECT_EQ(HAL_INVALID_PARAM, queue.push_n(NULL, 1, count));
+  EXPECT_EQ(HAL_INVALID_PARAM, queue.push_n(datas, 0, count));
+  EXPECT_EQ(HAL_QUEUE_EMPTY, queue.pop_n(datas, 8, count));
+  EXPECT_EQ(0, count);
+  // only the free slots are taken
+  EXPECT_EQ(HAL_SUCCESS, queue.push_n(datas, 10, count));
+  EXPECT_EQ(10, count);
+  EXPECT_EQ(HAL_SUCCESS, queue.push_n(datas + 10, 10, count));
+  EXPECT_EQ(6, count);
+  EXPECT_EQ(HAL_QUEUE_FULL, queue.push_n(datas, 1, count));
+  EXPECT_EQ(0, count);
+
+  int64_t values[32];
+  EXPECT_EQ(HAL_SUCCESS, queue.pop_n(values, 4, count));
+  EXPECT_EQ(4, count);
+  EXPECT_EQ(HAL_SUCCESS, queue.pop_n(values + 4, 32, count));
+  EXPECT_EQ(12, count);
+  for (int64_t i = 0; i < 16; i++) {
+    EXPECT_EQ(i, values[i]);
+  }
+  EXPECT_EQ(HAL_QUEUE_EMPTY, queue.pop_n(values, 32, count));
+}
+
+struct Counted {
+  static int64_t live;
+  std::string s;
+  Counted() : s(100, 'x') { __sync_add_and_fetch(&live, 1); }
+  Counted(const Counted &o) : s(o.s) { __sync_add_and_fetch(&live, 1); }
+  ~Counted() { __sync_add_and_fetch(&live, -1); }
+  Counted &operator =(const Counted &o) { s = o.s; return *this; }
+};
+int64_t Counted::live = 0;
+
+TEST(HALRingQueue, destruct) {
+  {
+    Counted c;
+    HALRingQueue<Counted> queue(8);
+    for (int64_t i = 0; i < 6; i++) {
+      EXPECT_EQ(HAL_SUCCESS, queue.push(c));
+    }
+    EXPECT_EQ(7, Counted::live);
+    Counted v;
+    EXPECT_EQ(HAL_SUCCESS, queue.pop(v));
+    EXPECT_EQ(c.s, v.s);
+    EXPECT_EQ(7, Counted::live);
+  }
+  // the other 5 are destructed by the queue
+  EXPECT_EQ(0, Counted::live);
+}
+
+struct FullConf {
+  HALRingQueue<int64_t> queue;
+  pthread_barrier_t barrier;
+  int64_t push_count;
+  FullConf() : queue(4), push_count(0) {}
+};
+
+void *thread_push_full(void *data) {
+  FullConf *conf = (FullConf*)data;
+  pthread_barrier_wait(&conf->barrier);
+  int ret = HAL_SUCCESS;
+  while (HAL_SUCCESS == (ret = conf->queue.push(0))) {
+    __sync_add_and_fetch(&conf->push_count, 1);
+  }
+  EXPECT_EQ(HAL_QUEUE_FULL, ret);
+  return NULL;
+}
+
+TEST(HALRingQueue, full) {
+  // Producers racing past the full check take tickets beyond the free slots
+  // and give them back, none of them waits for a consumer which never comes
+  const int64_t thread_count = 8;
+  FullConf conf;
+  pthread_barrier_init(&conf.barrier, NULL, (unsigned)thread_count);
+  for (int64_t round = 0; round < 100; round++) {
+    conf.push_count = 0;
+    pthread_t pds[thread_count];
+    for (int64_t i = 0; i < thread_count; i++) {
+      pthread_create(&pds[i], NULL, thread_push_full, &conf);
+    }
+    for (int64_t i = 0; i < thread_count; i++) {
+      pthread_join(pds[i], NULL);
+    }
+    ASSERT_EQ(4, conf.push_count);
+    EXPECT_EQ(4, conf.queue.size());
+    int64_t v = 0;
+    int64_t count = 0;
+    EXPECT_EQ(HAL_QUEUE_FULL, conf.queue.push(v));
+    EXPECT_EQ(HAL_QUEUE_FULL, conf.queue.push_n(&v, 1, count));
+    for (int64_t i = 0; i < 4; i++) {
+      EXPECT_EQ(HAL_SUCCESS, conf.queue.pop(v));
+    }
+    EXPECT_EQ(HAL_QUEUE_EMPTY, conf.queue.pop(v));
+  }
+  pthread_barrier_destroy(&conf.barrier);
+}
+
+struct QueueValue {
+  int64_t producer;
+  int64_t seq;
+};
+
+struct GConf {
+  HALRingQueue<QueueValue> queue;
+  int64_t loop_times;
+  int64_t producer_count;
+  int64_t running_producers;
+  int64_t pop_count;
+  int64_t seq_sum;
+  bool slow_producer;
+  GConf() : queue(64) {}
+};
+
+void *thread_producer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t producer = __sync_fetch_and_add(&g_conf->producer_count, 1);
+  QueueValue values[8];
+  int64_t push_count = 0;
+  for (int64_t i = 0; i < g_conf->loop_times; ) {
+    if (0 == i % 3 && i + 8 <= g_conf->loop_times) {
+      for (int64_t j = 0; j < 8; j++) {
+        values[j].producer = producer;
+        values[j].seq = i + j;
+      }
+      for (int64_t j = 0; j < 8; ) {
+        if (HAL_SUCCESS == g_conf->queue.push_n(values + j, 8 - j, push_count)) {
+          j += push_count;
+        } else {
+          sched_yield();
+        }
+      }
+      i += 8;
+    } else {
+      values[0].producer = producer;
+      values[0].seq = i;
+      while (HAL_SUCCESS != g_conf->queue.push(values[0])) {
+        sched_yield();
+      }
+      i += 1;
+    }
+    if (g_conf->slow_producer) {
+      sched_yield();
+    }
+  }
+  __sync_add_and_fetch(&g_conf->running_producers, -1);
+  return NULL;
+}
+
+void *thread_consumer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t last_seq[16];
+  for (int64_t i = 0; i < 16; i++) {
+    last_seq[i] = -1;
+  }
+  QueueValue values[4];
+  int64_t pop_count = 0;
+  bool skip = false;
+  for (int64_t round = 0; ; round++) {
+    if (0 == round % 2) {
+      pop_count = (HAL_SUCCESS == g_conf->queue.pop(values[0])) ? 1 : 0;
+    } else if (HAL_SUCCESS != g_conf->queue.pop_n(values, 4, pop_count)) {
+      pop_count = 0;
+    }
+    for (int64_t i = 0; i < pop_count; i++) {
+      // elements of one producer are seen in push order by every consumer
+      EXPECT_LT(last_seq[values[i].producer], values[i].seq);
+      last_seq[values[i].producer] = values[i].seq;
+      __sync_add_and_fetch(&g_conf->pop_count, 1);
+      __sync_add_and_fetch(&g_conf->seq_sum, values[i].seq);
+    }
+    if (0 < pop_count) {
+      skip = false;
+    } else if (0 != ATOMIC_LOAD(&g_conf->running_producers)) {
+      // pop and push return at once, let the other side run on few CPUs.
+      // Consumers of a slow producer keep racing for the next ticket.
+      if (!g_conf->slow_producer || 0 == round % 64) {
+        sched_yield();
+      }
+    } else {
+      if (skip) {
+        break;
+      }
+      skip = true;
+    }
+  }
+  return NULL;
+}
+
+void run_test(const int64_t producer_count, const int64_t consumer_count, const bool slow_producer) {
+  GConf g_conf;
+  g_conf.loop_times = 100000;
+  g_conf.producer_count = 0;
+  g_conf.running_producers = producer_count;
+  g_conf.pop_count = 0;
+  g_conf.seq_sum = 0;
+  g_conf.slow_producer = slow_producer;
+
+  pthread_t ppd[producer_count];
+  pthread_t cpd[consumer_count];
+  for (int64_t i = 0; i < producer_count; i++) {
+    pthread_create(&ppd[i], NULL, thread_producer, &g_conf);
+  }
+  for (int64_t i = 0; i < consumer_count; i++) {
+    pthread_create(&cpd[i], NULL, thread_consumer, &g_conf);
+  }
+  for (int64_t i = 0; i < producer_count; i++) {
+    pthread_join(ppd[i], NULL);
+  }
+  for (int64_t i = 0; i < consumer_count; i++) {
+    pthread_join(cpd[i], NULL);
+  }
+  EXPECT_EQ(producer_count * g_conf.loop_times, g_conf.pop_count);
+  EXPECT_EQ(producer_count * (g_conf.loop_times - 1) * g_conf.loop_times / 2, g_conf.seq_sum);
+  EXPECT_EQ(0, g_conf.queue.size());
+}
+
+TEST(HALRingQueue, mpmc) {
+  // every consumer sees the elements of one producer in push order
+  run_test(4, 4, false);
+}
+
+TEST(HALRingQueue, skip) {
+  // Consumers outnumber a slow producer on a mostly empty queue, they take
+  // tickets no producer has taken and skip those slots, the producer takes
+  // other tickets then
+  run_test(1, 4, true);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
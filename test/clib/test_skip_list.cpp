@@ -0,0 +1,187 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include "clib/hal_error.h"
+#include "clib/hal_skip_list.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+TEST(HALSkipList, simple) {
+  HALSkipList<int64_t, int64_t> list;
+  int64_t v = 0;
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, list.get(1, v));
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, list.erase(1));
+  EXPECT_EQ(HAL_SUCCESS, list.insert(1, 10));
+  EXPECT_EQ(HAL_ENTRY_EXIST, list.insert(1, 11));
+  EXPECT_EQ(HAL_SUCCESS, list.get(1, v));
+  EXPECT_EQ(10, v);
+  EXPECT_EQ(1, list.size());
+  EXPECT_EQ(HAL_SUCCESS, list.erase(1));
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, list.get(1, v));
+  EXPECT_EQ(HAL_ENTRY_NOT_EXIST, list.erase(1));
+  EXPECT_EQ(0, list.size());
+}
+
+TEST(HALSkipList, order) {
+  HALSkipList<int64_t, int64_t> list;
+  // 0, 3, 6 ... inserted out of order
+  for (int64_t i = 0; i < 1000; i++) {
+    int64_t k = (i * 7919) % 1000 * 3;
+    EXPECT_EQ(HAL_SUCCESS, list.insert(k, -k));
+  }
+  HALSkipList<int64_t, int64_t>::Iterator iter;
+  EXPECT_EQ(HAL_SUCCESS, list.begin(iter));
+  for (int64_t i = 0; i < 1000; i++) {
+    ASSERT_TRUE(iter.is_valid());
+    EXPECT_EQ(i * 3, iter.get_key());
+    EXPECT_EQ(-i * 3, iter.get_value());
+    iter.next();
+  }
+  EXPECT_FALSE(iter.is_valid());
+
+  EXPECT_EQ(HAL_SUCCESS, list.lower_bound(100, iter));
+  EXPECT_EQ(102, iter.get_key());
+  EXPECT_EQ(HAL_SUCCESS, list.lower_bound(102, iter));
+  EXPECT_EQ(102, iter.get_key());
+  EXPECT_EQ(HAL_SUCCESS, list.erase(102));
+  EXPECT_EQ(HAL_SUCCESS, list.lower_bound(101, iter));
+  EXPECT_EQ(105, iter.get_key());
+  EXPECT_EQ(HAL_SUCCESS, list.lower_bound(3000, iter));
+  EXPECT_FALSE(iter.is_valid());
+  iter.reset();
+
+  // range [300, 330)
+  int64_t count = 0;
+  for (list.lower_bound(300, iter); iter.is_valid() && iter.get_key() < 330; iter.next()) {
+    count++;
+  }
+  EXPECT_EQ(10, count);
+}
+
+TEST(HALSkipList, compare) {
+  HALSkipList<int64_t, int64_t, std::greater<int64_t> > list;
+  for (int64_t i = 0; i < 100; i++) {
+    EXPECT_EQ(HAL_SUCCESS, list.insert(i, i));
+  }
+  HALSkipList<int64_t, int64_t, std::greater<int64_t> >::Iterator iter;
+  EXPECT_EQ(HAL_SUCCESS, list.lower_bound(50, iter));
+  for (int64_t i = 50; i >= 0; i--) {
+    ASSERT_TRUE(iter.is_valid());
+    EXPECT_EQ(i, iter.get_key());
+    iter.next();
+  }
+  EXPECT_FALSE(iter.is_valid());
+}
+
+class CountingAllocator : public IHALAllocator {
+  public:
+    CountingAllocator() : count_(0) {}
+    void *alloc(const int64_t size, const int mod_id) {
+      __sync_add_and_fetch(&count_, 1);
+      return hal_malloc(size, mod_id);
+    }
+    void free(void *ptr) {
+      __sync_add_and_fetch(&count_, -1);
+      hal_free(ptr);
+    }
+  public:
+    int64_t count_;
+};
+
+TEST(HALSkipList, allocator) {
+  CountingAllocator allocator;
+  {
+    HALSkipList<int64_t, int64_t> list(allocator);
+    for (int64_t i = 0; i < 100; i++) {
+      EXPECT_EQ(HAL_SUCCESS, list.insert(i, i));
+    }
+    EXPECT_EQ(100, allocator.count_);
+    for (int64_t i = 0; i < 100; i += 2) {
+      EXPECT_EQ(HAL_SUCCESS, list.erase(i));
+    }
+    EXPECT_EQ(HAL_ENTRY_EXIST, list.insert(1, 1));
+    EXPECT_GE(100, allocator.count_);
+  }
+  EXPECT_EQ(0, allocator.count_);
+}
+
+struct GConf {
+  HALSkipList<int64_t, int64_t> list;
+  int64_t key_count;
+  int64_t writer_count;
+  int64_t running_writers;
+};
+
+void *thread_writer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t writer = __sync_fetch_and_add(&g_conf->writer_count, 1);
+  // every writer races on every key, the list decides who wins
+  for (int64_t round = 0; round < 4; round++) {
+    for (int64_t i = 0; i < g_conf->key_count; i++) {
+      int64_t k = (i * 7 + writer) % g_conf->key_count;
+      int ret = g_conf->list.insert(k, k);
+      EXPECT_TRUE(HAL_SUCCESS == ret || HAL_ENTRY_EXIST == ret);
+    }
+    if (round < 3) {
+      for (int64_t i = 0; i < g_conf->key_count; i += 2) {
+        int ret = g_conf->list.erase((i + writer) % g_conf->key_count);
+        EXPECT_TRUE(HAL_SUCCESS == ret || HAL_ENTRY_NOT_EXIST == ret);
+      }
+    }
+  }
+  __sync_add_and_fetch(&g_conf->running_writers, -1);
+  return NULL;
+}
+
+void *thread_reader(void *data) {
+  GConf *g_conf = (GConf*)data;
+  while (0 < ATOMIC_LOAD(&g_conf->running_writers)) {
+    HALSkipList<int64_t, int64_t>::Iterator iter;
+    int64_t start = (int64_t)(fast_rand() % (uint64_t)g_conf->key_count);
+    EXPECT_EQ(HAL_SUCCESS, g_conf->list.lower_bound(start, iter));
+    int64_t last = start - 1;
+    for (int64_t i = 0; i < 64 && iter.is_valid(); i++, iter.next()) {
+      EXPECT_LT(last, iter.get_key());
+      EXPECT_EQ(iter.get_key(), iter.get_value());
+      last = iter.get_key();
+    }
+  }
+  return NULL;
+}
+
+TEST(HALSkipList, concurrent) {
+  const int64_t thread_count = 4;
+  GConf g_conf;
+  g_conf.key_count = 10000;
+  g_conf.writer_count = 0;
+  g_conf.running_writers = thread_count;
+
+  pthread_t wpd[thread_count];
+  pthread_t rpd[thread_count];
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&wpd[i], NULL, thread_writer, &g_conf);
+    pthread_create(&rpd[i], NULL, thread_reader, &g_conf);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(wpd[i], NULL);
+    pthread_join(rpd[i], NULL);
+  }
+  // the last round inserts every key
+  EXPECT_EQ(g_conf.key_count, g_conf.list.size());
+  HALSkipList<int64_t, int64_t>::Iterator iter;
+  EXPECT_EQ(HAL_SUCCESS, g_conf.list.begin(iter));
+  for (int64_t k = 0; k < g_conf.key_count; k++, iter.next()) {
+    ASSERT_TRUE(iter.is_valid());
+    EXPECT_EQ(k, iter.get_key());
+  }
+  EXPECT_FALSE(iter.is_valid());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,138 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <unistd.h>
+#include <memory>
+#include "clib/hal_error.h"
+#include "clib/hal_stack.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+TEST(HALStack, simple) {
+  HALStack<int64_t> stack;
+  int64_t v = 0;
+  EXPECT_EQ(HAL_QUEUE_EMPTY, stack.pop(v));
+  for (int64_t i = 0; i < 1000; i++) {
+    EXPECT_EQ(HAL_SUCCESS, stack.push(i));
+  }
+  for (int64_t i = 999; i >= 0; i--) {
+    EXPECT_EQ(HAL_SUCCESS, stack.pop(v));
+    EXPECT_EQ(i, v);
+  }
+  EXPECT_EQ(HAL_QUEUE_EMPTY, stack.pop(v));
+}
+
+TEST(HALStack, move_only) {
+  HALStack<std::unique_ptr<int64_t> > stack;
+  for (int64_t i = 0; i < 10; i++) {
+    std::unique_ptr<int64_t> ptr(new int64_t(i));
+    EXPECT_EQ(HAL_SUCCESS, stack.push(std::move(ptr)));
+    EXPECT_TRUE(NULL == ptr.get());
+  }
+  std::unique_ptr<int64_t> ptr;
+  for (int64_t i = 9; i >= 5; i--) {
+    EXPECT_EQ(HAL_SUCCESS, stack.pop(ptr));
+    EXPECT_EQ(i, *ptr);
+  }
+  // the rest are released by the destructor of stack
+}
+
+struct Counted {
+  static int64_t alive;
+  int64_t v;
+  Counted(const int64_t value = 0) : v(value) { __sync_add_and_fetch(&alive, 1); }
+  Counted(const Counted &other) : v(other.v) { __sync_add_and_fetch(&alive, 1); }
+  ~Counted() { __sync_add_and_fetch(&alive, -1); }
+  Counted &operator =(const Counted &other) { v = other.v; return *this; }
+};
+int64_t Counted::alive = 0;
+
+TEST(HALStack, destruct) {
+  {
+    HALStack<Counted> stack;
+    Counted c;
+    for (int64_t i = 0; i < 100; i++) {
+      EXPECT_EQ(HAL_SUCCESS, stack.push(Counted(i)));
+    }
+    EXPECT_EQ(101, Counted::alive);
+    for (int64_t i = 99; i >= 50; i--) {
+      EXPECT_EQ(HAL_SUCCESS, stack.pop(c));
+      EXPECT_EQ(i, c.v);
+    }
+    EXPECT_EQ(51, Counted::alive);
+  }
+  EXPECT_EQ(0, Counted::alive);
+}
+
+struct GConf {
+  GConf(const int64_t elimination_width) : stack(elimination_width) {}
+  HALStack<int64_t> stack;
+  int64_t loop_times;
+  int64_t running_producers;
+  int64_t pop_count;
+  int64_t sum;
+};
+
+void *thread_producer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  for (int64_t i = 0; i < g_conf->loop_times; i++) {
+    EXPECT_EQ(HAL_SUCCESS, g_conf->stack.push(i));
+  }
+  __sync_add_and_fetch(&g_conf->running_producers, -1);
+  return NULL;
+}
+
+void *thread_consumer(void *data) {
+  GConf *g_conf = (GConf*)data;
+  int64_t v = 0;
+  bool skip = false;
+  while (true) {
+    if (HAL_SUCCESS == g_conf->stack.pop(v)) {
+      __sync_add_and_fetch(&g_conf->pop_count, 1);
+      __sync_add_and_fetch(&g_conf->sum, v);
+      skip = false;
+    } else if (0 == ATOMIC_LOAD(&g_conf->running_producers)) {
+      if (skip) {
+        break;
+      }
+      skip = true;
+    }
+  }
+  return NULL;
+}
+
+void run_mpmc(const int64_t elimination_width) {
+  const int64_t thread_count = 4;
+  GConf g_conf(elimination_width);
+  g_conf.loop_times = 100000;
+  g_conf.running_producers = thread_count;
+  g_conf.pop_count = 0;
+  g_conf.sum = 0;
+
+  pthread_t ppd[thread_count];
+  pthread_t cpd[thread_count];
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_create(&ppd[i], NULL, thread_producer, &g_conf);
+    pthread_create(&cpd[i], NULL, thread_consumer, &g_conf);
+  }
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_join(ppd[i], NULL);
+    pthread_join(cpd[i], NULL);
+  }
+  EXPECT_EQ(thread_count * g_conf.loop_times, g_conf.pop_count);
+  EXPECT_EQ(thread_count * (g_conf.loop_times - 1) * g_conf.loop_times / 2, g_conf.sum);
+}
+
+TEST(HALStack, mpmc) {
+  run_mpmc(0);
+  run_mpmc(1);
+  run_mpmc(HALStack<int64_t>::MAX_ELIMINATION_WIDTH);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}
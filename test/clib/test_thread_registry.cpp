@@ -0,0 +1,210 @@
+// Libhalog
+// Author: likai.root@gmail.com
+
+#include <pthread.h>
+#include <sched.h>
+#include "clib/hal_error.h"
+#include "clib/hal_thread_registry.h"
+#include "clib/hal_hazard_version.h"
+#include "clib/hal_linked_queue.h"
+#include "clib/hal_util.h"
+#include <gtest/gtest.h>
+
+using namespace libhalog;
+using namespace libhalog::clib;
+
+class TestExitHook : public HALThreadExitHook {
+  public:
+    TestExitHook() : count_(0), last_tn_(-1) {}
+    void on_thread_exit(const int64_t tn) {
+      EXPECT_EQ(tn, gettn());
+      __sync_add_and_fetch(&count_, 1);
+      ATOMIC_STORE(&last_tn_, tn);
+    }
+  public:
+    int64_t count_;
+    int64_t last_tn_;
+};
+
+void *get_tn_func(void *data) {
+  *(int64_t*)data = gettn();
+  return NULL;
+}
+
+int64_t run_get_tn() {
+  int64_t tn = -1;
+  pthread_t pd;
+  pthread_create(&pd, NULL, get_tn_func, &tn);
+  pthread_join(pd, NULL);
+  return tn;
+}
+
+TEST(HALThreadRegistry, recycle) {
+  int64_t main_tn = gettn();
+  EXPECT_EQ(main_tn, gettn());
+
+  int64_t tn = run_get_tn();
+  EXPECT_NE(main_tn, tn);
+  for (int64_t i = 0; i < 100; i++) {
+    EXPECT_EQ(tn, run_get_tn());
+  }
+}
+
+struct HoldTask {
+  int64_t tn;
+  bool exit;
+};
+
+void *hold_tn_func(void *data) {
+  HoldTask *task = (HoldTask*)data;
+  ATOMIC_STORE(&task->tn, gettn());
+  while (!ATOMIC_LOAD(&task->exit)) {
+    sched_yield();
+  }
+  return NULL;
+}
+
+TEST(HALThreadRegistry, lowest_first) {
+  const int64_t thread_count = 3;
+  HoldTask tasks[thread_count];
+  pthread_t pds[thread_count];
+  for (int64_t i = 0; i < thread_count; i++) {
+    tasks[i].tn = -1;
+    tasks[i].exit = false;
+    pthread_create(&pds[i], NULL, hold_tn_func, &tasks[i]);
+    while (-1 == ATOMIC_LOAD(&tasks[i].tn)) {
+      sched_yield();
+    }
+  }
+  EXPECT_LT(tasks[0].tn, tasks[1].tn);
+  EXPECT_LT(tasks[1].tn, tasks[2].tn);
+  // the lower number is given again although the higher one exits last
+  ATOMIC_STORE(&tasks[0].exit, true);
+  pthread_join(pds[0], NULL);
+  ATOMIC_STORE(&tasks[2].exit, true);
+  pthread_join(pds[2], NULL);
+  EXPECT_EQ(tasks[0].tn, run_get_tn());
+  ATOMIC_STORE(&tasks[1].exit, true);
+  pthread_join(pds[1], NULL);
+}
+
+TEST(HALThreadRegistry, hook) {
+  TestExitHook hook;
+  EXPECT_EQ(HAL_INVALID_PARAM, gsi<HALThreadRegistry>().add_exit_hook(NULL));
+  EXPECT_EQ(HAL_SUCCESS, gsi<HALThreadRegistry>().add_exit_hook(&hook));
+
+  int64_t tn = run_get_tn();
+  EXPECT_EQ(1, hook.count_);
+  EXPECT_EQ(tn, hook.last_tn_);
+
+  EXPECT_EQ(HAL_SUCCESS, gsi<HALThreadRegistry>().del_exit_hook(&hook));
+  run_get_tn();
+  EXPECT_EQ(1, hook.count_);
+}
+
+class GObject : public HALHazardNodeI {
+  public:
+    GObject(int64_t &counter) : counter_(counter) {
+      __sync_add_and_fetch(&counter_, 1);
+    }
+    virtual void retire() {
+      __sync_add_and_fetch(&counter_, -1);
+      delete this;
+    }
+  private:
+    int64_t &counter_;
+};
+
+struct HVTask {
+  HALHazardVersion *hv;
+  int64_t *counter;
+  bool leave_acquired;
+};
+
+void *hv_exit_func(void *data) {
+  HVTask *task = (HVTask*)data;
+  uint64_t handle = 0;
+  task->hv->acquire(handle);
+  for (int64_t i = 0; i < 16; i++) {
+    task->hv->add_node(new GObject(*task->counter));
+  }
+  if (!task->leave_acquired) {
+    task->hv->release(handle);
+  }
+  return NULL;
+}
+
+TEST(HALThreadRegistry, hazard_version) {
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  HVTask task = {&hv, &counter, false};
+  pthread_t pd;
+
+  // nodes of the exiting thread are reclaimed by its exit hook
+  pthread_create(&pd, NULL, hv_exit_func, &task);
+  pthread_join(pd, NULL);
+  EXPECT_EQ(0, counter);
+  EXPECT_EQ(0, hv.get_hazard_waiting_count());
+
+  // a thread exiting inside a critical section does not pin the nodes
+  task.leave_acquired = true;
+  pthread_create(&pd, NULL, hv_exit_func, &task);
+  pthread_join(pd, NULL);
+  EXPECT_EQ(0, counter);
+  EXPECT_EQ(0, hv.get_hazard_waiting_count());
+
+  // a reader of the main thread keeps the nodes alive after the writer exits
+  uint64_t handle = 0;
+  EXPECT_EQ(HAL_SUCCESS, hv.acquire(handle));
+  task.leave_acquired = false;
+  pthread_create(&pd, NULL, hv_exit_func, &task);
+  pthread_join(pd, NULL);
+  EXPECT_EQ(16, counter);
+  hv.release(handle);
+  hv.retire();
+  EXPECT_EQ(0, counter);
+}
+
+// Retiring it constructs and destroys an owner of a HALHazardVersion,
+// which adds and deletes an exit hook
+class QueueOwnerNode : public HALHazardNodeI {
+  public:
+    QueueOwnerNode(int64_t &counter) : counter_(counter) {
+      __sync_add_and_fetch(&counter_, 1);
+    }
+    virtual void retire() {
+      {
+        HALLinkedQueue<int64_t> queue;
+        queue.push(1);
+      }
+      __sync_add_and_fetch(&counter_, -1);
+      delete this;
+    }
+  private:
+    int64_t &counter_;
+};
+
+void *hv_exit_reclaim_func(void *data) {
+  HVTask *task = (HVTask*)data;
+  task->hv->add_node(new QueueOwnerNode(*task->counter));
+  return NULL;
+}
+
+TEST(HALThreadRegistry, hook_reclaims_hook_owner) {
+  HALHazardVersion hv;
+  int64_t counter = 0;
+  HVTask task = {&hv, &counter, false};
+  pthread_t pd;
+  // the exit hook of hv retires the node in the exiting thread, the join
+  // returns
+  for (int64_t i = 0; i < 10; i++) {
+    pthread_create(&pd, NULL, hv_exit_reclaim_func, &task);
+    pthread_join(pd, NULL);
+    EXPECT_EQ(0, counter);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc,argv);
+  return RUN_ALL_TESTS();
+}